@@ -0,0 +1,3286 @@
+// The library declared in lonely_planet.hpp, and its C interface declared
+// in lonely_planet.h.
+
+#ifdef WIN32
+// For _mkdir()
+#include <direct.h>
+#define MKDIR(directoryName) _mkdir ( directoryName )
+#else
+// For mkdir()
+#include <sys/stat.h>
+#define MKDIR(directoryName) mkdir ( directoryName, 0777 )
+// For mmap() of snapshots
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "lonely_planet.hpp"
+#include "lonely_planet.h"
+
+#include <rapidxml_print.hpp>
+
+#ifdef LP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LP_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+using namespace std;
+using namespace rapidxml;
+
+namespace lonely_planet
+{
+
+//----------------------------------------------------------------------------
+// The built-in template. Its placeholders are found by the compiler, so the
+// length of each literal segment between them is a compile-time constant
+// and HtmlGenerator can render it with fixed-size copies.
+
+constexpr char builtInTemplateText[] = "<!DOCTYPE html>\n\
+<html>\n\
+  <head>\n\
+    <meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">\n\
+    <title>Lonely Planet</title>\n\
+    <link href=\"{{root}}static/all.css\" media=\"screen\" rel=\"stylesheet\" type=\"text/css\">\n\
+  </head>\n\
+\n\
+  <body>\n\
+    <div id=\"container\">\n\
+      <div id=\"header\">\n\
+        <div id=\"logo\"></div>\n\
+        <h1>Lonely Planet: {{title}}</h1>\n\
+      </div>\n\
+\n\
+      <div id=\"wrapper\">\n\
+        <div id=\"sidebar\">\n\
+          <div class=\"block\">\n\
+            <h3>Navigation</h3>\n\
+            <div class=\"content\">\n\
+              <div class=\"inner\">\n\
+{{navigation}}\n\
+              </div>\n\
+            </div>\n\
+          </div>\n\
+        </div>\n\
+\n\
+        <div id=\"main\">\n\
+          <div class=\"block\">\n\
+            <div class=\"secondary-navigation\">\n\
+              <ul>\n\
+                <li class=\"first\"><a href=\"#\">{{title}}</a></li>\n\
+              </ul>\n\
+              <div class=\"clear\"></div>\n\
+            </div>\n\
+            <div class=\"content\">\n\
+              <div class=\"inner\">\n\
+{{content}}\n\
+              </div>\n\
+            </div>\n\
+          </div>\n\
+        </div>\n\
+      </div>\n\
+    </div>\n\
+  </body>\n\
+</html>\n";
+
+// Literal segment N runs from m_literalBegin[N] for m_literalLength[N]
+// characters and is followed by slot m_slots[N], except for the last
+// segment, N == m_slotCount, which ends the page.
+struct BuiltInTemplateLayout
+{
+    static const size_t MAX_SLOTS = 16;
+
+    size_t m_literalBegin[MAX_SLOTS + 1];
+    size_t m_literalLength[MAX_SLOTS + 1];
+    HtmlTemplate::Slot m_slots[MAX_SLOTS];
+    size_t m_slotCount;
+    size_t m_slotUses[HtmlTemplate::SLOT_COUNT];  // per kind of slot
+    size_t m_literalsLength;                      // all segments together
+    bool m_valid;                                 // all placeholders known
+};
+
+constexpr bool matchesBuiltInText
+(   size_t position,
+    const char * text
+)
+{
+    for ( size_t inx = 0; text[inx] != 0; ++inx )
+    {
+        if ( builtInTemplateText[position + inx] != text[inx] )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+constexpr size_t findInBuiltInText
+(   size_t position,
+    const char * text
+)
+{
+    for ( ; builtInTemplateText[position] != 0; ++position )
+    {
+        if ( matchesBuiltInText ( position, text ) )
+        {
+            return position;
+        }
+    }
+    return position;    // i.e. the end
+}
+
+constexpr BuiltInTemplateLayout parseBuiltInTemplate()
+{
+    BuiltInTemplateLayout layout {};
+    layout.m_valid = true;
+    size_t end = sizeof ( builtInTemplateText ) - 1;
+    size_t start = 0;
+    for(;;)
+    {
+        size_t slotStart = findInBuiltInText ( start, "{{" );
+        size_t & slotCount = layout.m_slotCount;
+        layout.m_literalBegin[slotCount] = start;
+        layout.m_literalLength[slotCount] = slotStart - start;
+        layout.m_literalsLength += slotStart - start;
+        if ( slotStart == end )
+        {
+            break;
+        }
+        if ( slotCount == BuiltInTemplateLayout::MAX_SLOTS )
+        {
+            layout.m_valid = false;
+            break;
+        }
+
+        HtmlTemplate::Slot slot = HtmlTemplate::SLOT_LITERAL;
+        if ( matchesBuiltInText ( slotStart, "{{title}}" ) )
+        {
+            slot = HtmlTemplate::SLOT_TITLE;
+        }
+        else if ( matchesBuiltInText ( slotStart, "{{navigation}}" ) )
+        {
+            slot = HtmlTemplate::SLOT_NAVIGATION;
+        }
+        else if ( matchesBuiltInText ( slotStart, "{{content}}" ) )
+        {
+            slot = HtmlTemplate::SLOT_CONTENT;
+        }
+        else if ( matchesBuiltInText ( slotStart, "{{root}}" ) )
+        {
+            slot = HtmlTemplate::SLOT_ROOT;
+        }
+        else
+        {
+            layout.m_valid = false;
+        }
+        layout.m_slots[slotCount] = slot;
+        ++layout.m_slotUses[slot];
+        ++slotCount;
+        start = findInBuiltInText ( slotStart, "}}" ) + 2;
+    }
+    return layout;
+}
+
+constexpr BuiltInTemplateLayout builtInTemplateLayout =
+    parseBuiltInTemplate();
+static_assert ( builtInTemplateLayout.m_valid,
+                "Unknown placeholder in built-in template" );
+
+//============================================================================
+// The scan for special characters is the one RapidXml's printer uses, which
+// works through 16 or 32 bytes at a time where SIMD is available. HTML has
+// no &apos;, hence the numeric reference.
+
+void appendEscapedHtml ( string & output, const char * text, size_t length )
+{
+    const char * end = text + length;
+    while ( text != end )
+    {
+        const char * special =
+            internal::find_expandable_char ( text, end, char ( 0 ) );
+        output.append ( text, special - text );
+        if ( special == end )
+        {
+            break;
+        }
+        switch ( *special )
+        {
+            case '<':   output.append ( "&lt;" );     break;
+            case '>':   output.append ( "&gt;" );     break;
+            case '&':   output.append ( "&amp;" );    break;
+            case '"':   output.append ( "&quot;" );   break;
+            case '\'':  output.append ( "&#39;" );    break;
+        }
+        text = special + 1;
+    }
+}
+
+//============================================================================
+
+XmlReader::XmlReader
+(   const char * fileSignifier,
+    const char * fileName
+) : m_fileSignifier ( fileSignifier ),
+    m_fileName ( fileName ),
+    m_bytesRead ( 0 )
+{
+    m_document.set_allocator ( allocatePoolBlock, freePoolBlock );
+    openFile();
+}
+
+//----------------------------------------------------------------------------
+
+void XmlReader::openFile()
+{
+    m_file.open ( m_fileName.c_str(), ios::in );
+    if ( ! m_file.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open " << m_fileSignifier << " file "
+                    << m_fileName << " for reading";
+        throw errorStream.str();
+    }
+}
+
+//----------------------------------------------------------------------------
+// May be called again to pick up changes to the file, in which case the
+// previous contents are discarded, and with them the document.
+
+void XmlReader::read()
+{
+    TraceRecorder::Span span ( "read", m_fileName.c_str() );
+    if ( ! m_file.is_open() )
+    {
+        openFile();
+    }
+    m_document.clear();
+    m_contents.clear();
+    m_bytesRead = 0;
+
+    string fileLine;
+    while ( getline ( m_file, fileLine ) )
+    {
+        m_contents.append ( fileLine );
+        // The last line may have had no newline for getline to consume.
+        m_bytesRead += fileLine.size() + ( m_file.eof() ? 0 : 1 );
+    }
+    m_file.close();
+}
+
+//----------------------------------------------------------------------------
+// Parse what read() read, once: parsing changes the contents in place.
+
+void XmlReader::parse()
+{
+    TraceRecorder::Span span ( "parse", m_fileName.c_str() );
+    m_document.clear();
+    m_document.set_max_depth ( s_maxDepth );
+
+    // Vile rapidxml declares input arg as char*, not const char *.
+    // 0 means default parse flags
+    m_document.parse<0> ( const_cast<char*>(m_contents.c_str()) );
+
+}
+
+//----------------------------------------------------------------------------
+// Standard "getter".
+
+const xml_document<char> & XmlReader::getDocument() const
+{
+    return m_document;
+}
+
+//----------------------------------------------------------------------------
+// Relaxed, since only the totals matter.
+
+atomic< size_t > XmlReader::s_poolBlocks ( 0 );
+atomic< size_t > XmlReader::s_poolBytes ( 0 );
+atomic< size_t > XmlReader::s_livePoolBytes ( 0 );
+
+size_t XmlReader::s_maxDepth = 0;
+
+XmlReader::PoolCounts XmlReader::getPoolCounts()
+{
+    PoolCounts poolCounts;
+    poolCounts.m_blocks = s_poolBlocks.load ( memory_order_relaxed );
+    poolCounts.m_bytes = s_poolBytes.load ( memory_order_relaxed );
+    poolCounts.m_liveBytes = s_livePoolBytes.load ( memory_order_relaxed );
+    return poolCounts;
+}
+
+//----------------------------------------------------------------------------
+// RapidXml's pool allocates through these rather than new[], so that its
+// blocks can be counted. Each block starts with its size, padded to keep
+// what follows as aligned as new would have.
+
+void * XmlReader::allocatePoolBlock ( size_t size )
+{
+    const size_t prefix = alignof ( max_align_t );
+    char * block = static_cast< char * > ( operator new ( prefix + size ) );
+    *reinterpret_cast< size_t * > ( block ) = size;
+    s_poolBlocks.fetch_add ( 1, memory_order_relaxed );
+    s_poolBytes.fetch_add ( size, memory_order_relaxed );
+    s_livePoolBytes.fetch_add ( size, memory_order_relaxed );
+    return block + prefix;
+}
+
+//----------------------------------------------------------------------------
+
+void XmlReader::freePoolBlock ( void * memory )
+{
+    char * block = static_cast< char * > ( memory )
+                   - alignof ( max_align_t );
+    s_livePoolBytes.fetch_sub ( *reinterpret_cast< size_t * > ( block ),
+                                memory_order_relaxed );
+    operator delete ( block );
+}
+
+//============================================================================
+// Parse, then find the root of the destination hierarchy.
+
+void TaxonomyReader::parse()
+{
+    m_rootNode = 0;
+    XmlReader::parse();
+
+    // First we have to skip some assumed higher-level nodes.
+    xml_node<char> * taxonomiesChild =
+        findLevel ( &m_document, "taxonomies", "first" );
+    xml_node<char> * taxonomyChild =
+        findLevel ( taxonomiesChild, "taxonomy", "second" );
+
+    // Fudge a root node for "World".
+
+    // A usable node has an attribute "atlas_node_id" and a child_node
+    // identified as "node_name".
+    // Its children are all the child_nodes identified as "node".
+    // So we start with this:
+
+    //  <taxonomies>
+    //    <taxonomy>
+    //      <taxonomy_name>World</taxonomy_name>
+    //      <node atlas_node_id = "355064" ethyl_content_object_id="82534" geo_id = "355064">
+    //        <node_name>Africa</node_name>
+    //        <node atlas_node_id = "355611" ethyl_content_object_id="3210" geo_id = "355611">
+    //          <node_name>South Africa</node_name>
+    //          <node atlas_node_id = "355612" ethyl_content_object_id="35474" geo_id = "355612">
+    //            <node_name>Cape Town</node_name>
+    //            <node atlas_node_id = "355613" ethyl_content_object_id="" geo_id = "355613">
+    //              <node_name>Table Mountain National Park</node_name>
+    //            </node>
+    //          </node>
+
+    // but we want to end up with this:
+
+    // ...
+    //
+    //    <node atlas_node_id = "1">
+    //      <node_name>World</node_name>
+    //
+    //      <node atlas_node_id = "355064" ethyl_content_object_id="82534" geo_id = "355064">
+    //        <node_name>Africa</node_name>
+    //        <node atlas_node_id = "355611" ethyl_content_object_id="3210" geo_id = "355611">
+    //          <node_name>South Africa</node_name>
+    //          <node atlas_node_id = "355612" ethyl_content_object_id="35474" geo_id = "355612">
+    //            <node_name>Cape Town</node_name>
+    //            <node atlas_node_id = "355613" ethyl_content_object_id="" geo_id = "355613">
+    //              <node_name>Table Mountain National Park</node_name>
+    //            </node>
+    //          </node>
+
+    // The added node and attribute come from the document's own pool and
+    // their strings are literals, so they last exactly as long as the rest
+    // of the document.
+
+    // Modify <taxonomy> to have an atlas_node_id=1 attribute.
+    taxonomyChild->append_attribute (
+        m_document.allocate_attribute ( "atlas_node_id", "1" ) );
+
+    // Give <taxonomy> a child data node <node_name>.
+    taxonomyChild->append_node (
+        m_document.allocate_node ( node_data, "node_name", "World" ) );
+
+    // Rename <taxonomy> as <node>.
+    taxonomyChild->name ( "node" );
+
+    m_rootNode = taxonomyChild;
+}
+
+//----------------------------------------------------------------------------
+// Find the named child which must be present at the given level of the
+// document.
+
+xml_node<char> * TaxonomyReader::findLevel
+(   xml_node<char> * parent,
+    const char * name,
+    const char * level
+) const
+{
+    xml_node<char> * child = parent->first_node ( name );
+    if ( 0 == child )
+    {
+        stringstream errorStream;
+        errorStream << "Mal-formed taxonomy document: found no " << level
+                    << "-level \"" << name << "\" element";
+        throw errorStream.str();
+    }
+    return child;
+}
+
+//============================================================================
+// Gather up all the relevant sections, in document order, however deep they
+// are: the nodes still to visit are kept on pendingNodes rather than the
+// call stack, children pushed last first so that they come off in order.
+// The caller keeps the stack's storage from one destination to the next.
+
+static void getSubTreeContent
+(   xml_node< char > * subTreeNode,
+    const set<string> & sectionNames,
+    map< string, string > & combinedContents,
+    vector< xml_node< char > * > & pendingNodes
+)
+{
+    pendingNodes.clear();
+    pendingNodes.push_back ( subTreeNode );
+    while ( ! pendingNodes.empty() )
+    {
+        xml_node< char > * node = pendingNodes.back();
+        pendingNodes.pop_back();
+        if ( sectionNames.find ( node->name() ) != sectionNames.end() )
+        {
+            xml_node< char > * contentData = node->first_node();
+            if ( contentData != 0 )
+            {
+                string & combinedContent = combinedContents[node->name()];
+                combinedContent.append ( "<p>" );
+                appendEscapedHtml ( combinedContent, contentData->value(),
+                                    contentData->value_size() );
+                combinedContent.append ( "</p>" );
+            }
+        }
+        // (RapidXml insists on there being a first child to look for the
+        // last.)
+        for ( xml_node<char> * child = ( node->first_node() != 0 )
+                                       ? node->last_node() : 0;
+              child != 0; child = child->previous_sibling() )
+        {
+            pendingNodes.push_back ( child );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Each map node is reckoned as its value plus the usual red-black tree
+// node's three links and colour. A string's characters only count when
+// they are outside the string itself, i.e. too long for it to hold them.
+
+static size_t getStringBytes ( const string & text )
+{
+    const char * data = text.data();
+    const char * object = reinterpret_cast< const char * > ( &text );
+    bool isInline = data >= object && data < object + sizeof ( text );
+    return isInline ? 0 : text.capacity() + 1;
+}
+
+static size_t getDescriptionMapsBytes
+(   const map< int, map<string, string> > & descriptions
+)
+{
+    const size_t nodeLinkBytes = 4 * sizeof ( void * );
+    size_t bytes = 0;
+    for ( map< int, map<string, string> >::const_iterator iter =
+              descriptions.begin(); iter != descriptions.end(); ++iter )
+    {
+        bytes += nodeLinkBytes + sizeof ( *iter );
+        for ( map<string, string>::const_iterator sectionIter =
+                  iter->second.begin(); sectionIter != iter->second.end();
+              ++sectionIter )
+        {
+            bytes += nodeLinkBytes + sizeof ( *sectionIter )
+                     + getStringBytes ( sectionIter->first )
+                     + getStringBytes ( sectionIter->second );
+        }
+    }
+    return bytes;
+}
+
+//----------------------------------------------------------------------------
+// Whether the name (not NUL-terminated) is the given one.
+
+static bool isName
+(   const char * name,
+    size_t nameSize,
+    const char * wantedName,
+    size_t wantedNameSize
+)
+{
+    return nameSize == wantedNameSize
+           && memcmp ( name, wantedName, nameSize ) == 0;
+}
+
+//----------------------------------------------------------------------------
+// Destinations are selected at the top level, as in a single destination's
+// text, or in a destinations element there. Within a destination, the
+// nearest ancestor built is the destination itself or a section.
+
+filter_action SectionsFilter::filter
+(   const xml_node<char> * parent,
+    const char * name,
+    size_t nameSize,
+    size_t
+)
+{
+    static const char destinationName[] = "destination";
+    static const char destinationsName[] = "destinations";
+    bool isDestination = isName ( name, nameSize, destinationName,
+                                  sizeof ( destinationName ) - 1 );
+    if ( parent->type() == node_document )
+    {
+        return ( isDestination
+                 || isName ( name, nameSize, destinationsName,
+                             sizeof ( destinationsName ) - 1 ) )
+               ? filter_select : filter_skip;
+    }
+    if ( isName ( parent->name(), parent->name_size(), destinationsName,
+                  sizeof ( destinationsName ) - 1 ) )
+    {
+        return isDestination ? filter_select : filter_skip;
+    }
+    for ( set<string>::const_iterator nameIter = m_sectionNames->begin();
+          nameIter != m_sectionNames->end(); ++nameIter )
+    {
+        if ( isName ( name, nameSize, nameIter->data(), nameIter->size() ) )
+        {
+            return filter_keep;
+        }
+    }
+    return filter_transparent;
+}
+
+//----------------------------------------------------------------------------
+
+void DestinationsReader::selectSections ( const set<string> & sectionNames )
+{
+    m_sectionsFilter.setSectionNames ( &sectionNames );
+    m_document.set_filter ( &m_sectionsFilter );
+}
+
+//----------------------------------------------------------------------------
+// Look through all the "destination" children of the top-level "destinations"
+// node and get their descriptions.
+
+void DestinationsReader::generateDestinationDescriptions
+(   const set<string> & sectionNames
+)
+{
+    TraceRecorder::Span span ( "generateDestinationDescriptions",
+                               getFileName() );
+    m_sectionNames = &sectionNames;
+    m_descriptions.clear();
+    xml_node<char> * destinationsChild = m_document.first_node (
+        "destinations" );
+    if ( destinationsChild != 0 )
+    {
+        for ( xml_node<char> * destination = destinationsChild->first_node (
+                  "destination" );
+              destination != 0;
+              destination = destination->next_sibling ( "destination" ) )
+        {
+            xml_attribute< char > * atlas_id =
+                destination->first_attribute ( "atlas_id" );
+            if ( atlas_id != 0 )
+            {
+                for ( set<string>::const_iterator iter = m_sectionNames->begin();
+                      iter != m_sectionNames->end(); ++iter )
+                {
+                    m_combinedContents[*iter] = "";
+                }
+                // Pick up all content from sub-tree.
+                getSubTreeContent ( destination, *m_sectionNames,
+                                    m_combinedContents, m_pendingNodes );
+                for ( set<string>::const_iterator iter = m_sectionNames->begin();
+                      iter != m_sectionNames->end(); ++iter )
+                m_descriptions.insert ( pair< int, map< string, string > > (
+                    atoi ( atlas_id->value() ), m_combinedContents ) );
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// After the file has been read again: regenerate the descriptions for the
+// same sections, and report which destinations' descriptions have been
+// added, removed or changed.
+
+void DestinationsReader::regenerateDestinationDescriptions
+(   set<int> & changedNodeIds
+)
+{
+    map< int, map<string, string> > previousDescriptions;
+    previousDescriptions.swap ( m_descriptions );
+    generateDestinationDescriptions ( *m_sectionNames );
+
+    map< int, map<string, string> >::const_iterator previous =
+        previousDescriptions.begin();
+    map< int, map<string, string> >::const_iterator current =
+        m_descriptions.begin();
+    while ( previous != previousDescriptions.end()
+            || current != m_descriptions.end() )
+    {
+        if ( current == m_descriptions.end()
+             || ( previous != previousDescriptions.end()
+                  && previous->first < current->first ) )
+        {
+            changedNodeIds.insert ( previous->first );
+            ++previous;
+        }
+        else if ( previous == previousDescriptions.end()
+                  || current->first < previous->first )
+        {
+            changedNodeIds.insert ( current->first );
+            ++current;
+        }
+        else
+        {
+            if ( previous->second != current->second )
+            {
+                changedNodeIds.insert ( current->first );
+            }
+            ++previous;
+            ++current;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+size_t DestinationsReader::getDescriptionsBytes() const
+{
+    return getDescriptionMapsBytes ( m_descriptions );
+}
+
+//============================================================================
+
+DestinationsIndex::DestinationsIndex ( const char * fileName ) :
+    m_fileName ( fileName ),
+    m_contents ( 0 ),
+    m_size ( 0 ),
+    m_mapping ( 0 ),
+    m_sectionNames ( 0 )
+{
+}
+
+//----------------------------------------------------------------------------
+
+DestinationsIndex::~DestinationsIndex()
+{
+    release();
+}
+
+//----------------------------------------------------------------------------
+
+void DestinationsIndex::release()
+{
+#ifndef WIN32
+    if ( m_mapping != 0 )
+    {
+        munmap ( m_mapping, m_size );
+        m_mapping = 0;
+    }
+#endif
+    m_storage.clear();
+    m_contents = 0;
+    m_size = 0;
+}
+
+//----------------------------------------------------------------------------
+// Map the file, or where that can't be done, read it in. The sections
+// already parsed are forgotten.
+
+void DestinationsIndex::build ( const set<string> & sectionNames )
+{
+    TraceRecorder::Span span ( "DestinationsIndex::build", getFileName() );
+    m_sectionNames = &sectionNames;
+    m_sectionsFilter.setSectionNames ( &sectionNames );
+    m_sections.clear();
+    m_entries.clear();
+    release();
+    mapFile();
+    scan();
+    stable_sort ( m_entries.begin(), m_entries.end(), EntryLess() );
+}
+
+//----------------------------------------------------------------------------
+
+void DestinationsIndex::mapFile()
+{
+    stringstream errorStream;
+    errorStream << "Failed to open destinations file " << m_fileName
+                << " for reading";
+
+#ifndef WIN32
+    int fileDescriptor = open ( m_fileName.c_str(), O_RDONLY );
+    if ( fileDescriptor < 0 )
+    {
+        throw errorStream.str();
+    }
+    struct stat fileStatus;
+    if ( fstat ( fileDescriptor, &fileStatus ) != 0 )
+    {
+        close ( fileDescriptor );
+        throw errorStream.str();
+    }
+    if ( fileStatus.st_size != 0 )
+    {
+        void * mapping = mmap ( 0, fileStatus.st_size, PROT_READ,
+                                MAP_SHARED, fileDescriptor, 0 );
+        if ( mapping == MAP_FAILED )
+        {
+            close ( fileDescriptor );
+            throw errorStream.str();
+        }
+        m_mapping = mapping;
+        m_contents = static_cast< const char * > ( mapping );
+        m_size = fileStatus.st_size;
+    }
+    close ( fileDescriptor );
+#else
+    ifstream destinationsFile ( m_fileName.c_str(), ios::in | ios::binary );
+    if ( ! destinationsFile )
+    {
+        throw errorStream.str();
+    }
+    stringstream contents;
+    contents << destinationsFile.rdbuf();
+    m_storage = contents.str();
+    m_contents = m_storage.data();
+    m_size = m_storage.size();
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Where text starts with the given tag name, followed by the end of the
+// name; false if it doesn't, or runs out first.
+
+static bool isTagName
+(   const char * text,
+    const char * end,
+    const char * name,
+    size_t nameLength
+)
+{
+    if ( size_t ( end - text ) <= nameLength
+         || memcmp ( text, name, nameLength ) != 0 )
+    {
+        return false;
+    }
+    char next = text[nameLength];
+    return next == '>' || next == '/' || next == ' ' || next == '\t'
+           || next == '\n' || next == '\r';
+}
+
+//----------------------------------------------------------------------------
+// Just past the first occurrence of terminator from text on, or end if
+// there is none.
+
+static const char * skipPast
+(   const char * text,
+    const char * end,
+    const char * terminator,
+    size_t terminatorLength
+)
+{
+    while ( text < end )
+    {
+        const char * found = static_cast< const char * > (
+            memchr ( text, terminator[0], end - text ) );
+        if ( found == 0 || size_t ( end - found ) < terminatorLength )
+        {
+            break;
+        }
+        if ( memcmp ( found, terminator, terminatorLength ) == 0 )
+        {
+            return found + terminatorLength;
+        }
+        text = found + 1;
+    }
+    return end;
+}
+
+//----------------------------------------------------------------------------
+// Go through a start tag's attributes, quotes and all, to its closing ">",
+// noting the value of any atlas_id on the way. Returns just past the ">",
+// or end if the tag doesn't close.
+
+static const char * scanStartTag
+(   const char * text,
+    const char * end,
+    const char * & atlasId,
+    bool & isEmpty
+)
+{
+    static const char atlasIdName[] = "atlas_id";
+    atlasId = 0;
+    isEmpty = false;
+    while ( text < end )
+    {
+        char next = *text;
+        if ( next == '>' )
+        {
+            isEmpty = text[-1] == '/';
+            return text + 1;
+        }
+        if ( next == '"' || next == '\'' )
+        {
+            const char * value = text + 1;
+            const char * closeQuote = static_cast< const char * > (
+                memchr ( value, next, end - value ) );
+            if ( closeQuote == 0 )
+            {
+                break;
+            }
+            text = closeQuote + 1;
+        }
+        else if ( next == '=' )
+        {
+            // Is the name before it (and any spaces) atlas_id?
+            const char * nameEnd = text;
+            while ( nameEnd[-1] == ' ' || nameEnd[-1] == '\t'
+                    || nameEnd[-1] == '\n' || nameEnd[-1] == '\r' )
+            {
+                --nameEnd;
+            }
+            const char * nameBegin = nameEnd - ( sizeof ( atlasIdName ) - 1 );
+            const char * value = text + 1;
+            while ( value < end && ( *value == ' ' || *value == '\t'
+                                     || *value == '\n' || *value == '\r' ) )
+            {
+                ++value;
+            }
+            if ( memcmp ( nameBegin, atlasIdName,
+                          sizeof ( atlasIdName ) - 1 ) == 0
+                 && ( nameBegin[-1] == ' ' || nameBegin[-1] == '\t'
+                      || nameBegin[-1] == '\n' || nameBegin[-1] == '\r' )
+                 && value < end && ( *value == '"' || *value == '\'' ) )
+            {
+                atlasId = value + 1;
+            }
+            text = value;
+        }
+        else
+        {
+            ++text;
+        }
+    }
+    return end;
+}
+
+//----------------------------------------------------------------------------
+// The one pass over the file: find each top-level destination element,
+// skipping anything inside CDATA sections, comments and processing
+// instructions, where a "<destination" is just text. Like the eager
+// reader, only destinations with an atlas_id are kept; unlike it, where
+// they are in the file doesn't matter. No other checking is done until a
+// destination is parsed.
+
+void DestinationsIndex::scan()
+{
+    static const char startTag[] = "<destination";
+    static const char endTag[] = "</destination";
+    const char * end = m_contents + m_size;
+    const char * text = m_contents;
+    const char * destinationBegin = 0;
+    const char * destinationAtlasId = 0;
+    size_t depth = 0;           // of destination elements
+    while ( text < end )
+    {
+        text = static_cast< const char * > ( memchr ( text, '<',
+                                                      end - text ) );
+        if ( text == 0 )
+        {
+            break;
+        }
+        if ( end - text >= 9 && memcmp ( text, "<![CDATA[", 9 ) == 0 )
+        {
+            text = skipPast ( text + 9, end, "]]>", 3 );
+        }
+        else if ( end - text >= 4 && memcmp ( text, "<!--", 4 ) == 0 )
+        {
+            text = skipPast ( text + 4, end, "-->", 3 );
+        }
+        else if ( end - text >= 2 && text[1] == '?' )
+        {
+            text = skipPast ( text + 2, end, "?>", 2 );
+        }
+        else if ( isTagName ( text, end, startTag, sizeof ( startTag ) - 1 ) )
+        {
+            const char * atlasId;
+            bool isEmpty;
+            const char * tagEnd = scanStartTag (
+                text + sizeof ( startTag ) - 1, end, atlasId, isEmpty );
+            if ( depth == 0 )
+            {
+                destinationBegin = text;
+                destinationAtlasId = atlasId;
+            }
+            if ( ! isEmpty )
+            {
+                ++depth;
+            }
+            else if ( depth == 0 && destinationAtlasId != 0 )
+            {
+                Entry entry;
+                entry.m_nodeId = atoi ( destinationAtlasId );
+                entry.m_begin = destinationBegin - m_contents;
+                entry.m_end = tagEnd - m_contents;
+                m_entries.push_back ( entry );
+            }
+            text = tagEnd;
+        }
+        else if ( isTagName ( text, end, endTag, sizeof ( endTag ) - 1 ) )
+        {
+            const char * tagEnd = skipPast ( text, end, ">", 1 );
+            if ( depth != 0 && --depth == 0 && destinationAtlasId != 0 )
+            {
+                Entry entry;
+                entry.m_nodeId = atoi ( destinationAtlasId );
+                entry.m_begin = destinationBegin - m_contents;
+                entry.m_end = tagEnd - m_contents;
+                m_entries.push_back ( entry );
+            }
+            text = tagEnd;
+        }
+        else
+        {
+            ++text;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Looked up and kept under the lock, but parsed outside it, so that other
+// threads' pages needn't wait. Should two threads parse the same
+// destination at once, the first to finish wins; the other's is the same.
+
+const map< string, string > * DestinationsIndex::getSections
+(   int nodeId
+) const
+{
+    Entry key;
+    key.m_nodeId = nodeId;
+    vector< Entry >::const_iterator entryIter =
+        lower_bound ( m_entries.begin(), m_entries.end(), key, EntryLess() );
+    if ( entryIter == m_entries.end() || entryIter->m_nodeId != nodeId )
+    {
+        return 0;
+    }
+    {
+        lock_guard< mutex > lock ( m_sectionsMutex );
+        map< int, map< string, string > >::const_iterator sectionsIter =
+            m_sections.find ( nodeId );
+        if ( sectionsIter != m_sections.end() )
+        {
+            return &sectionsIter->second;
+        }
+    }
+
+    map< string, string > sections;
+    parseDestination ( *entryIter, sections );
+    lock_guard< mutex > lock ( m_sectionsMutex );
+    pair< map< int, map< string, string > >::iterator, bool > inserted =
+        m_sections.insert ( make_pair ( nodeId, map< string, string >() ) );
+    if ( inserted.second )
+    {
+        inserted.first->second.swap ( sections );
+    }
+    return &inserted.first->second;
+}
+
+//----------------------------------------------------------------------------
+// RapidXml parses in place, so the destination's text is copied out of the
+// (read-only) mapping first. Each thread keeps a document on the heap for
+// this, rather than making one each time: its static pool is too big for
+// the stacks some threads have, and for a heap allocation per destination.
+// A parse error is passed on pointing into the mapping rather than the copy,
+// which is gone by the time anyone looks.
+
+void DestinationsIndex::parseDestination
+(   const Entry & entry,
+    map< string, string > & sections
+) const
+{
+    TraceRecorder::Span span ( "parseDestination", getFileName(),
+                               entry.m_nodeId );
+    string text ( m_contents + entry.m_begin, entry.m_end - entry.m_begin );
+    static thread_local unique_ptr< xml_document<char> > document;
+    if ( ! document )
+    {
+        document.reset ( new xml_document<char> );
+    }
+    document->clear();
+    document->set_max_depth ( XmlReader::getMaxDepth() );
+    document->set_filter ( &m_sectionsFilter );
+    try
+    {
+        document->parse<0> ( &text[0] );
+    }
+    catch ( const parse_error & error )
+    {
+        throw parse_error ( error.what(),
+            const_cast< char * > ( m_contents ) + entry.m_begin
+                + ( error.where<char>() - &text[0] ) );
+    }
+
+    for ( set<string>::const_iterator nameIter = m_sectionNames->begin();
+          nameIter != m_sectionNames->end(); ++nameIter )
+    {
+        sections[*nameIter] = "";
+    }
+    vector< xml_node< char > * > pendingNodes;
+    getSubTreeContent ( document->first_node(), *m_sectionNames, sections,
+                        pendingNodes );
+}
+
+//----------------------------------------------------------------------------
+
+size_t DestinationsIndex::getParsedCount() const
+{
+    lock_guard< mutex > lock ( m_sectionsMutex );
+    return m_sections.size();
+}
+
+//----------------------------------------------------------------------------
+
+size_t DestinationsIndex::getSectionsBytes() const
+{
+    lock_guard< mutex > lock ( m_sectionsMutex );
+    return getDescriptionMapsBytes ( m_sections )
+           + m_entries.capacity() * sizeof ( Entry );
+}
+
+//============================================================================
+
+static const char SNAPSHOT_MAGIC[8] = { 'L', 'P', 'M', 'O', 'D', 'E', 'L', 0 };
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+//----------------------------------------------------------------------------
+// Starts out as an empty model, for which the header alone is enough.
+
+SiteModel::SiteModel() :
+    m_mapping ( 0 ),
+    m_mappingSize ( 0 )
+{
+    m_storage.assign ( ( sizeof ( Header ) + 7 ) / 8, 0 );
+    m_base = reinterpret_cast< const char * > ( &m_storage[0] );
+    m_header = reinterpret_cast< const Header * > ( m_base );
+}
+
+//----------------------------------------------------------------------------
+
+SiteModel::~SiteModel()
+{
+    release();
+}
+
+//----------------------------------------------------------------------------
+
+void SiteModel::release()
+{
+#ifndef WIN32
+    if ( m_mapping != 0 )
+    {
+        munmap ( m_mapping, m_mappingSize );
+        m_mapping = 0;
+        m_mappingSize = 0;
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+
+void SiteModel::build
+(   const TaxonomyReader & taxonomyReader,
+    const DestinationsReader & destinationsReader
+)
+{
+    build ( taxonomyReader, destinationsReader.getSectionNames(),
+            destinationsReader.getDescriptions() );
+}
+
+//----------------------------------------------------------------------------
+
+void SiteModel::build
+(   const TaxonomyReader & taxonomyReader,
+    const set<string> & sectionNames
+)
+{
+    build ( taxonomyReader, sectionNames,
+            map< int, map< string, string > >() );
+}
+
+//----------------------------------------------------------------------------
+// Flatten the taxonomy tree and the destinations' descriptions into a new
+// block, replacing whatever the model held before.
+
+void SiteModel::build
+(   const TaxonomyReader & taxonomyReader,
+    const set<string> & destinationsSectionNames,
+    const map< int, map< string, string > > & destinationsDescriptions
+)
+{
+    TraceRecorder::Span span ( "SiteModel::build" );
+    xml_node<char> * rootNode = taxonomyReader.getRootNode();
+    if ( 0 == rootNode )
+    {
+        throw string ( "No taxonomy has been read" );
+    }
+
+    string text;
+    vector< SectionName > sectionNames;
+    map< string, uint32_t > sectionNameIndexes;
+    for ( set<string>::const_iterator nameIter =
+              destinationsSectionNames.begin();
+          nameIter != destinationsSectionNames.end(); ++nameIter )
+    {
+        SectionName sectionName;
+        sectionName.m_offset = text.size();
+        sectionName.m_length = nameIter->size();
+        sectionName.m_unused = 0;
+        sectionNameIndexes[*nameIter] = sectionNames.size();
+        sectionNames.push_back ( sectionName );
+        text.append ( *nameIter );
+    }
+
+    vector< Description > descriptions;
+    vector< Section > sections;
+    map< int, uint32_t > descriptionIndexes;
+    for ( map< int, map< string, string > >::const_iterator descriptionIter =
+              destinationsDescriptions.begin();
+          descriptionIter != destinationsDescriptions.end();
+          ++descriptionIter )
+    {
+        Description description;
+        description.m_nodeId = descriptionIter->first;
+        description.m_firstSection = sections.size();
+        description.m_sectionCount = descriptionIter->second.size();
+        descriptionIndexes[descriptionIter->first] = descriptions.size();
+        descriptions.push_back ( description );
+
+        for ( map< string, string >::const_iterator sectionIter =
+                  descriptionIter->second.begin();
+              sectionIter != descriptionIter->second.end(); ++sectionIter )
+        {
+            Section section;
+            section.m_contentOffset = text.size();
+            section.m_contentLength = sectionIter->second.size();
+            section.m_nameIndex = sectionNameIndexes[sectionIter->first];
+            sections.push_back ( section );
+            text.append ( sectionIter->second );
+        }
+    }
+
+    vector< Node > nodes;
+    addNodes ( rootNode, NONE, descriptionIndexes, nodes, text );
+
+    // Where a node-id is repeated, lookups find the first in pre-order.
+    vector< NodeIndexEntry > nodeIndex;
+    for ( size_t index = 0; index < nodes.size(); ++index )
+    {
+        if ( nodes[index].m_idLength != 0 )
+        {
+            NodeIndexEntry entry;
+            entry.m_nodeId = nodes[index].m_nodeId;
+            entry.m_index = index;
+            nodeIndex.push_back ( entry );
+        }
+    }
+    stable_sort ( nodeIndex.begin(), nodeIndex.end(),
+                  NodeIndexEntryLess() );
+
+    // Lay the tables out one after another, then copy them into place.
+    Header header;
+    memset ( &header, 0, sizeof ( header ) );
+    memcpy ( header.m_magic, SNAPSHOT_MAGIC, sizeof ( header.m_magic ) );
+    header.m_version = SNAPSHOT_VERSION;
+    header.m_byteOrder = BYTE_ORDER_MARK;
+    size_t size = sizeof ( Header );
+    placeTable ( header.m_nodes, nodes, size );
+    placeTable ( header.m_nodeIndex, nodeIndex, size );
+    placeTable ( header.m_descriptions, descriptions, size );
+    placeTable ( header.m_sections, sections, size );
+    placeTable ( header.m_sectionNames, sectionNames, size );
+    vector< char > textTable ( text.begin(), text.end() );
+    placeTable ( header.m_text, textTable, size );
+    header.m_size = size;
+
+    release();
+    m_storage.assign ( ( size + 7 ) / 8, 0 );
+    m_base = reinterpret_cast< const char * > ( &m_storage[0] );
+    m_header = reinterpret_cast< const Header * > ( m_base );
+    memcpy ( &m_storage[0], &header, sizeof ( header ) );
+    copyTable ( header.m_nodes, nodes );
+    copyTable ( header.m_nodeIndex, nodeIndex );
+    copyTable ( header.m_descriptions, descriptions );
+    copyTable ( header.m_sections, sections );
+    copyTable ( header.m_sectionNames, sectionNames );
+    copyTable ( header.m_text, textTable );
+}
+
+//----------------------------------------------------------------------------
+// Pre-order, over the same nodes that HtmlGenerator makes pages of, however
+// deep the tree is: the nodes still to add are kept on an explicit stack,
+// each with its parent's index, and children are pushed last first so that
+// they come off in order. Each node's subtree size is added into its
+// parent's once all the nodes are in, working backwards, since a parent
+// always comes before its children. Returns the size of the subtree.
+
+uint32_t SiteModel::addNodes
+(   xml_node<char> * subTreeNode,
+    uint32_t subTreeParentIndex,
+    const map< int, uint32_t > & descriptionIndexes,
+    vector< Node > & nodes,
+    string & text
+)
+{
+    uint32_t subTreeIndex = nodes.size();
+    vector< pair< xml_node<char> *, uint32_t > > pendingNodes;
+    pendingNodes.push_back ( make_pair ( subTreeNode, subTreeParentIndex ) );
+    while ( ! pendingNodes.empty() )
+    {
+        xml_node<char> * node = pendingNodes.back().first;
+        uint32_t index = nodes.size();
+        addNode ( node, pendingNodes.back().second, descriptionIndexes,
+                  nodes, text );
+        pendingNodes.pop_back();
+
+        // Its children are all the child_nodes identified as "node". (RapidXml
+        // insists on there being a first child to look for the last.)
+        for ( xml_node<char> * child = ( node->first_node() != 0 )
+                                       ? node->last_node ( "node" ) : 0;
+              child != 0; child = child->previous_sibling ( "node" ) )
+        {
+            pendingNodes.push_back ( make_pair ( child, index ) );
+        }
+    }
+
+    for ( uint32_t index = nodes.size() - 1; index > subTreeIndex; --index )
+    {
+        nodes[nodes[index].m_parentIndex].m_subTreeSize +=
+            nodes[index].m_subTreeSize;
+    }
+    return nodes[subTreeIndex].m_subTreeSize;
+}
+
+//----------------------------------------------------------------------------
+// Just the node itself, as a subtree of one so far.
+
+void SiteModel::addNode
+(   xml_node<char> * node,
+    uint32_t parentIndex,
+    const map< int, uint32_t > & descriptionIndexes,
+    vector< Node > & nodes,
+    string & text
+)
+{
+    Node modelNode;
+    memset ( &modelNode, 0, sizeof ( modelNode ) );
+    modelNode.m_parentIndex = parentIndex;
+    modelNode.m_descriptionIndex = NONE;
+
+    // A usable node has an attribute "atlas_node_id" and a child_node
+    // identified as "node_name".
+    xml_attribute< char > * atlas_node_id =
+        node->first_attribute ( "atlas_node_id" );
+    xml_node< char > * node_name = node->first_node ( "node_name" );
+    if ( atlas_node_id != 0 && node_name != 0
+         && atlas_node_id->value_size() != 0 )
+    {
+        modelNode.m_idOffset = text.size();
+        modelNode.m_idLength = atlas_node_id->value_size();
+        text.append ( atlas_node_id->value(), atlas_node_id->value_size() );
+        text.append ( 1, '\0' );
+        modelNode.m_nameOffset = text.size();
+        modelNode.m_nameLength = node_name->value_size();
+        text.append ( node_name->value(), node_name->value_size() );
+        modelNode.m_nodeId = atoi ( atlas_node_id->value() );
+
+        map< int, uint32_t >::const_iterator descriptionIter =
+            descriptionIndexes.find ( modelNode.m_nodeId );
+        if ( descriptionIter != descriptionIndexes.end() )
+        {
+            modelNode.m_descriptionIndex = descriptionIter->second;
+        }
+    }
+    modelNode.m_subTreeSize = 1;
+    nodes.push_back ( modelNode );
+}
+
+//----------------------------------------------------------------------------
+// Every table starts on an 8-byte boundary.
+
+template < class Entry >
+void SiteModel::placeTable
+(   Table & table,
+    const vector< Entry > & entries,
+    size_t & size
+) const
+{
+    table.m_offset = ( size + 7 ) & ~size_t ( 7 );
+    table.m_count = entries.size();
+    size = table.m_offset + entries.size() * sizeof ( Entry );
+}
+
+//----------------------------------------------------------------------------
+
+template < class Entry >
+void SiteModel::copyTable
+(   const Table & table,
+    const vector< Entry > & entries
+)
+{
+    if ( ! entries.empty() )
+    {
+        memcpy ( reinterpret_cast< char * > ( &m_storage[0] ) + table.m_offset,
+                 &entries[0], entries.size() * sizeof ( Entry ) );
+    }
+}
+
+//----------------------------------------------------------------------------
+// The block is written exactly as it is held.
+
+void SiteModel::saveSnapshot ( const char * snapshotFileName ) const
+{
+    ofstream snapshotFile ( snapshotFileName,
+                            ios::out | ios::binary | ios::trunc );
+    if ( ! snapshotFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open snapshot file " << snapshotFileName
+                    << " for writing";
+        throw errorStream.str();
+    }
+    snapshotFile.write ( m_base, m_header->m_size );
+    if ( ! snapshotFile )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to write snapshot file " << snapshotFileName;
+        throw errorStream.str();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Map the file read-only and use it where it lies: pages of it are only
+// read in from disk when rendering first touches them. (Without mmap, just
+// read the whole file.) The file is checked before it replaces anything, so
+// if it won't do, the model is left as it was.
+
+void SiteModel::loadSnapshot ( const char * snapshotFileName )
+{
+    stringstream errorStream;
+    errorStream << "Failed to read snapshot file " << snapshotFileName;
+
+#ifndef WIN32
+    int fileDescriptor = open ( snapshotFileName, O_RDONLY );
+    if ( fileDescriptor < 0 )
+    {
+        throw errorStream.str();
+    }
+    struct stat fileStatus;
+    void * mapping = MAP_FAILED;
+    if ( fstat ( fileDescriptor, &fileStatus ) == 0
+         && fileStatus.st_size >= off_t ( sizeof ( Header ) ) )
+    {
+        mapping = mmap ( 0, fileStatus.st_size, PROT_READ, MAP_SHARED,
+                         fileDescriptor, 0 );
+    }
+    close ( fileDescriptor );
+    if ( mapping == MAP_FAILED )
+    {
+        throw errorStream.str();
+    }
+    try
+    {
+        checkSnapshot ( snapshotFileName,
+                        static_cast< const Header * > ( mapping ),
+                        fileStatus.st_size );
+    }
+    catch ( ... )
+    {
+        munmap ( mapping, fileStatus.st_size );
+        throw;
+    }
+
+    release();
+    m_mapping = mapping;
+    m_mappingSize = fileStatus.st_size;
+    m_base = static_cast< const char * > ( mapping );
+#else
+    ifstream snapshotFile ( snapshotFileName, ios::in | ios::binary );
+    snapshotFile.seekg ( 0, ios::end );
+    size_t fileSize = snapshotFile.tellg();
+    snapshotFile.seekg ( 0, ios::beg );
+    if ( ! snapshotFile || fileSize < sizeof ( Header ) )
+    {
+        throw errorStream.str();
+    }
+    vector< uint64_t > storage ( ( fileSize + 7 ) / 8, 0 );
+    snapshotFile.read ( reinterpret_cast< char * > ( &storage[0] ),
+                        fileSize );
+    checkSnapshot ( snapshotFileName,
+                    reinterpret_cast< const Header * > ( &storage[0] ),
+                    fileSize );
+
+    m_storage.swap ( storage );
+    m_base = reinterpret_cast< const char * > ( &m_storage[0] );
+    m_mappingSize = fileSize;
+#endif
+    m_header = reinterpret_cast< const Header * > ( m_base );
+}
+
+//----------------------------------------------------------------------------
+// Check the header, that every table lies within the file, and that every
+// entry's indices and offsets lie within the tables they refer to, so that
+// a damaged or stale file is turned away rather than read beyond. That
+// reads each table once, which is still little next to parsing the XML.
+
+void SiteModel::checkSnapshot
+(   const char * snapshotFileName,
+    const Header * header,
+    size_t size
+)
+{
+    const char * problem = 0;
+    if ( memcmp ( header->m_magic, SNAPSHOT_MAGIC,
+                  sizeof ( SNAPSHOT_MAGIC ) ) != 0 )
+    {
+        problem = "is not a snapshot";
+    }
+    else if ( header->m_version != SNAPSHOT_VERSION )
+    {
+        problem = "was written by a different version";
+    }
+    else if ( header->m_byteOrder != BYTE_ORDER_MARK )
+    {
+        problem = "was written with a different byte order";
+    }
+    else if ( header->m_size != size )
+    {
+        problem = "is truncated";
+    }
+    else
+    {
+        const Table * tables[] =
+        {
+            &header->m_nodes, &header->m_nodeIndex,
+            &header->m_descriptions, &header->m_sections,
+            &header->m_sectionNames, &header->m_text
+        };
+        const size_t entrySizes[] =
+        {
+            sizeof ( Node ), sizeof ( NodeIndexEntry ),
+            sizeof ( Description ), sizeof ( Section ),
+            sizeof ( SectionName ), sizeof ( char )
+        };
+        for ( size_t inx = 0; inx < sizeof ( tables ) / sizeof ( tables[0] );
+              ++inx )
+        {
+            if ( tables[inx]->m_offset % 8 != 0
+                 || tables[inx]->m_offset > size
+                 || tables[inx]->m_count
+                    > ( size - tables[inx]->m_offset ) / entrySizes[inx] )
+            {
+                problem = "is corrupt";
+            }
+        }
+        if ( problem == 0 && ! areSnapshotEntriesValid ( header ) )
+        {
+            problem = "is corrupt";
+        }
+    }
+
+    if ( problem != 0 )
+    {
+        stringstream errorStream;
+        errorStream << "Snapshot file " << snapshotFileName << " " << problem;
+        throw errorStream.str();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Whether the length bytes at offset lie within text of textSize bytes.
+
+static bool isInText
+(   uint64_t offset,
+    uint64_t length,
+    uint64_t textSize
+)
+{
+    return offset <= textSize && length <= textSize - offset;
+}
+
+//----------------------------------------------------------------------------
+// The tables themselves are known to lie within the file. Each node's parent
+// comes before it and its subtree ends within the nodes, as in pre-order, so
+// that walking up or across the tree always ends; its id is NUL-terminated,
+// for use as a C string.
+
+bool SiteModel::areSnapshotEntriesValid ( const Header * header )
+{
+    const char * base = reinterpret_cast< const char * > ( header );
+    const char * text = base + header->m_text.m_offset;
+    uint64_t textSize = header->m_text.m_count;
+    uint64_t nodeCount = header->m_nodes.m_count;
+    uint64_t descriptionCount = header->m_descriptions.m_count;
+    uint64_t sectionCount = header->m_sections.m_count;
+    uint64_t sectionNameCount = header->m_sectionNames.m_count;
+
+    const Node * nodes =
+        reinterpret_cast< const Node * > ( base + header->m_nodes.m_offset );
+    for ( uint64_t inx = 0; inx < nodeCount; ++inx )
+    {
+        const Node & node = nodes[inx];
+        if ( ( node.m_parentIndex == NONE ) != ( inx == 0 )
+             || ( inx != 0 && node.m_parentIndex >= inx )
+             || node.m_subTreeSize == 0
+             || node.m_subTreeSize > nodeCount - inx
+             || ( node.m_descriptionIndex != NONE
+                  && node.m_descriptionIndex >= descriptionCount )
+             || ! isInText ( node.m_nameOffset, node.m_nameLength, textSize )
+             || ! isInText ( node.m_idOffset, uint64_t ( node.m_idLength ) + 1,
+                             textSize )
+             || text[node.m_idOffset + node.m_idLength] != 0 )
+        {
+            return false;
+        }
+    }
+
+    const NodeIndexEntry * nodeIndex =
+        reinterpret_cast< const NodeIndexEntry * > (
+            base + header->m_nodeIndex.m_offset );
+    for ( uint64_t inx = 0; inx < header->m_nodeIndex.m_count; ++inx )
+    {
+        if ( nodeIndex[inx].m_index >= nodeCount
+             || ( inx != 0
+                  && nodeIndex[inx].m_nodeId < nodeIndex[inx - 1].m_nodeId ) )
+        {
+            return false;
+        }
+    }
+
+    const Description * descriptions =
+        reinterpret_cast< const Description * > (
+            base + header->m_descriptions.m_offset );
+    for ( uint64_t inx = 0; inx < descriptionCount; ++inx )
+    {
+        if ( descriptions[inx].m_firstSection > sectionCount
+             || descriptions[inx].m_sectionCount
+                > sectionCount - descriptions[inx].m_firstSection )
+        {
+            return false;
+        }
+    }
+
+    const Section * sections = reinterpret_cast< const Section * > (
+        base + header->m_sections.m_offset );
+    for ( uint64_t inx = 0; inx < sectionCount; ++inx )
+    {
+        if ( sections[inx].m_nameIndex >= sectionNameCount
+             || ! isInText ( sections[inx].m_contentOffset,
+                             sections[inx].m_contentLength, textSize ) )
+        {
+            return false;
+        }
+    }
+
+    const SectionName * sectionNames =
+        reinterpret_cast< const SectionName * > (
+            base + header->m_sectionNames.m_offset );
+    for ( uint64_t inx = 0; inx < sectionNameCount; ++inx )
+    {
+        if ( ! isInText ( sectionNames[inx].m_offset,
+                          sectionNames[inx].m_length, textSize ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Binary search of the node index.
+
+size_t SiteModel::findNode ( int nodeId ) const
+{
+    const NodeIndexEntry * begin =
+        getTable< NodeIndexEntry > ( m_header->m_nodeIndex );
+    const NodeIndexEntry * end = begin + m_header->m_nodeIndex.m_count;
+    NodeIndexEntry key;
+    key.m_nodeId = nodeId;
+    key.m_index = 0;
+    const NodeIndexEntry * found =
+        lower_bound ( begin, end, key, NodeIndexEntryLess() );
+    if ( found == end || found->m_nodeId != nodeId )
+    {
+        return NONE;
+    }
+    return found->m_index;
+}
+
+//----------------------------------------------------------------------------
+// The node's description, or 0 if it has none.
+
+const SiteModel::Description * SiteModel::getDescription
+(   const Node & node
+) const
+{
+    if ( node.m_descriptionIndex == NONE )
+    {
+        return 0;
+    }
+    return getTable< Description > ( m_header->m_descriptions )
+           + node.m_descriptionIndex;
+}
+
+//============================================================================
+
+void HtmlGenerator::Counts::add ( const Counts & counts )
+{
+    m_pagesRendered += counts.m_pagesRendered;
+    m_filesWritten += counts.m_filesWritten;
+    m_bytesWritten += counts.m_bytesWritten;
+    m_directoriesCreated += counts.m_directoriesCreated;
+    m_renderSeconds += counts.m_renderSeconds;
+}
+
+//----------------------------------------------------------------------------
+// Each page hash is reckoned as its value, its node's link and a bucket.
+
+size_t HtmlGenerator::getRenderBytes() const
+{
+    return m_linkSnippetText.capacity()
+           + m_linkSnippets.capacity() * sizeof ( LinkSnippet )
+           + m_pageHashes.size() * ( 2 * sizeof ( void * )
+               + sizeof ( unordered_map< int,
+                                         unsigned long long >::value_type ) )
+           + m_renderBufferBytes;
+}
+
+//----------------------------------------------------------------------------
+
+void HtmlGenerator::prepareToRender()
+{
+    // Every page of a fanned-out layout sits two directories down, so links
+    // between pages have to climb back up to the top first.
+    m_linkPrefix = ( m_outputLayout == LAYOUT_FLAT ) ? "" : "../../";
+    m_layoutBucketsUsed.assign ( getLayoutFanOut() * getLayoutFanOut(), false );
+
+    // Render every node's link once, up front: each one is reused by the
+    // node's parent and by all of its descendants.
+    buildLinkSnippets();
+
+    m_sectionsShown.assign ( m_siteModel.getSectionNameCount(), true );
+    if ( m_sectionNames != 0 )
+    {
+        for ( size_t nameIndex = 0; nameIndex < m_sectionsShown.size();
+              ++nameIndex )
+        {
+            const SiteModel::SectionName & sectionName =
+                m_siteModel.getSectionName ( nameIndex );
+            m_sectionsShown[nameIndex] = m_sectionNames->count ( string (
+                m_siteModel.getText ( sectionName.m_offset ),
+                sectionName.m_length ) ) != 0;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+size_t HtmlGenerator::generateFiles ( const char * outputDirName )
+{
+    TraceRecorder::Span span ( "generateFiles", outputDirName );
+    prepareToRender();
+
+    // Generate hierarchy.
+    createDirectory ( outputDirName );
+    m_outputDirectory = outputDirName;
+    m_outputDirectory.append ( "/" );
+    createLayoutDirectories();
+    if ( 0 == m_siteModel.getNodeCount() )
+    {
+        return 0;
+    }
+    if ( m_workerCount > 1 && ! m_skipUnchangedPages )
+    {
+        return generateFilesInParallel();
+    }
+    TreeWalk walk;
+    size_t pagesWritten = generateFilesForTree ( 0, walk );
+    m_counts.add ( walk.m_counts );
+    m_renderBufferBytes = max ( m_renderBufferBytes,
+                                walk.m_page.capacity() );
+    return pagesWritten;
+}
+
+//----------------------------------------------------------------------------
+// Each worker takes the next run of nodes, in the model's order, until
+// there are none left. Every directory a page needs was made beforehand,
+// so the workers share nothing but the counter. The first error any of
+// them met is thrown once they have all finished; a parse error (of a lazily
+// indexed destination) is thrown as it was, so it is reported as one.
+
+size_t HtmlGenerator::generateFilesInParallel()
+{
+    atomic< size_t > nextIndex ( 0 );
+    vector< size_t > pagesWritten ( m_workerCount, 0 );
+    vector< TreeWalk > walks ( m_workerCount );
+    vector< string > errors ( m_workerCount );
+    vector< unique_ptr< parse_error > > parseErrors ( m_workerCount );
+    vector< thread > workers;
+    for ( unsigned int worker = 0; worker < m_workerCount; ++worker )
+    {
+        workers.push_back ( thread ( &HtmlGenerator::runGenerateWorker, this,
+            ref ( nextIndex ), ref ( pagesWritten[worker] ),
+            ref ( walks[worker] ), ref ( errors[worker] ),
+            ref ( parseErrors[worker] ) ) );
+    }
+    size_t totalPagesWritten = 0;
+    size_t bufferBytes = 0;
+    for ( unsigned int worker = 0; worker < m_workerCount; ++worker )
+    {
+        workers[worker].join();
+        totalPagesWritten += pagesWritten[worker];
+        m_counts.add ( walks[worker].m_counts );
+        bufferBytes += walks[worker].m_page.capacity();
+    }
+    m_renderBufferBytes = max ( m_renderBufferBytes, bufferBytes );
+    for ( unsigned int worker = 0; worker < m_workerCount; ++worker )
+    {
+        if ( parseErrors[worker] )
+        {
+            throw *parseErrors[worker];
+        }
+        if ( ! errors[worker].empty() )
+        {
+            throw errors[worker];
+        }
+    }
+    return totalPagesWritten;
+}
+
+//----------------------------------------------------------------------------
+// Runs of 64 nodes keep the counter out of the way without leaving any
+// worker with much more than its share at the end.
+
+void HtmlGenerator::runGenerateWorker
+(   atomic< size_t > & nextIndex,
+    size_t & pagesWritten,
+    TreeWalk & walk,
+    string & error,
+    unique_ptr< parse_error > & parseError
+) const
+{
+    const size_t RUN_LENGTH = 64;
+    walk.m_isWalking = false;
+    try
+    {
+        size_t nodeCount = m_siteModel.getNodeCount();
+        for ( size_t start = nextIndex.fetch_add ( RUN_LENGTH );
+              start < nodeCount; start = nextIndex.fetch_add ( RUN_LENGTH ) )
+        {
+            size_t end = min ( start + RUN_LENGTH, nodeCount );
+            for ( size_t index = start; index < end; ++index )
+            {
+                pagesWritten += generateFile ( index, walk ) ? 1 : 0;
+            }
+        }
+    }
+    catch ( const string & exceptionError )
+    {
+        error = exceptionError;
+    }
+    catch ( const parse_error & exceptionError )
+    {
+        parseError.reset ( new parse_error ( exceptionError ) );
+    }
+    catch ( ... )
+    {
+        error = "unknown exception";
+    }
+}
+
+//----------------------------------------------------------------------------
+// Only the descriptions of the given destinations have changed since the
+// last generateFiles: the taxonomy, and so every link, is as it was.
+
+size_t HtmlGenerator::regenerateFiles ( const set<int> & nodeIds )
+{
+    if ( m_linkSnippets.size() != m_siteModel.getNodeCount() )
+    {
+        throw string ( "The taxonomy has changed since the pages were "
+                       "generated" );
+    }
+    if ( 0 == m_siteModel.getNodeCount() )
+    {
+        return 0;
+    }
+    TreeWalk walk;
+    walk.m_onlyNodeIds = &nodeIds;
+    size_t pagesWritten = generateFilesForTree ( 0, walk );
+    m_counts.add ( walk.m_counts );
+    m_renderBufferBytes = max ( m_renderBufferBytes,
+                                walk.m_page.capacity() );
+    return pagesWritten;
+}
+
+//----------------------------------------------------------------------------
+// Given a/b/c/d:
+// recursively call with a/b/c
+// recursively call with a/b
+// recursively call with a
+// create a
+// create a/b
+// create a/b/c
+// create a/b/c/d.
+
+void HtmlGenerator::createDirectoryRecursively
+(   const string & directoryName
+) const
+{
+    size_t lastSeparatorIndex = directoryName.find_last_of ( "\\/" );
+    if ( lastSeparatorIndex != string::npos )
+    {
+        createDirectoryRecursively ( directoryName.substr ( 0, lastSeparatorIndex ) );
+    }
+    // Blithely ignoring errors for now since we will eventually try to
+    // create files and that will indicate any mkdir failure implicitly.
+    // An error could merely indicate that the directory already exists.
+    MKDIR ( directoryName.c_str() );
+}
+
+//----------------------------------------------------------------------------
+// Given a/b/c/d:
+// create a
+// create a/b
+// create a/b/c
+// create a/b/c/d.
+
+void HtmlGenerator::createDirectory
+(   const string & directoryName
+) const
+{
+    size_t start = 0;
+    for(;;)
+    {
+        size_t firstSeparatorIndex = directoryName.find_first_of ( "\\/", start );
+        string dirName = directoryName.substr ( 0, firstSeparatorIndex );
+        makeDirectory ( dirName.c_str() );
+        if ( firstSeparatorIndex == string::npos )
+        {
+            break;
+        }
+        start = firstSeparatorIndex+1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Blithely ignoring errors for now since we will eventually try to create
+// files and that will indicate any mkdir failure implicitly. An error could
+// merely indicate that the directory already exists.
+
+void HtmlGenerator::makeDirectory ( const char * directoryName ) const
+{
+    if ( MKDIR ( directoryName ) == 0 )
+    {
+        ++m_counts.m_directoriesCreated;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Create just those layout directories which buildLinkSnippets found a use
+// for, each with a single mkdir: the output directory itself already exists.
+
+void HtmlGenerator::createLayoutDirectories() const
+{
+    size_t fanOut = getLayoutFanOut();
+    if ( fanOut == 1 )
+    {
+        return;
+    }
+    string directoryName;
+    for ( size_t outer = 0; outer < fanOut; ++outer )
+    {
+        bool outerCreated = false;
+        for ( size_t inner = 0; inner < fanOut; ++inner )
+        {
+            if ( ! m_layoutBucketsUsed[outer * fanOut + inner] )
+            {
+                continue;
+            }
+            directoryName = m_outputDirectory;
+            appendLayoutBucketName ( directoryName, outer );
+            if ( ! outerCreated )
+            {
+                makeDirectory ( directoryName.c_str() );
+                outerCreated = true;
+            }
+            directoryName.append ( "/" );
+            appendLayoutBucketName ( directoryName, inner );
+            makeDirectory ( directoryName.c_str() );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// In node order, append "<a href="lp_<nodeid>.html"><name></a>" for each
+// usable node to the contiguous snippet text.
+
+void HtmlGenerator::buildLinkSnippets()
+{
+    m_linkSnippetText.clear();
+    m_linkSnippets.resize ( m_siteModel.getNodeCount() );
+    for ( size_t index = 0; index < m_linkSnippets.size(); ++index )
+    {
+        const SiteModel::Node & node = m_siteModel.getNode ( index );
+        size_t offset = m_linkSnippetText.size();
+        size_t nameOffset = offset;
+        if ( node.m_idLength != 0 )
+        {
+            const char * nodeId = m_siteModel.getText ( node.m_idOffset );
+            m_layoutBucketsUsed[getLayoutBucket ( nodeId )] = true;
+            m_linkSnippetText.append ( "<a href=\"" );
+            m_linkSnippetText.append ( m_linkPrefix );
+            m_linkSnippetText.append ( makeHtmlFileName ( nodeId ) );
+            m_linkSnippetText.append ( "\">" );
+            nameOffset = m_linkSnippetText.size();
+            appendEscapedHtml ( m_linkSnippetText,
+                                m_siteModel.getText ( node.m_nameOffset ),
+                                node.m_nameLength );
+        }
+        size_t nameLength = m_linkSnippetText.size() - nameOffset;
+        if ( nameOffset != offset )
+        {
+            m_linkSnippetText.append ( "</a>" );
+        }
+
+        LinkSnippet & snippet = m_linkSnippets[index];
+        snippet.m_offset = offset;
+        snippet.m_length = m_linkSnippetText.size() - offset;
+        snippet.m_nameOffset = nameOffset;
+        snippet.m_nameLength = nameLength;
+    }
+}
+
+//----------------------------------------------------------------------------
+// The model's nodes are already in pre-order, so the subtree is just the
+// nodes from index up to its size further on, and the walk's ancestors are
+// the descent's stack: before each node, every ancestor whose subtree it is
+// past is popped, leaving its parent on top. So however deep the tree,
+// nothing recurses, and the stack's storage is the walk's to keep.
+// Subtrees are traced down to the level of countries, which is enough to
+// see how the work divides.
+
+size_t HtmlGenerator::generateFilesForTree
+(   size_t index,
+    TreeWalk & walk
+) const
+{
+    const size_t TRACED_DEPTH = 3;
+    unique_ptr< TraceRecorder::Span > spans[TRACED_DEPTH];
+    bool isTracing = TraceRecorder::isActive();
+    size_t baseDepth = walk.m_ancestors.size();
+    size_t endIndex = index + m_siteModel.getNode ( index ).m_subTreeSize;
+    size_t pagesWritten = 0;
+    for ( size_t nodeIndex = index; nodeIndex < endIndex; ++nodeIndex )
+    {
+        while ( walk.m_ancestors.size() > baseDepth )
+        {
+            size_t ancestor = walk.m_ancestors.back();
+            if ( nodeIndex < ancestor
+                             + m_siteModel.getNode ( ancestor ).m_subTreeSize )
+            {
+                break;
+            }
+            walk.m_ancestors.pop_back();
+            if ( walk.m_ancestors.size() < TRACED_DEPTH )
+            {
+                spans[walk.m_ancestors.size()].reset();
+            }
+        }
+        if ( isTracing && walk.m_ancestors.size() < TRACED_DEPTH )
+        {
+            spans[walk.m_ancestors.size()].reset ( new TraceRecorder::Span (
+                "generateFilesForTree", 0,
+                m_siteModel.getNode ( nodeIndex ).m_nodeId ) );
+        }
+        pagesWritten += generateFile ( nodeIndex, walk ) ? 1 : 0;
+        walk.m_ancestors.push_back ( nodeIndex );
+    }
+    while ( walk.m_ancestors.size() > baseDepth )
+    {
+        walk.m_ancestors.pop_back();
+        if ( walk.m_ancestors.size() < TRACED_DEPTH )
+        {
+            spans[walk.m_ancestors.size()].reset();
+        }
+    }
+    return pagesWritten;
+}
+
+//----------------------------------------------------------------------------
+// Create HTML file according to template, for a usable node.
+// The page is rendered into the walk's buffer, which is reused from page to
+// page. Returns whether a page was written.
+
+bool HtmlGenerator::generateFile
+(   size_t index,
+    TreeWalk & walk
+) const
+{
+    const SiteModel::Node & node = m_siteModel.getNode ( index );
+    if ( 0 == node.m_idLength )     // not a usable node
+    {
+        return false;
+    }
+
+    if ( walk.m_onlyNodeIds != 0
+         && walk.m_onlyNodeIds->count ( node.m_nodeId ) == 0 )
+    {
+        return false;
+    }
+    TraceRecorder::Span span ( TraceRecorder::isPageSampled()
+                               ? "generateFile" : 0, 0, node.m_nodeId );
+
+    // Render template+substitutions in memory, so that the same bytes can
+    // be both written and compressed.
+    chrono::steady_clock::time_point renderStart;
+    if ( m_timeRendering )
+    {
+        renderStart = chrono::steady_clock::now();
+    }
+    PageFields fields;
+    fillPageFields ( index, walk.m_isWalking ? &walk.m_ancestors : 0,
+                     fields );
+    renderPage ( fields, walk.m_page );
+    if ( m_timeRendering )
+    {
+        walk.m_counts.m_renderSeconds += chrono::duration< double > (
+            chrono::steady_clock::now() - renderStart ).count();
+    }
+    ++walk.m_counts.m_pagesRendered;
+    if ( m_skipUnchangedPages
+         && isPageUnchanged ( node.m_nodeId, walk.m_page ) )
+    {
+        return false;
+    }
+
+    // Construct filename and write it, and any compressed siblings.
+    string htmlFilePath ( m_outputDirectory );
+    htmlFilePath.append ( makeHtmlFileName (
+        m_siteModel.getText ( node.m_idOffset ) ) );
+    writePage ( htmlFilePath, walk.m_page, walk.m_counts );
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Without a walk down the tree to follow, navigation climbs back up it to
+// find the ancestors.
+
+bool HtmlGenerator::renderPageForNode ( int nodeId, string & page ) const
+{
+    size_t index = m_siteModel.findNode ( nodeId );
+    if ( index == SiteModel::NONE )
+    {
+        return false;
+    }
+    PageFields fields;
+    fillPageFields ( index, 0, fields );
+    renderPage ( fields, page );
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+bool HtmlGenerator::renderPageForNode
+(   int nodeId,
+    char * buffer,
+    size_t bufferSize,
+    size_t & pageLength
+) const
+{
+    size_t index = m_siteModel.findNode ( nodeId );
+    if ( index == SiteModel::NONE )
+    {
+        return false;
+    }
+    PageFields fields;
+    fillPageFields ( index, 0, fields );
+    pageLength = measurePage ( fields );
+    if ( pageLength <= bufferSize )
+    {
+        fillPage ( fields, buffer );
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void HtmlGenerator::fillPageFields
+(   size_t index,
+    const vector< size_t > * ancestors,
+    PageFields & fields
+) const
+{
+    // The node's name, already escaped, is the text of its own link.
+    const LinkSnippet & snippet = m_linkSnippets[index];
+    fields.m_title = m_linkSnippetText.data() + snippet.m_nameOffset;
+    fields.m_titleLength = snippet.m_nameLength;
+    fields.m_index = index;
+    fields.m_ancestors = ancestors;
+    const SiteModel::Node & node = m_siteModel.getNode ( index );
+    fields.m_description = m_siteModel.getDescription ( node );
+    fields.m_sections = ( m_destinationsIndex != 0 && node.m_idLength != 0 )
+                        ? m_destinationsIndex->getSections ( node.m_nodeId )
+                        : 0;
+}
+
+//----------------------------------------------------------------------------
+// Compare the page with what was last written for the node, by FNV-1a 64
+// hash, and remember it for next time.
+
+bool HtmlGenerator::isPageUnchanged ( int nodeId, const string & page ) const
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for ( string::const_iterator pageIter = page.begin();
+          pageIter != page.end(); ++pageIter )
+    {
+        hash ^= static_cast< unsigned char > ( *pageIter );
+        hash *= 1099511628211ULL;
+    }
+
+    unordered_map< int, unsigned long long >::iterator hashIter =
+        m_pageHashes.find ( nodeId );
+    if ( hashIter != m_pageHashes.end() && hashIter->second == hash )
+    {
+        return true;
+    }
+    m_pageHashes[nodeId] = hash;
+    return false;
+}
+
+//----------------------------------------------------------------------------
+// Render in two passes: measure, then size the page exactly, which reuses
+// the buffer's existing capacity whenever the page fits, and copy
+// everything into place.
+
+void HtmlGenerator::renderPage
+(   const PageFields & fields,
+    string & page
+) const
+{
+    page.resize ( measurePage ( fields ) );
+    fillPage ( fields, &page[0] );
+}
+
+//----------------------------------------------------------------------------
+// The template's literal text is of fixed length, so only the slots'
+// contents need sizing.
+
+size_t HtmlGenerator::measurePage ( const PageFields & fields ) const
+{
+    bool builtIn = m_template->isBuiltIn();
+    size_t pageSize = builtIn ? builtInTemplateLayout.m_literalsLength
+                              : m_template->getLiteralsLength();
+    for ( int slotNumber = HtmlTemplate::SLOT_TITLE;
+          slotNumber < HtmlTemplate::SLOT_COUNT; ++slotNumber )
+    {
+        HtmlTemplate::Slot slot = HtmlTemplate::Slot ( slotNumber );
+        size_t slotUses = builtIn ? builtInTemplateLayout.m_slotUses[slot]
+                                  : m_template->getSlotUses ( slot );
+        if ( slotUses != 0 )
+        {
+            SizeCounter slotSize;
+            writeSlot ( slotSize, slot, fields );
+            pageSize += slotUses * slotSize.getSize();
+        }
+    }
+    return pageSize;
+}
+
+//----------------------------------------------------------------------------
+// The buffer must have room for measurePage's worth.
+
+void HtmlGenerator::fillPage
+(   const PageFields & fields,
+    char * buffer
+) const
+{
+    BufferWriter writer ( buffer );
+    if ( m_template->isBuiltIn() )
+    {
+        writeBuiltIn< 0 > ( writer, fields,
+            integral_constant< bool, 0 < builtInTemplateLayout.m_slotCount >() );
+    }
+    else
+    {
+        writeOperations ( writer, fields );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Render an external template: its list of operations is only known at run
+// time.
+
+template < class Output >
+void HtmlGenerator::writeOperations
+(   Output & output,
+    const PageFields & fields
+) const
+{
+    const vector< HtmlTemplate::Operation > & operations =
+        m_template->getOperations();
+    for ( vector< HtmlTemplate::Operation >::const_iterator iter =
+              operations.begin();
+          iter != operations.end(); ++iter )
+    {
+        if ( iter->m_slot == HtmlTemplate::SLOT_LITERAL )
+        {
+            output.append ( iter->m_text, iter->m_length );
+        }
+        else
+        {
+            writeSlot ( output, iter->m_slot, fields );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Render the built-in template from literal segment N onwards. Each
+// segment's position, length and following slot are compile-time constants,
+// which leaves one fixed-size copy per segment.
+
+template < size_t N, class Output >
+void HtmlGenerator::writeBuiltIn
+(   Output & output,
+    const PageFields & fields,
+    true_type
+) const
+{
+    output.append ( builtInTemplateText
+                        + builtInTemplateLayout.m_literalBegin[N],
+                    builtInTemplateLayout.m_literalLength[N] );
+    writeSlot ( output, builtInTemplateLayout.m_slots[N], fields );
+    writeBuiltIn< N + 1 > ( output, fields,
+        integral_constant< bool,
+                           N + 1 < builtInTemplateLayout.m_slotCount >() );
+}
+
+template < size_t N, class Output >
+void HtmlGenerator::writeBuiltIn
+(   Output & output,
+    const PageFields &,
+    false_type
+) const
+{
+    output.append ( builtInTemplateText
+                        + builtInTemplateLayout.m_literalBegin[N],
+                    builtInTemplateLayout.m_literalLength[N] );
+}
+
+//----------------------------------------------------------------------------
+
+template < class Output >
+void HtmlGenerator::writeSlot
+(   Output & output,
+    HtmlTemplate::Slot slot,
+    const PageFields & fields
+) const
+{
+    switch ( slot )
+    {
+        case HtmlTemplate::SLOT_TITLE:
+            output.append ( fields.m_title, fields.m_titleLength );
+            break;
+        case HtmlTemplate::SLOT_NAVIGATION:
+            writeNavigation ( output, fields.m_index, fields.m_ancestors );
+            break;
+        case HtmlTemplate::SLOT_CONTENT:
+            if ( m_destinationsIndex != 0 )
+            {
+                writeIndexedContent ( output, fields.m_sections );
+            }
+            else
+            {
+                writeContent ( output, fields.m_description );
+            }
+            break;
+        case HtmlTemplate::SLOT_ROOT:
+            output.append ( m_linkPrefix.data(), m_linkPrefix.size() );
+            break;
+        default:
+            break;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Links up to every ancestor, then down to each child.
+
+static const char upLinkPrefix[] = "<p>Up to ";
+static const char downLinkPrefix[] = "<p>";
+
+template < class Output >
+void HtmlGenerator::writeNavigation
+(   Output & output,
+    size_t index,
+    const vector< size_t > * ancestors
+) const
+{
+    if ( ancestors != 0 )
+    {
+        for ( vector< size_t >::const_iterator iter = ancestors->begin();
+              iter != ancestors->end(); ++iter )
+        {
+            writeLink ( output, upLinkPrefix, sizeof ( upLinkPrefix ) - 1,
+                        *iter );
+        }
+    }
+    else
+    {
+        writeAncestorLinks ( output,
+                             m_siteModel.getNode ( index ).m_parentIndex );
+    }
+
+    size_t endIndex = index + m_siteModel.getNode ( index ).m_subTreeSize;
+    for ( size_t childIndex = index + 1; childIndex < endIndex;
+          childIndex += m_siteModel.getNode ( childIndex ).m_subTreeSize )
+    {
+        writeLink ( output, downLinkPrefix, sizeof ( downLinkPrefix ) - 1,
+                    childIndex );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Outermost first, from the parent at index up. Without a walk's stack to
+// read them from, the ancestors are gathered by following the parents into
+// a small buffer, a batch at a time: each batch is the outermost of those
+// not yet written, found by skipping the ones below it. So nothing
+// recurses or allocates, however deep the node.
+
+template < class Output >
+void HtmlGenerator::writeAncestorLinks
+(   Output & output,
+    size_t index
+) const
+{
+    static const size_t batchSize = 64;
+    size_t batch[batchSize];
+
+    size_t remaining = 0;
+    for ( size_t ancestor = index; ancestor != SiteModel::NONE;
+          ancestor = m_siteModel.getNode ( ancestor ).m_parentIndex )
+    {
+        ++remaining;
+    }
+    while ( remaining != 0 )
+    {
+        size_t count = min ( remaining, batchSize );
+        size_t ancestor = index;
+        for ( size_t skipped = count; skipped < remaining; ++skipped )
+        {
+            ancestor = m_siteModel.getNode ( ancestor ).m_parentIndex;
+        }
+        for ( size_t slot = count; slot != 0; )
+        {
+            batch[--slot] = ancestor;
+            ancestor = m_siteModel.getNode ( ancestor ).m_parentIndex;
+        }
+        for ( size_t slot = 0; slot < count; ++slot )
+        {
+            writeLink ( output, upLinkPrefix, sizeof ( upLinkPrefix ) - 1,
+                        batch[slot] );
+        }
+        remaining -= count;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Unusable nodes have no link.
+
+template < class Output >
+void HtmlGenerator::writeLink
+(   Output & output,
+    const char * prefix,
+    size_t prefixLength,
+    size_t index
+) const
+{
+    static const char suffix[] = "</p>";
+    const LinkSnippet & snippet = m_linkSnippets[index];
+    if ( snippet.m_length != 0 )
+    {
+        output.append ( prefix, prefixLength );
+        output.append ( m_linkSnippetText.data() + snippet.m_offset,
+                        snippet.m_length );
+        output.append ( suffix, sizeof ( suffix ) - 1 );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Each requested section of the destination's description, headed by its
+// capitalised name.
+
+template < class Output >
+void HtmlGenerator::writeContent
+(   Output & output,
+    const SiteModel::Description * description
+) const
+{
+    if ( 0 == description )
+    {
+        return;
+    }
+    size_t endSection = description->m_firstSection
+                        + description->m_sectionCount;
+    for ( size_t sectionIndex = description->m_firstSection;
+          sectionIndex < endSection; ++sectionIndex )
+    {
+        const SiteModel::Section & section =
+            m_siteModel.getSection ( sectionIndex );
+        if ( ! m_sectionsShown[section.m_nameIndex] )
+        {
+            continue;
+        }
+        const SiteModel::SectionName & heading =
+            m_siteModel.getSectionName ( section.m_nameIndex );
+        writeHeading ( output, m_siteModel.getText ( heading.m_offset ),
+                       heading.m_length );
+        output.append ( m_siteModel.getText ( section.m_contentOffset ),
+                        section.m_contentLength );
+    }
+}
+
+//----------------------------------------------------------------------------
+// The same, from a DestinationsIndex. The model's section names, which say
+// which sections are shown, are in the same order as the sections, so the
+// two are stepped through together.
+
+template < class Output >
+void HtmlGenerator::writeIndexedContent
+(   Output & output,
+    const map< string, string > * sections
+) const
+{
+    if ( 0 == sections )
+    {
+        return;
+    }
+    map< string, string >::const_iterator sectionIter = sections->begin();
+    for ( size_t nameIndex = 0; nameIndex < m_sectionsShown.size()
+                                && sectionIter != sections->end();
+          ++nameIndex )
+    {
+        const SiteModel::SectionName & heading =
+            m_siteModel.getSectionName ( nameIndex );
+        const char * headingText = m_siteModel.getText ( heading.m_offset );
+        int order = 0;
+        while ( sectionIter != sections->end()
+                && ( order = sectionIter->first.compare ( 0, string::npos,
+                         headingText, heading.m_length ) ) < 0 )
+        {
+            ++sectionIter;
+        }
+        if ( order == 0 && sectionIter != sections->end()
+             && m_sectionsShown[nameIndex] )
+        {
+            writeHeading ( output, headingText, heading.m_length );
+            output.append ( sectionIter->second.data(),
+                            sectionIter->second.size() );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+template < class Output >
+void HtmlGenerator::writeHeading
+(   Output & output,
+    const char * name,
+    size_t nameLength
+) const
+{
+    static const char headingStart[] = "<h3>";
+    static const char headingEnd[] = "</h3>";
+    output.append ( headingStart, sizeof ( headingStart ) - 1 );
+    if ( nameLength != 0 )
+    {
+        char initial = toupper ( name[0] );
+        output.append ( &initial, 1 );
+        output.append ( name + 1, nameLength - 1 );
+    }
+    output.append ( headingEnd, sizeof ( headingEnd ) - 1 );
+}
+
+//----------------------------------------------------------------------------
+// Write the rendered page, then compress it while it is still in memory and
+// write the ".gz" and ".br" siblings that a static web server can hand out
+// as they stand.
+
+void HtmlGenerator::writePage
+(   const string & htmlFilePath,
+    const string & page,
+    Counts & counts
+) const
+{
+    writeFile ( htmlFilePath, page.data(), page.size(), counts );
+
+#ifdef LP_WITH_ZLIB
+    if ( m_gzipLevel >= 0 )
+    {
+        // windowBits 15+16 asks zlib for a gzip header and trailer.
+        z_stream zStream;
+        zStream.zalloc = Z_NULL;
+        zStream.zfree = Z_NULL;
+        zStream.opaque = Z_NULL;
+        if ( deflateInit2 ( &zStream, m_gzipLevel, Z_DEFLATED, 15 + 16, 8,
+                            Z_DEFAULT_STRATEGY ) != Z_OK )
+        {
+            throw string ( "Failed to initialise gzip compression" );
+        }
+        string compressed ( deflateBound ( &zStream, page.size() ), '\0' );
+        zStream.next_in =
+            reinterpret_cast<Bytef *> ( const_cast<char *> ( page.data() ) );
+        zStream.avail_in = page.size();
+        zStream.next_out = reinterpret_cast<Bytef *> ( &compressed[0] );
+        zStream.avail_out = compressed.size();
+        int result = deflate ( &zStream, Z_FINISH );
+        compressed.resize ( zStream.total_out );
+        deflateEnd ( &zStream );
+        if ( result != Z_STREAM_END )
+        {
+            throw "Failed to gzip " + htmlFilePath;
+        }
+        writeFile ( htmlFilePath + ".gz", compressed.data(),
+                    compressed.size(), counts );
+    }
+#endif
+
+#ifdef LP_WITH_BROTLI
+    if ( m_brotliQuality >= 0 )
+    {
+        size_t compressedSize = BrotliEncoderMaxCompressedSize ( page.size() );
+        string compressed ( compressedSize, '\0' );
+        if ( ! BrotliEncoderCompress ( m_brotliQuality, BROTLI_DEFAULT_WINDOW,
+                   BROTLI_MODE_TEXT, page.size(),
+                   reinterpret_cast<const uint8_t *> ( page.data() ),
+                   &compressedSize,
+                   reinterpret_cast<uint8_t *> ( &compressed[0] ) ) )
+        {
+            throw "Failed to brotli-compress " + htmlFilePath;
+        }
+        writeFile ( htmlFilePath + ".br", compressed.data(), compressedSize,
+                    counts );
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Write one whole output file. The contents are already complete in memory,
+// so the stream is left unbuffered and they go out in a single write.
+
+void HtmlGenerator::writeFile
+(   const string & filePath,
+    const char * data,
+    size_t size,
+    Counts & counts
+) const
+{
+    ofstream file;
+    file.rdbuf()->pubsetbuf ( 0, 0 );
+    file.open ( filePath.c_str(), ios::out | ios::binary );
+    if ( ! file.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open file " << filePath << " for writing";
+        throw errorStream.str();
+    }
+    file.write ( data, size );
+    if ( file )
+    {
+        file.close();
+    }
+    if ( ! file )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to write file " << filePath;
+        throw errorStream.str();
+    }
+    ++counts.m_filesWritten;
+    counts.m_bytesWritten += size;
+}
+
+//----------------------------------------------------------------------------
+// Build "lp_<nodeid>.html", prefixed for fanned-out layouts by the two
+// levels of directory, so the result is relative to the output directory.
+
+string HtmlGenerator::makeHtmlFileName ( const char * nodeId ) const
+{
+    string htmlFileName;
+    if ( m_outputLayout != LAYOUT_FLAT )
+    {
+        size_t fanOut = getLayoutFanOut();
+        size_t bucket = getLayoutBucket ( nodeId );
+        appendLayoutBucketName ( htmlFileName, bucket / fanOut );
+        htmlFileName.append ( "/" );
+        appendLayoutBucketName ( htmlFileName, bucket % fanOut );
+        htmlFileName.append ( "/" );
+    }
+    htmlFileName.append ( "lp_" );
+    htmlFileName.append ( nodeId );
+    htmlFileName.append ( ".html" );
+    return htmlFileName;
+}
+
+//----------------------------------------------------------------------------
+// Number of directories at each of the two levels of the layout.
+
+size_t HtmlGenerator::getLayoutFanOut() const
+{
+    switch ( m_outputLayout )
+    {
+        case LAYOUT_HASHED:     return 256;
+        case LAYOUT_ID_PREFIX:  return 100;
+        default:                return 1;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Which of the fanOut*fanOut leaf directories a node-id belongs in.
+// Hashed: the low 16 bits of a 32-bit FNV-1a hash of the id text.
+// Prefix: the leading four digits of the id, zero-padded on the left.
+
+size_t HtmlGenerator::getLayoutBucket ( const char * nodeId ) const
+{
+    if ( m_outputLayout == LAYOUT_HASHED )
+    {
+        unsigned long hash = 2166136261UL;
+        for ( const char * iter = nodeId; *iter != 0; ++iter )
+        {
+            hash = ( ( hash ^ static_cast<unsigned char> ( *iter ) )
+                     * 16777619UL ) & 0xffffffffUL;
+        }
+        return hash & 0xffff;
+    }
+
+    if ( m_outputLayout == LAYOUT_ID_PREFIX )
+    {
+        size_t idLength = strlen ( nodeId );
+        size_t padding = ( idLength < 4 ) ? 4 - idLength : 0;
+        size_t bucket = 0;
+        for ( size_t inx = 0; inx < 4; ++inx )
+        {
+            char digit = ( inx < padding ) ? '0' : nodeId[inx - padding];
+            if ( ! isdigit ( static_cast<unsigned char> ( digit ) ) )
+            {
+                stringstream errorStream;
+                errorStream << "Cannot use prefix layout for non-numeric "
+                            << "node-id \"" << nodeId << "\"";
+                throw errorStream.str();
+            }
+            bucket = bucket * 10 + ( digit - '0' );
+        }
+        return bucket;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// Append a directory name for one level of the layout: two hex digits for
+// hashed, two decimal digits for prefix.
+
+void HtmlGenerator::appendLayoutBucketName
+(   string & name,
+    size_t bucket
+) const
+{
+    const char * digits = "0123456789abcdef";
+    size_t radix = ( m_outputLayout == LAYOUT_HASHED ) ? 16 : 10;
+    name.push_back ( digits[bucket / radix] );
+    name.push_back ( digits[bucket % radix] );
+}
+
+//============================================================================
+// One template per file (the built-in one for none), made on first use and
+// kept for the rest of the run.
+
+HtmlTemplate * HtmlTemplate::createHtmlTemplate
+(   const char * templateFileName
+)
+{
+    static mutex templatesMutex;
+    static map< string, HtmlTemplate * > templates;
+    lock_guard< mutex > lock ( templatesMutex );
+    string key ( templateFileName != 0 ? templateFileName : "" );
+    map< string, HtmlTemplate * >::iterator iter = templates.find ( key );
+    if ( iter == templates.end() )
+    {
+        iter = templates.insert ( make_pair ( key,
+                   new HtmlTemplate ( templateFileName ) ) ).first;
+    }
+    return iter->second;
+}
+
+//----------------------------------------------------------------------------
+// Read and compile the given template file, or failing that the built-in
+// one. Operations point into the template text, which for the built-in
+// template is static.
+
+HtmlTemplate::HtmlTemplate
+(   const char * templateFileName
+) : m_literalsLength ( 0 )
+{
+    fill ( m_slotUses, m_slotUses + SLOT_COUNT, 0 );
+    if ( 0 == templateFileName )
+    {
+        compile ( builtInTemplateText, sizeof ( builtInTemplateText ) - 1 );
+        return;
+    }
+
+    m_templateFileName = templateFileName;
+    ifstream templateFile ( templateFileName, ios::in | ios::binary );
+    if ( ! templateFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open template file "
+                    << templateFileName << " for reading";
+        throw errorStream.str();
+    }
+    stringstream templateText;
+    templateText << templateFile.rdbuf();
+    m_templateText = templateText.str();
+    compile ( m_templateText.data(), m_templateText.size() );
+}
+
+//----------------------------------------------------------------------------
+// Split the template text at each "{{name}}" into literal segments and
+// slots.
+
+void HtmlTemplate::compile
+(   const char * templateText,
+    size_t templateLength
+)
+{
+    static const char slotOpen[] = "{{";
+    static const char slotClose[] = "}}";
+    const char * templateEnd = templateText + templateLength;
+    const char * start = templateText;
+    for(;;)
+    {
+        const char * slotStart = search ( start, templateEnd,
+                                          slotOpen, slotOpen + 2 );
+        if ( slotStart > start )
+        {
+            Operation literal;
+            literal.m_slot = SLOT_LITERAL;
+            literal.m_text = start;
+            literal.m_length = slotStart - start;
+            m_operations.push_back ( literal );
+            m_literalsLength += literal.m_length;
+        }
+        if ( slotStart == templateEnd )
+        {
+            break;
+        }
+
+        const char * slotEnd = search ( slotStart + 2, templateEnd,
+                                        slotClose, slotClose + 2 );
+        if ( slotEnd == templateEnd )
+        {
+            stringstream errorStream;
+            errorStream << "Unterminated \"{{\" in template "
+                        << m_templateFileName;
+            throw errorStream.str();
+        }
+        string slotName ( slotStart + 2, slotEnd );
+        Operation slot;
+        slot.m_text = 0;
+        slot.m_length = 0;
+        if ( slotName == "title" )
+        {
+            slot.m_slot = SLOT_TITLE;
+        }
+        else if ( slotName == "navigation" )
+        {
+            slot.m_slot = SLOT_NAVIGATION;
+        }
+        else if ( slotName == "content" )
+        {
+            slot.m_slot = SLOT_CONTENT;
+        }
+        else if ( slotName == "root" )
+        {
+            slot.m_slot = SLOT_ROOT;
+        }
+        else
+        {
+            stringstream errorStream;
+            errorStream << "Unknown placeholder \"{{" << slotName
+                        << "}}\" in template " << m_templateFileName;
+            throw errorStream.str();
+        }
+        m_operations.push_back ( slot );
+        ++m_slotUses[slot.m_slot];
+        start = slotEnd + 2;
+    }
+}
+
+//============================================================================
+
+atomic< TraceRecorder * > TraceRecorder::s_active ( 0 );
+
+//----------------------------------------------------------------------------
+
+TraceRecorder::Span::Span
+(   const char * name,
+    const char * detail,
+    int nodeId
+) : m_recorder ( name != 0 ? s_active.load ( memory_order_acquire ) : 0 ),
+    m_name ( name ),
+    m_detail ( detail ),
+    m_nodeId ( nodeId )
+{
+    if ( m_recorder != 0 )
+    {
+        m_start = chrono::steady_clock::now();
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void TraceRecorder::Span::end()
+{
+    if ( m_recorder == 0 )
+    {
+        return;
+    }
+    chrono::steady_clock::time_point finish = chrono::steady_clock::now();
+    Event event;
+    event.m_name = m_name;
+    event.m_detail = ( m_detail != 0 ) ? m_detail : "";
+    event.m_nodeId = m_nodeId;
+    event.m_threadId = getThreadId();
+    event.m_startMicroseconds = chrono::duration< double, micro > (
+        m_start - m_recorder->m_origin ).count();
+    event.m_durationMicroseconds = chrono::duration< double, micro > (
+        finish - m_start ).count();
+    {
+        lock_guard< mutex > lock ( m_recorder->m_eventsMutex );
+        m_recorder->m_events.push_back ( event );
+    }
+    m_recorder = 0;
+}
+
+//----------------------------------------------------------------------------
+
+TraceRecorder::TraceRecorder
+(   size_t pageSampleInterval
+) : m_origin ( chrono::steady_clock::now() ),
+    m_pageSampleInterval ( pageSampleInterval != 0 ? pageSampleInterval : 1 ),
+    m_pagesSeen ( 0 )
+{}
+
+//----------------------------------------------------------------------------
+
+void TraceRecorder::setActive ( TraceRecorder * recorder )
+{
+    s_active.store ( recorder, memory_order_release );
+}
+
+//----------------------------------------------------------------------------
+
+bool TraceRecorder::isActive()
+{
+    return s_active.load ( memory_order_acquire ) != 0;
+}
+
+//----------------------------------------------------------------------------
+
+bool TraceRecorder::isPageSampled()
+{
+    TraceRecorder * recorder = s_active.load ( memory_order_acquire );
+    return recorder != 0
+           && recorder->m_pagesSeen.fetch_add ( 1, memory_order_relaxed )
+              % recorder->m_pageSampleInterval == 0;
+}
+
+//----------------------------------------------------------------------------
+// Small numbers, in the order threads first record something, read better
+// in a trace viewer than the system's own ids.
+
+int TraceRecorder::getThreadId()
+{
+    static atomic< int > nextThreadId ( 1 );
+    static thread_local int threadId = nextThreadId++;
+    return threadId;
+}
+
+//----------------------------------------------------------------------------
+// Names and files come from the input, so may hold anything: quotes,
+// backslashes and control characters are escaped.
+
+static void writeJsonString
+(   ostream & output,
+    const char * text,
+    size_t length
+)
+{
+    output << '"';
+    for ( size_t inx = 0; inx < length; ++inx )
+    {
+        unsigned char character = text[inx];
+        if ( character == '"' || character == '\\' )
+        {
+            output << '\\' << text[inx];
+        }
+        else if ( character < 0x20 )
+        {
+            char escape[8];
+            snprintf ( escape, sizeof ( escape ), "\\u%04x", character );
+            output << escape;
+        }
+        else
+        {
+            output << text[inx];
+        }
+    }
+    output << '"';
+}
+
+//----------------------------------------------------------------------------
+// Complete ("X") events, with the thread names that viewers label tracks
+// with. Times are in microseconds.
+
+void TraceRecorder::write ( const char * traceFileName ) const
+{
+    ofstream traceFile ( traceFileName, ios::out );
+    if ( ! traceFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open trace file " << traceFileName
+                    << " for writing";
+        throw errorStream.str();
+    }
+
+    lock_guard< mutex > lock ( m_eventsMutex );
+    traceFile << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    set< int > threadIds;
+    char times[64];
+    for ( vector< Event >::const_iterator iter = m_events.begin();
+          iter != m_events.end(); ++iter )
+    {
+        threadIds.insert ( iter->m_threadId );
+        snprintf ( times, sizeof ( times ), "\"ts\":%.3f,\"dur\":%.3f",
+                   iter->m_startMicroseconds, iter->m_durationMicroseconds );
+        traceFile << ( iter == m_events.begin() ? "\n" : ",\n" )
+                  << "{\"name\":";
+        writeJsonString ( traceFile, iter->m_name, strlen ( iter->m_name ) );
+        traceFile << ",\"cat\":\"lonely_planet\",\"ph\":\"X\","
+                  << times << ",\"pid\":1,\"tid\":" << iter->m_threadId
+                  << ",\"args\":{";
+        const char * separator = "";
+        if ( iter->m_nodeId >= 0 )
+        {
+            traceFile << "\"node_id\":" << iter->m_nodeId;
+            separator = ",";
+        }
+        if ( ! iter->m_detail.empty() )
+        {
+            traceFile << separator << "\"file\":";
+            writeJsonString ( traceFile, iter->m_detail.data(),
+                              iter->m_detail.size() );
+        }
+        traceFile << "}}";
+    }
+    for ( set< int >::const_iterator iter = threadIds.begin();
+          iter != threadIds.end(); ++iter )
+    {
+        traceFile << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                  << "\"tid\":" << *iter << ",\"args\":{\"name\":\""
+                  << ( *iter == 1 ? "main" : "worker " ) ;
+        if ( *iter != 1 )
+        {
+            traceFile << *iter - 1;
+        }
+        traceFile << "\"}}";
+    }
+    traceFile << "\n]}\n";
+}
+
+//============================================================================
+
+struct PageRenderer::Implementation
+{
+    Implementation
+    (   HtmlGenerator::OutputLayout outputLayout,
+        const char * templateFileName
+    ) : m_htmlGenerator ( m_siteModel, outputLayout, templateFileName )
+    {}
+
+    SiteModel m_siteModel;
+    HtmlGenerator m_htmlGenerator;
+};
+
+//----------------------------------------------------------------------------
+// The readers are only needed until the model has been built from them.
+
+PageRenderer * PageRenderer::createFromXml
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const set<string> & sectionNames,
+    HtmlGenerator::OutputLayout outputLayout,
+    const char * templateFileName
+)
+{
+    unique_ptr< Implementation > implementation (
+        new Implementation ( outputLayout, templateFileName ) );
+    {
+        TaxonomyReader taxonomyReader ( taxonomyFileName );
+        taxonomyReader.readAndParse();
+        DestinationsReader destinationsReader ( destinationsFileName );
+        destinationsReader.selectSections ( sectionNames );
+        destinationsReader.readAndParse();
+        destinationsReader.generateDestinationDescriptions ( sectionNames );
+        implementation->m_siteModel.build ( taxonomyReader,
+                                            destinationsReader );
+    }
+    implementation->m_htmlGenerator.prepareToRender();
+    return new PageRenderer ( implementation.release() );
+}
+
+//----------------------------------------------------------------------------
+
+PageRenderer * PageRenderer::createFromSnapshot
+(   const char * snapshotFileName,
+    HtmlGenerator::OutputLayout outputLayout,
+    const char * templateFileName
+)
+{
+    unique_ptr< Implementation > implementation (
+        new Implementation ( outputLayout, templateFileName ) );
+    implementation->m_siteModel.loadSnapshot ( snapshotFileName );
+    implementation->m_htmlGenerator.prepareToRender();
+    return new PageRenderer ( implementation.release() );
+}
+
+//----------------------------------------------------------------------------
+
+PageRenderer::~PageRenderer()
+{
+    delete m_implementation;
+}
+
+//----------------------------------------------------------------------------
+
+bool PageRenderer::renderPage
+(   int nodeId,
+    char * buffer,
+    size_t bufferSize,
+    size_t & pageLength
+) const
+{
+    return m_implementation->m_htmlGenerator.renderPageForNode ( nodeId,
+               buffer, bufferSize, pageLength );
+}
+
+} // namespace lonely_planet
+
+//============================================================================
+// The C interface: an LpRenderer is a PageRenderer, and exceptions become
+// a null handle and a message.
+
+using namespace lonely_planet;
+
+static LpRenderer * openRenderer
+(   PageRenderer * ( * create ) ( const void * arguments ),
+    const void * arguments,
+    char * errorBuffer,
+    size_t errorBufferSize
+)
+{
+    string error;
+    try
+    {
+        return reinterpret_cast< LpRenderer * > ( create ( arguments ) );
+    }
+    catch ( const string & exceptionError )
+    {
+        error = exceptionError;
+    }
+    catch ( const parse_error & exceptionError )
+    {
+        error = string ( "Parse error: " ) + exceptionError.what();
+    }
+    catch ( ... )
+    {
+        error = "Unknown exception";
+    }
+    if ( errorBuffer != 0 && errorBufferSize != 0 )
+    {
+        size_t length = min ( error.size(), errorBufferSize - 1 );
+        memcpy ( errorBuffer, error.data(), length );
+        errorBuffer[length] = 0;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// Checked before anything is read: a layout out of range would otherwise
+// quietly make nonsense of every link.
+
+static HtmlGenerator::OutputLayout getOutputLayout ( int layout )
+{
+    switch ( layout )
+    {
+        case LP_LAYOUT_FLAT:
+            return HtmlGenerator::LAYOUT_FLAT;
+        case LP_LAYOUT_HASHED:
+            return HtmlGenerator::LAYOUT_HASHED;
+        case LP_LAYOUT_PREFIX:
+            return HtmlGenerator::LAYOUT_ID_PREFIX;
+    }
+    stringstream errorStream;
+    errorStream << "Unknown layout " << layout;
+    throw errorStream.str();
+}
+
+//----------------------------------------------------------------------------
+
+struct XmlRendererArguments
+{
+    const char * m_taxonomyFileName;
+    const char * m_destinationsFileName;
+    const char * const * m_sectionNames;
+    size_t m_sectionCount;
+    int m_layout;
+    const char * m_templateFileName;
+};
+
+static PageRenderer * createXmlRenderer ( const void * arguments )
+{
+    const XmlRendererArguments & xmlArguments =
+        *static_cast< const XmlRendererArguments * > ( arguments );
+    HtmlGenerator::OutputLayout outputLayout =
+        getOutputLayout ( xmlArguments.m_layout );
+    set<string> sectionNames ( xmlArguments.m_sectionNames,
+        xmlArguments.m_sectionNames + xmlArguments.m_sectionCount );
+    if ( sectionNames.empty() )
+    {
+        sectionNames.insert ( "overview" );
+    }
+    return PageRenderer::createFromXml ( xmlArguments.m_taxonomyFileName,
+        xmlArguments.m_destinationsFileName, sectionNames, outputLayout,
+        xmlArguments.m_templateFileName );
+}
+
+//----------------------------------------------------------------------------
+
+LpRenderer * lpOpenRenderer
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const char * const * sectionNames,
+    size_t sectionCount,
+    int layout,
+    const char * templateFileName,
+    char * errorBuffer,
+    size_t errorBufferSize
+)
+{
+    XmlRendererArguments arguments;
+    arguments.m_taxonomyFileName = taxonomyFileName;
+    arguments.m_destinationsFileName = destinationsFileName;
+    arguments.m_sectionNames = sectionNames;
+    arguments.m_sectionCount = sectionCount;
+    arguments.m_layout = layout;
+    arguments.m_templateFileName = templateFileName;
+    return openRenderer ( createXmlRenderer, &arguments, errorBuffer,
+                         errorBufferSize );
+}
+
+//----------------------------------------------------------------------------
+
+struct SnapshotRendererArguments
+{
+    const char * m_snapshotFileName;
+    int m_layout;
+    const char * m_templateFileName;
+};
+
+static PageRenderer * createSnapshotRenderer ( const void * arguments )
+{
+    const SnapshotRendererArguments & snapshotArguments =
+        *static_cast< const SnapshotRendererArguments * > ( arguments );
+    return PageRenderer::createFromSnapshot (
+        snapshotArguments.m_snapshotFileName,
+        getOutputLayout ( snapshotArguments.m_layout ),
+        snapshotArguments.m_templateFileName );
+}
+
+//----------------------------------------------------------------------------
+
+LpRenderer * lpOpenRendererFromSnapshot
+(   const char * snapshotFileName,
+    int layout,
+    const char * templateFileName,
+    char * errorBuffer,
+    size_t errorBufferSize
+)
+{
+    SnapshotRendererArguments arguments;
+    arguments.m_snapshotFileName = snapshotFileName;
+    arguments.m_layout = layout;
+    arguments.m_templateFileName = templateFileName;
+    return openRenderer ( createSnapshotRenderer, &arguments, errorBuffer,
+                         errorBufferSize );
+}
+
+//----------------------------------------------------------------------------
+
+int lpRenderPage
+(   const LpRenderer * renderer,
+    int atlasId,
+    char * buffer,
+    size_t bufferSize,
+    size_t * pageLength
+)
+{
+    size_t length = 0;
+    if ( ! reinterpret_cast< const PageRenderer * > ( renderer )->renderPage (
+             atlasId, buffer, bufferSize, length ) )
+    {
+        return LP_NOT_FOUND;
+    }
+    if ( pageLength != 0 )
+    {
+        *pageLength = length;
+    }
+    return ( length <= bufferSize ) ? LP_RENDERED : LP_BUFFER_TOO_SMALL;
+}
+
+//----------------------------------------------------------------------------
+
+void lpCloseRenderer ( LpRenderer * renderer )
+{
+    delete reinterpret_cast< PageRenderer * > ( renderer );
+}
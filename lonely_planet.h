@@ -0,0 +1,80 @@
+// C interface to the Lonely Planet page renderer (PageRenderer in
+// lonely_planet.hpp), for programs which want the HTML for single
+// destinations without running the whole generator. Link with the library
+// built from lonely_planet.cpp (and with the C++ standard library).
+//
+// Open a renderer once, which reads and parses the inputs, then render any
+// destination's page into a buffer of your own. lpRenderPage may be called
+// from any number of threads at once, and allocates no memory: everything
+// it needs was parsed when the renderer was opened.
+
+#ifndef LONELY_PLANET_H
+#define LONELY_PLANET_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct LpRenderer LpRenderer;
+
+// Where the links in pages point, as for --layout.
+enum
+{
+    LP_LAYOUT_FLAT,
+    LP_LAYOUT_HASHED,
+    LP_LAYOUT_PREFIX
+};
+
+// Results of lpRenderPage.
+enum
+{
+    LP_RENDERED,
+    LP_NOT_FOUND,
+    LP_BUFFER_TOO_SMALL
+};
+
+// Returns a null pointer on failure, with the reason in errorBuffer (which
+// may be null); a layout other than the LP_LAYOUT_ values is a failure.
+// With no section names, shows "overview". templateFileName may be null for
+// the built-in template.
+LpRenderer * lpOpenRenderer
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const char * const * sectionNames,
+    size_t sectionCount,
+    int layout,
+    const char * templateFileName,
+    char * errorBuffer,
+    size_t errorBufferSize
+);
+
+// As lpOpenRenderer, but from a file saved with --save-snapshot.
+LpRenderer * lpOpenRendererFromSnapshot
+(   const char * snapshotFileName,
+    int layout,
+    const char * templateFileName,
+    char * errorBuffer,
+    size_t errorBufferSize
+);
+
+// Sets *pageLength (if pageLength isn't null) to the length of the page,
+// which is not NUL-terminated, and writes it into the buffer if it fits.
+// Returns LP_BUFFER_TOO_SMALL if it doesn't, so that a caller can ask with
+// a size of 0 first.
+int lpRenderPage
+(   const LpRenderer * renderer,
+    int atlasId,
+    char * buffer,
+    size_t bufferSize,
+    size_t * pageLength
+);
+
+void lpCloseRenderer ( LpRenderer * renderer );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
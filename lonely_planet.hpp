@@ -0,0 +1,953 @@
+// The Lonely Planet page generator's readers and renderer, as a library:
+// the program in lonely_planet_test.cpp is one user of it, and other
+// programs can render single pages with PageRenderer (or, from C, with the
+// functions in lonely_planet.h).
+//
+// Build lonely_planet.cpp (as C++14 or later) alongside, with the same
+// optional -DLP_WITH_ZLIB and -DLP_WITH_BROTLI as the program.
+
+#ifndef LONELY_PLANET_HPP
+#define LONELY_PLANET_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <rapidxml.hpp>
+
+namespace lonely_planet
+{
+
+// Classes:
+//
+//  XmlReader: reads a given XML file and uses RapidXml to parse it (again, if
+//  asked, for --watch).
+//  XmlReader TODO:
+//  TODO: (1) make XmlReader abstract and/or make its constructor protected.
+//  TODO: (2) destructor should really close m_file if not already closed.
+//
+//  TaxonomyReader: specialisation of XmlReader, used by HtmlGenerator to
+//  extract from the XML a doubly-linked tree of destinations (well, RapidXml
+//  does that for us), with a fudged "World" node at its root.
+//  TaxonomyReader TODO:
+//  DONE: (1) move the tree-traversal from HtmlGenerator::generateFilesForTree
+//  DONE: into a TaxonomyReader method, since HtmlGenerator has no business
+//  DONE: making assumptions about the form of the XML tree. (SiteModel::build
+//  DONE: does it now, and HtmlGenerator only ever sees the flattened model.)
+//  DONE: (2) Similarly move the level-skipping into TaxonomyReader; also
+//  DONE: factorise it into a private method called N times.
+//
+//  DestinationsReader: specialisation of XmlReader which generates map of
+//  destination-to-description.
+//  DestinationsReader TODO:
+//  DONE: (1) allow nicely for distinguishing multiple content sections in
+//  DONE: description.
+//
+//  SectionsFilter: tells RapidXml which elements of a destinations file to
+//  build nodes for, given the sections wanted, so that the rest is skipped.
+//
+//  DestinationsIndex: the lazy alternative to DestinationsReader, which maps
+//  the destinations file, notes where each destination lies in it, and only
+//  parses a destination when its description is first asked for.
+//
+//  SiteModel: the taxonomy tree and the destinations' descriptions,
+//  flattened into one position-independent block of tables which can be
+//  saved as a snapshot file and mapped back into memory.
+//
+//  HtmlGenerator: generates the HTML files (who would have guessed?) by
+//  descending the tree held in a SiteModel, whose nodes carry their
+//  descriptions with them.
+//  HtmlGenerator TODO:
+//  TODO: (1) copy other necessary files e.g. stylesheet.
+//  TODO: (2) destructor should if necessary close currently-open html file
+//  TODO: stream (which hence should be a member).
+//  TODO: (3) consider generating links on each page to entire ancestor line
+//  TODO: of destinations rather than just immediate parent.
+//  TODO: (4) consider generating index page which displays entire destination
+//  TODO: hierarchy (possibly collapsible).
+//  TODO: (5) see also TaxonomyReader TODOs.
+//
+//  HtmlTemplate: one instance per template file (or the built-in one),
+//  holding the template compiled into a list of literal segments and
+//  substitution slots.
+//  HtmlTemplate TODO:
+//  DONE: (1) read from template file instead of having it inline (yuk). Need
+//  DONE: to work out how to do the interpolation/substitution, though.
+//
+//  appendEscapedHtml: replaces the characters special to HTML in names and
+//  content, using RapidXml's (SIMD) scan for them to copy the runs of
+//  ordinary characters in between in one go.
+//
+//  PageRenderer: loads the inputs (or a snapshot) once, then renders any
+//  destination's page into a caller's buffer, from any thread.
+//
+//  TraceRecorder: collects timed spans of the work done, from any thread,
+//  and writes them out as Chrome trace events (for Perfetto and the like).
+//
+//============================================================================
+// Class declarations.
+
+void appendEscapedHtml
+(   std::string & output,
+    const char * text,
+    size_t length
+);
+
+// At most one recorder is active at a time, and the library's spans go to
+// that one. With none active, a span costs an atomic load.
+class TraceRecorder
+{
+    public:
+        // A span is timed from its construction until end() or its
+        // destruction, and records the thread it was made in. A null name
+        // means not to record this one after all.
+        class Span
+        {
+            public:
+                Span
+                (   const char * name,
+                    const char * detail = 0,
+                    int nodeId = -1
+                );
+                ~Span() { end(); }
+                void end();
+
+            private:
+                Span ( const Span & );              // not copyable
+                Span & operator= ( const Span & );
+
+                TraceRecorder * m_recorder;         // 0 if not recording
+                const char * m_name;
+                const char * m_detail;
+                int m_nodeId;
+                std::chrono::steady_clock::time_point m_start;
+        };
+
+        // Records one page in every pageSampleInterval.
+        TraceRecorder ( size_t pageSampleInterval );
+        static void setActive ( TraceRecorder * recorder );
+        static bool isActive();
+        // Whether to record the page about to be generated.
+        static bool isPageSampled();
+        void write ( const char * traceFileName ) const;
+
+    private:
+        struct Event
+        {
+            const char * m_name;
+            std::string m_detail;
+            int m_nodeId;
+            int m_threadId;
+            double m_startMicroseconds;
+            double m_durationMicroseconds;
+        };
+
+        static int getThreadId();
+
+        static std::atomic< TraceRecorder * > s_active;
+        std::chrono::steady_clock::time_point m_origin;
+        size_t m_pageSampleInterval;
+        std::atomic< size_t > m_pagesSeen;
+        mutable std::mutex m_eventsMutex;
+        std::vector< Event > m_events;
+};
+
+class XmlReader
+{
+    public:
+        XmlReader ( const char * fileSignifier,
+                    const char * fileName
+                  );
+        // readAndParse is just read then parse, which may also be called
+        // separately, for instance to time them.
+        void readAndParse() { read(); parse(); }
+        void read();
+        virtual void parse();
+        const rapidxml::xml_document<char> & getDocument() const;
+        const char * getFileName() const { return m_fileName.c_str(); }
+        size_t getBytesRead() const { return m_bytesRead; }
+        // Held for the file's text, which the document points into.
+        size_t getContentsBytes() const { return m_contents.capacity(); }
+
+        // The blocks RapidXml's pools have taken for every reader's
+        // document: how many, how many bytes in all, and how many bytes are
+        // still held.
+        struct PoolCounts
+        {
+            size_t m_blocks;
+            size_t m_bytes;
+            size_t m_liveBytes;
+        };
+        static PoolCounts getPoolCounts();
+
+        // Elements nested deeper than this in any file parsed from now on
+        // make the parse fail with a parse_error; 0, the default, means no
+        // limit. (The parser doesn't recurse, so copes with any depth.)
+        static void setMaxDepth ( size_t maxDepth ) { s_maxDepth = maxDepth; }
+        static size_t getMaxDepth() { return s_maxDepth; }
+
+    protected:
+        rapidxml::xml_document<char> m_document;
+
+    private:
+        void openFile();
+        static void * allocatePoolBlock ( size_t size );
+        static void freePoolBlock ( void * memory );
+
+        static std::atomic< size_t > s_poolBlocks;
+        static std::atomic< size_t > s_poolBytes;
+        static std::atomic< size_t > s_livePoolBytes;
+        static size_t s_maxDepth;
+
+        std::string m_fileSignifier;
+        std::string m_fileName;
+        std::ifstream m_file;
+        std::string m_contents;
+        size_t m_bytesRead;
+};
+
+class TaxonomyReader : public XmlReader
+{
+    public:
+        TaxonomyReader ( const char * fileName ) :
+            XmlReader ( "taxonomy", fileName ),
+            m_rootNode ( 0 )
+        {}
+        virtual void parse();
+        rapidxml::xml_node<char> * getRootNode() const { return m_rootNode; }
+
+    private:
+        rapidxml::xml_node<char> * findLevel
+        (   rapidxml::xml_node<char> * parent,
+            const char * name,
+            const char * level
+        ) const;
+
+        rapidxml::xml_node<char> * m_rootNode;
+};
+
+// Only what the descriptions of the given sections are made from is built:
+// the destinations (and the destinations element holding them) with their
+// attributes, and within a destination each element named after one of the
+// sections, whole. The other elements within a destination are scanned for
+// those, however deep, without anything being built for them or their text;
+// anything else is skipped outright.
+class SectionsFilter : public rapidxml::xml_filter<char>
+{
+    public:
+        SectionsFilter() : m_sectionNames ( 0 ) {}
+        void setSectionNames ( const std::set<std::string> * sectionNames )
+        {
+            m_sectionNames = sectionNames;
+        }
+        virtual rapidxml::filter_action filter
+        (   const rapidxml::xml_node<char> * parent,
+            const char * name,
+            size_t nameSize,
+            size_t depth
+        );
+
+    private:
+        const std::set<std::string> * m_sectionNames;
+};
+
+class DestinationsReader : public XmlReader
+{
+    public:
+        DestinationsReader ( const char * fileName ) :
+            XmlReader ( "destinations", fileName ) {}
+        // From the next parse on, build only what the descriptions of these
+        // sections need (see SectionsFilter), rather than the whole document,
+        // which is then no use for any other sections.
+        void selectSections ( const std::set<std::string> & sectionNames );
+        void generateDestinationDescriptions
+        (   const std::set<std::string> & sectionNames
+        );
+        void regenerateDestinationDescriptions
+        (   std::set<int> & changedNodeIds
+        );
+        const std::map< int, std::map< std::string, std::string > > &
+            getDescriptions() const
+        {
+            return m_descriptions;
+        }
+        const std::set<std::string> & getSectionNames() const
+        {
+            return *m_sectionNames;
+        }
+        // Roughly: the maps' nodes, and the strings' own allocations.
+        size_t getDescriptionsBytes() const;
+
+    private:
+        const std::set<std::string> * m_sectionNames;
+        std::map< int, std::map<std::string, std::string> > m_descriptions;
+        std::map< std::string, std::string> m_combinedContents;
+        // getSubTreeContent's
+        std::vector< rapidxml::xml_node< char > * > m_pendingNodes;
+        SectionsFilter m_sectionsFilter;
+};
+
+// Nothing is parsed up front: build makes one pass over the mapped file,
+// noting where each destination starts and ends, and getSections parses
+// just the one destination, the first time it is asked for, keeping its
+// sections for next time. So the time taken and the memory held grow with
+// the destinations actually rendered rather than with the file. Any thread
+// may ask for sections at once.
+class DestinationsIndex
+{
+    public:
+        DestinationsIndex ( const char * fileName );
+        ~DestinationsIndex();
+        void build ( const std::set<std::string> & sectionNames );
+        // The requested sections of the node's destination, in name order,
+        // each there even if empty; 0 if the file has no such destination.
+        const std::map< std::string, std::string > * getSections
+        (   int nodeId
+        ) const;
+        const char * getFileName() const { return m_fileName.c_str(); }
+        size_t getFileSize() const { return m_size; }
+        size_t getDestinationCount() const { return m_entries.size(); }
+        size_t getParsedCount() const;
+        // Roughly, as for DestinationsReader, plus the index itself.
+        size_t getSectionsBytes() const;
+
+    private:
+        DestinationsIndex ( const DestinationsIndex & );    // not copyable
+        DestinationsIndex & operator= ( const DestinationsIndex & );
+
+        // Where one destination lies in the file, from the "<" of its
+        // start tag to just after the ">" of its end tag.
+        struct Entry
+        {
+            int m_nodeId;
+            size_t m_begin;
+            size_t m_end;
+        };
+
+        struct EntryLess
+        {
+            bool operator()
+            (   const Entry & left,
+                const Entry & right
+            ) const
+            {
+                return left.m_nodeId < right.m_nodeId;
+            }
+        };
+
+        void mapFile();
+        void release();
+        void scan();
+        void parseDestination
+        (   const Entry & entry,
+            std::map< std::string, std::string > & sections
+        ) const;
+
+        std::string m_fileName;
+        const char * m_contents;
+        size_t m_size;
+        void * m_mapping;                    // 0 if not mapped
+        std::string m_storage;               // the contents, if not mapped
+        const std::set<std::string> * m_sectionNames;
+        mutable SectionsFilter m_sectionsFilter;
+        std::vector< Entry > m_entries;      // sorted by node-id
+        mutable std::mutex m_sectionsMutex;  // guards m_sections
+        // Those parsed so far.
+        mutable std::map< int, std::map< std::string, std::string > >
+            m_sections;
+};
+
+// Templates are compiled once into a flat list of operations, each either
+// copying a literal segment or filling a named substitution slot, so that
+// rendering a page is a single pass over that list.
+class HtmlTemplate
+{
+    public:
+        enum Slot
+        {
+            SLOT_LITERAL,       // not a slot: copy literal text
+            SLOT_TITLE,         // {{title}}
+            SLOT_NAVIGATION,    // {{navigation}}
+            SLOT_CONTENT,       // {{content}}
+            SLOT_ROOT,          // {{root}}
+            SLOT_COUNT          // number of the above
+        };
+
+        struct Operation
+        {
+            Slot m_slot;
+            const char * m_text;    // literal text, not nul-terminated
+            size_t m_length;
+        };
+
+        // One instance per template file; 0 means the built-in template.
+        static HtmlTemplate * createHtmlTemplate
+        (   const char * templateFileName = 0
+        );
+        bool isBuiltIn() const { return m_templateFileName.empty(); }
+        const std::vector< Operation > & getOperations() const
+        {
+            return m_operations;
+        }
+        // Total length of the literal segments, and the number of times
+        // each kind of slot appears: with these and the size of each slot's
+        // contents, the size of a page is known before rendering it.
+        size_t getLiteralsLength() const { return m_literalsLength; }
+        size_t getSlotUses ( Slot slot ) const { return m_slotUses[slot]; }
+
+    private:
+        // One per template file: see createHtmlTemplate.
+        HtmlTemplate ( const char * templateFileName );
+        void compile ( const char * templateText, size_t templateLength );
+
+        std::string m_templateFileName;
+        std::string m_templateText;      // file templates only
+        std::vector< Operation > m_operations;
+        size_t m_literalsLength;
+        size_t m_slotUses[SLOT_COUNT];
+};
+
+// The parsed inputs, flattened into one block of memory whose tables refer
+// to each other, and to a pool of text, only by index and offset. So the
+// block is position-independent: it can be saved as a snapshot file, which
+// a later run maps and renders from as it stands. Nodes are held in the
+// taxonomy's pre-order, so that a node's children and its subtree can be
+// found from its index alone.
+class SiteModel
+{
+    public:
+        static const uint32_t NONE = 0xffffffff;
+
+        struct Node
+        {
+            uint64_t m_idOffset;        // atlas_node_id text, NUL-terminated
+            uint64_t m_nameOffset;      // node_name text, not yet escaped
+            uint32_t m_idLength;        // 0 if not a usable node
+            uint32_t m_nameLength;
+            uint32_t m_parentIndex;     // NONE at the root
+            uint32_t m_subTreeSize;     // this node plus all its descendants
+            int32_t m_nodeId;
+            uint32_t m_descriptionIndex;    // NONE if it has no description
+        };
+
+        // Usable nodes' indices, sorted by node-id for lookups.
+        struct NodeIndexEntry
+        {
+            int32_t m_nodeId;
+            uint32_t m_index;
+        };
+
+        struct Description
+        {
+            int32_t m_nodeId;
+            uint32_t m_firstSection;    // its sections are in name order
+            uint32_t m_sectionCount;
+        };
+
+        struct Section
+        {
+            uint64_t m_contentOffset;   // already escaped
+            uint32_t m_contentLength;
+            uint32_t m_nameIndex;       // into the section names
+        };
+
+        struct SectionName
+        {
+            uint64_t m_offset;
+            uint32_t m_length;
+            uint32_t m_unused;
+        };
+
+        SiteModel();
+        ~SiteModel();
+        void build
+        (   const TaxonomyReader & taxonomyReader,
+            const DestinationsReader & destinationsReader
+        );
+        // The taxonomy and the section names alone, for when the
+        // descriptions are to come from a DestinationsIndex instead.
+        void build
+        (   const TaxonomyReader & taxonomyReader,
+            const std::set<std::string> & sectionNames
+        );
+        void saveSnapshot ( const char * snapshotFileName ) const;
+        void loadSnapshot ( const char * snapshotFileName );
+
+        size_t getNodeCount() const { return m_header->m_nodes.m_count; }
+        // The whole block of tables, built or mapped.
+        size_t getTablesBytes() const { return m_header->m_size; }
+        size_t getDescriptionCount() const
+        {
+            return m_header->m_descriptions.m_count;
+        }
+        const Node & getNode ( size_t index ) const
+        {
+            return getTable< Node > ( m_header->m_nodes )[index];
+        }
+        size_t findNode ( int nodeId ) const;   // NONE if there is none
+        const Description * getDescription ( const Node & node ) const;
+        const Section & getSection ( size_t index ) const
+        {
+            return getTable< Section > ( m_header->m_sections )[index];
+        }
+        size_t getSectionNameCount() const
+        {
+            return m_header->m_sectionNames.m_count;
+        }
+        const SectionName & getSectionName ( size_t index ) const
+        {
+            return getTable< SectionName > (
+                m_header->m_sectionNames )[index];
+        }
+        const char * getText ( uint64_t offset ) const
+        {
+            return getTable< char > ( m_header->m_text ) + offset;
+        }
+
+    private:
+        struct Table
+        {
+            uint64_t m_offset;          // from the start of the block
+            uint64_t m_count;
+        };
+
+        struct Header
+        {
+            char m_magic[8];
+            uint32_t m_version;
+            uint32_t m_byteOrder;       // BYTE_ORDER_MARK as written
+            uint64_t m_size;
+            Table m_nodes;
+            Table m_nodeIndex;
+            Table m_descriptions;
+            Table m_sections;
+            Table m_sectionNames;
+            Table m_text;
+        };
+
+        struct NodeIndexEntryLess
+        {
+            bool operator()
+            (   const NodeIndexEntry & left,
+                const NodeIndexEntry & right
+            ) const
+            {
+                return left.m_nodeId < right.m_nodeId;
+            }
+        };
+
+        template < class Entry >
+        const Entry * getTable ( const Table & table ) const
+        {
+            return reinterpret_cast< const Entry * > (
+                m_base + table.m_offset );
+        }
+        void build
+        (   const TaxonomyReader & taxonomyReader,
+            const std::set<std::string> & sectionNames,
+            const std::map< int, std::map< std::string, std::string > > &
+                descriptions
+        );
+        uint32_t addNodes
+        (   rapidxml::xml_node<char> * subTreeNode,
+            uint32_t subTreeParentIndex,
+            const std::map< int, uint32_t > & descriptionIndexes,
+            std::vector< Node > & nodes,
+            std::string & text
+        );
+        void addNode
+        (   rapidxml::xml_node<char> * node,
+            uint32_t parentIndex,
+            const std::map< int, uint32_t > & descriptionIndexes,
+            std::vector< Node > & nodes,
+            std::string & text
+        );
+        template < class Entry >
+        void placeTable
+        (   Table & table,
+            const std::vector< Entry > & entries,
+            size_t & size
+        ) const;
+        template < class Entry >
+        void copyTable
+        (   const Table & table,
+            const std::vector< Entry > & entries
+        );
+        static void checkSnapshot
+        (   const char * snapshotFileName,
+            const Header * header,
+            size_t size
+        );
+        static bool areSnapshotEntriesValid ( const Header * header );
+        void release();
+
+        std::vector< uint64_t > m_storage;  // built or read; 8-byte aligned
+        void * m_mapping;                   // when mapped
+        size_t m_mappingSize;
+        const char * m_base;
+        const Header * m_header;
+};
+
+class HtmlGenerator
+{
+    public:
+        // Where pages go beneath the output directory.
+        enum OutputLayout
+        {
+            LAYOUT_FLAT,        // lp_<nodeid>.html
+            LAYOUT_HASHED,      // <hash-hex>/<hash-hex>/lp_<nodeid>.html
+            LAYOUT_ID_PREFIX    // <digits 1-2>/<digits 3-4>/lp_<nodeid>.html
+        };
+
+        // What generateFiles and regenerateFiles have done, added up over
+        // every call.
+        struct Counts
+        {
+            Counts() :
+                m_pagesRendered ( 0 ),
+                m_filesWritten ( 0 ),
+                m_bytesWritten ( 0 ),
+                m_directoriesCreated ( 0 ),
+                m_renderSeconds ( 0 )
+            {}
+
+            void add ( const Counts & counts );
+
+            size_t m_pagesRendered;
+            size_t m_filesWritten;      // pages and compressed siblings
+            size_t m_bytesWritten;
+            size_t m_directoriesCreated;
+            double m_renderSeconds;     // only if rendering is timed
+        };
+
+        HtmlGenerator
+        (   const SiteModel & siteModel,
+            OutputLayout outputLayout = LAYOUT_FLAT,
+            const char * templateFileName = 0
+        ) : m_siteModel ( siteModel ),
+            m_outputDirectory ( "" ),
+            m_template ( HtmlTemplate::createHtmlTemplate (
+                templateFileName ) ),
+            m_outputLayout ( outputLayout ),
+            m_gzipLevel ( -1 ),
+            m_brotliQuality ( -1 ),
+            m_skipUnchangedPages ( false ),
+            m_sectionNames ( 0 ),
+            m_timeRendering ( false ),
+            m_workerCount ( 1 ),
+            m_destinationsIndex ( 0 ),
+            m_renderBufferBytes ( 0 )
+        {}
+        void prepareToRender();
+        size_t generateFiles ( const char * outputDirName );
+        size_t regenerateFiles ( const std::set<int> & nodeIds );
+
+        // Render one page, without writing it, after prepareToRender. May be
+        // called from several threads at once, each with its own buffer.
+        // Return false if there is no such (usable) node. The second sets
+        // pageLength and only renders the page if it fits in bufferSize; it
+        // allocates nothing, unless there is a destinations index, whose
+        // sections are parsed (and kept) when a page first needs them.
+        bool renderPageForNode ( int nodeId, std::string & page ) const;
+        bool renderPageForNode
+        (   int nodeId,
+            char * buffer,
+            size_t bufferSize,
+            size_t & pageLength
+        ) const;
+
+        // Remember what each page was last written as, and leave it alone
+        // when it comes out the same again.
+        void setSkipUnchangedPages ( bool skip )
+        {
+            m_skipUnchangedPages = skip;
+        }
+
+        // Compressed siblings of each page; a negative level (the default)
+        // means none.
+        void setGzipLevel ( int level ) { m_gzipLevel = level; }
+        void setBrotliQuality ( int quality ) { m_brotliQuality = quality; }
+
+        // Which of the described sections to show; 0 (the default) means
+        // all of them. Lets generators share one SiteModel.
+        void setSectionNames ( const std::set<std::string> * sectionNames )
+        {
+            m_sectionNames = sectionNames;
+        }
+
+        // Timing rendering separately from writing costs two clock reads
+        // a page, so is only done when asked for.
+        void setTimeRendering ( bool time ) { m_timeRendering = time; }
+        const Counts & getCounts() const { return m_counts; }
+        // Held for rendering: the links, the hashes of the pages (if
+        // skipping unchanged ones), and the most that the buffers pages
+        // were rendered into came to at once.
+        size_t getRenderBytes() const;
+
+        // Have generateFiles write pages from this many threads at once
+        // (default 1). regenerateFiles, and skipping unchanged pages, still
+        // use just the one.
+        void setWorkerCount ( unsigned int workerCount )
+        {
+            m_workerCount = ( workerCount != 0 ) ? workerCount : 1;
+        }
+
+        // Take the descriptions from the index, parsing each as its page is
+        // first rendered, rather than from the SiteModel, which should then
+        // have been built without them. 0 (the default) means the model.
+        void setDestinationsIndex ( const DestinationsIndex * index )
+        {
+            m_destinationsIndex = index;
+        }
+
+    private:
+        // Pre-rendered link for one node of the taxonomy, held at the same
+        // index as the node is in the SiteModel.
+        struct LinkSnippet
+        {
+            size_t m_offset;        // into m_linkSnippetText
+            size_t m_length;        // 0 if not a usable node
+            size_t m_nameOffset;    // the (escaped) link text
+            size_t m_nameLength;
+        };
+
+        // State carried down the tree while generating, or by one worker
+        // of several, which isn't walking the tree and has no ancestors.
+        struct TreeWalk
+        {
+            TreeWalk() : m_onlyNodeIds ( 0 ), m_isWalking ( true ) {}
+
+            std::vector< size_t > m_ancestors;   // node indices
+            std::string m_page;                  // reused for every page
+            const std::set<int> * m_onlyNodeIds; // 0 means every page
+            bool m_isWalking;               // false: pages climb the tree
+            Counts m_counts;                // added to the generator's after
+        };
+
+        void createDirectoryRecursively
+        (   const std::string & directoryName
+        ) const;
+        void createDirectory ( const std::string & directoryName ) const;
+        void makeDirectory ( const char * directoryName ) const;
+        void createLayoutDirectories() const;
+        void buildLinkSnippets();
+        size_t generateFilesForTree ( size_t index, TreeWalk & walk ) const;
+        size_t generateFilesInParallel();
+        void runGenerateWorker
+        (   std::atomic< size_t > & nextIndex,
+            size_t & pagesWritten,
+            TreeWalk & walk,
+            std::string & error,
+            std::unique_ptr< rapidxml::parse_error > & parseError
+        ) const;
+        bool generateFile ( size_t index, TreeWalk & walk ) const;
+        bool isPageUnchanged ( int nodeId, const std::string & page ) const;
+        // Everything that can be substituted into one page's template.
+        struct PageFields
+        {
+            const char * m_title;
+            size_t m_titleLength;
+            size_t m_index;
+            const std::vector< size_t > * m_ancestors;   // 0: climb the tree
+            const SiteModel::Description * m_description;   // may be 0
+            // The sections instead, when indexed; likewise may be 0.
+            const std::map< std::string, std::string > * m_sections;
+        };
+        void fillPageFields
+        (   size_t index,
+            const std::vector< size_t > * ancestors,
+            PageFields & fields
+        ) const;
+
+        // Page output, for use as the Output of the template methods below,
+        // which (like string) only need append ( data, length ).
+        // SizeCounter measures what would be written; BufferWriter copies
+        // it into a buffer already known to be big enough.
+        class SizeCounter
+        {
+            public:
+                SizeCounter() : m_size ( 0 ) {}
+                void append ( const char *, size_t length )
+                {
+                    m_size += length;
+                }
+                size_t getSize() const { return m_size; }
+
+            private:
+                size_t m_size;
+        };
+
+        class BufferWriter
+        {
+            public:
+                BufferWriter ( char * buffer ) : m_next ( buffer ) {}
+                void append ( const char * data, size_t length )
+                {
+                    memcpy ( m_next, data, length );
+                    m_next += length;
+                }
+
+            private:
+                char * m_next;
+        };
+
+        void renderPage
+        (   const PageFields & fields,
+            std::string & page
+        ) const;
+        size_t measurePage ( const PageFields & fields ) const;
+        void fillPage ( const PageFields & fields, char * buffer ) const;
+        template < class Output >
+        void writeOperations
+        (   Output & output,
+            const PageFields & fields
+        ) const;
+        template < size_t N, class Output >
+        void writeBuiltIn
+        (   Output & output,
+            const PageFields & fields,
+            std::true_type       // segment N is followed by a slot
+        ) const;
+        template < size_t N, class Output >
+        void writeBuiltIn
+        (   Output & output,
+            const PageFields & fields,
+            std::false_type      // segment N is the last
+        ) const;
+        template < class Output >
+        void writeSlot
+        (   Output & output,
+            HtmlTemplate::Slot slot,
+            const PageFields & fields
+        ) const;
+        template < class Output >
+        void writeNavigation
+        (   Output & output,
+            size_t index,
+            const std::vector< size_t > * ancestors
+        ) const;
+        template < class Output >
+        void writeAncestorLinks ( Output & output, size_t index ) const;
+        template < class Output >
+        void writeLink
+        (   Output & output,
+            const char * prefix,
+            size_t prefixLength,
+            size_t index
+        ) const;
+        template < class Output >
+        void writeContent
+        (   Output & output,
+            const SiteModel::Description * description
+        ) const;
+        template < class Output >
+        void writeIndexedContent
+        (   Output & output,
+            const std::map< std::string, std::string > * sections
+        ) const;
+        template < class Output >
+        void writeHeading
+        (   Output & output,
+            const char * name,
+            size_t nameLength
+        ) const;
+        void writePage
+        (   const std::string & htmlFilePath,
+            const std::string & page,
+            Counts & counts
+        ) const;
+        void writeFile
+        (   const std::string & filePath,
+            const char * data,
+            size_t size,
+            Counts & counts
+        ) const;
+        std::string makeHtmlFileName ( const char * nodeId ) const;
+        size_t getLayoutFanOut() const;
+        size_t getLayoutBucket ( const char * nodeId ) const;
+        void appendLayoutBucketName
+        (   std::string & name,
+            size_t bucket
+        ) const;
+
+        const SiteModel & m_siteModel;
+        std::string m_outputDirectory;
+        HtmlTemplate * m_template;
+        OutputLayout m_outputLayout;
+        int m_gzipLevel;
+        int m_brotliQuality;
+        bool m_skipUnchangedPages;
+        const std::set<std::string> * m_sectionNames;
+        bool m_timeRendering;
+        unsigned int m_workerCount;
+        const DestinationsIndex * m_destinationsIndex;
+        mutable Counts m_counts;
+        size_t m_renderBufferBytes;
+        std::vector< bool > m_sectionsShown;     // by section name index
+        mutable std::unordered_map< int, unsigned long long > m_pageHashes;
+        std::string m_linkPrefix;            // from any page back to the top
+        std::string m_linkSnippetText;
+        std::vector< LinkSnippet > m_linkSnippets;
+        std::vector< bool > m_layoutBucketsUsed;
+};
+
+// The entry point for other programs. Reading the inputs and building the
+// model happen once, when the renderer is created; the XML is let go of
+// then. The implementation is hidden so that the class itself stays the
+// same shape as the library changes.
+class PageRenderer
+{
+    public:
+        static PageRenderer * createFromXml
+        (   const char * taxonomyFileName,
+            const char * destinationsFileName,
+            const std::set<std::string> & sectionNames,
+            HtmlGenerator::OutputLayout outputLayout =
+                HtmlGenerator::LAYOUT_FLAT,
+            const char * templateFileName = 0
+        );
+        static PageRenderer * createFromSnapshot
+        (   const char * snapshotFileName,
+            HtmlGenerator::OutputLayout outputLayout =
+                HtmlGenerator::LAYOUT_FLAT,
+            const char * templateFileName = 0
+        );
+        ~PageRenderer();
+
+        // Returns false if there is no such destination. Otherwise sets
+        // pageLength, and renders the page into the buffer if it fits in
+        // bufferSize (so a caller can ask with a size of 0 first). Safe to
+        // call from any number of threads at once, and allocates nothing:
+        // the renderer's generator never has a destinations index.
+        bool renderPage
+        (   int nodeId,
+            char * buffer,
+            size_t bufferSize,
+            size_t & pageLength
+        ) const;
+
+    private:
+        struct Implementation;
+
+        PageRenderer ( Implementation * implementation ) :
+            m_implementation ( implementation )
+        {}
+        PageRenderer ( const PageRenderer & );              // not copyable
+        PageRenderer & operator= ( const PageRenderer & );
+
+        Implementation * m_implementation;
+};
+
+} // namespace lonely_planet
+
+#endif
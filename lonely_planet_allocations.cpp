@@ -0,0 +1,97 @@
+// Replaces the global operator new and delete, to count allocations and the
+// bytes asked for, for programs which want to know how many they make (such
+// as lonely_planet_bench, and lonely_planet_test for --stats). Compile and
+// link it in with them; this has to be a translation unit of its own so that
+// the compiler can't see through the replacements to the malloc and free
+// beneath them.
+//
+// Counting is off until setAllocationCounting turns it on, so that programs
+// which only sometimes want the counts don't pay for them otherwise: every
+// thread's allocations would contend for the same counters.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Relaxed, since only the total matters.
+static atomic< bool > countingAllocations ( false );
+static atomic< size_t > allocationCount ( 0 );
+static atomic< size_t > allocatedBytes ( 0 );
+
+//============================================================================
+// Allocations made while counting is off aren't counted, so turn it on
+// before whatever is to be measured.
+
+void setAllocationCounting ( bool counting )
+{
+    countingAllocations.store ( counting, memory_order_relaxed );
+}
+
+//----------------------------------------------------------------------------
+
+size_t getAllocationCount()
+{
+    return allocationCount.load ( memory_order_relaxed );
+}
+
+//----------------------------------------------------------------------------
+// In all, not just those still allocated.
+
+size_t getAllocatedBytes()
+{
+    return allocatedBytes.load ( memory_order_relaxed );
+}
+
+//----------------------------------------------------------------------------
+
+void * operator new ( size_t size )
+{
+    if ( countingAllocations.load ( memory_order_relaxed ) )
+    {
+        allocationCount.fetch_add ( 1, memory_order_relaxed );
+        allocatedBytes.fetch_add ( size, memory_order_relaxed );
+    }
+    void * memory = malloc ( size != 0 ? size : 1 );
+    if ( memory == 0 )
+    {
+        throw bad_alloc();
+    }
+    return memory;
+}
+
+//----------------------------------------------------------------------------
+
+void * operator new[] ( size_t size )
+{
+    return operator new ( size );
+}
+
+//----------------------------------------------------------------------------
+
+void operator delete ( void * memory ) noexcept
+{
+    free ( memory );
+}
+
+//----------------------------------------------------------------------------
+
+void operator delete[] ( void * memory ) noexcept
+{
+    free ( memory );
+}
+
+//----------------------------------------------------------------------------
+
+void operator delete ( void * memory, size_t ) noexcept
+{
+    free ( memory );
+}
+
+//----------------------------------------------------------------------------
+
+void operator delete[] ( void * memory, size_t ) noexcept
+{
+    free ( memory );
+}
@@ -0,0 +1,1181 @@
+// Compile (as C++14 or later) with lonely_planet.cpp and
+// lonely_planet_allocations.cpp, preferably with -O2, and run. Has no
+// dependencies apart from STL and RapidXml, as for the library itself.
+//
+// Times each stage of page generation on its own, so that any change meant
+// to make one of them faster can be judged on numbers: parsing (with
+// several sets of RapidXml flags), extracting the destinations'
+// descriptions, building the SiteModel, looking destinations up in it,
+// rendering pages (measuring only, into a buffer and into a string) and
+// writing the pages out as files; and the whole of generation, from
+// reading the files to writing the pages, end to end.
+//
+// Run as:
+//
+// lonely_planet_bench [ <options> ] <taxonomy-xml-file>
+//                     <destinations-xml-file> <scratch-directory>
+//                     [ <section-names> ]
+// where <section-names> defaults to "overview", <scratch-directory> is where
+// the pages are written (and is created if necessary), and <options> are:
+//
+// --samples=<n>      time each benchmark <n> times over (default 5).
+// --min-time=<ms>    keep repeating the benchmark's operations for at least
+//                    <ms> milliseconds per sample (default 200).
+// --filter=<text>    only run benchmarks whose names contain <text>.
+// --json=<file>      also write the results to <file> as JSON, to serve as
+//                    a baseline for later runs.
+// --baseline=<file>  compare the results with those written earlier to
+//                    <file> by --json, list every figure which has got
+//                    worse (or better) by more than its threshold, and
+//                    exit with status 2 if any got worse. Benchmarks
+//                    filtered out or missing from the baseline are left
+//                    out of the comparison.
+// --threshold=<percent>
+//                    how much slower, as throughput (or time per operation
+//                    where there's no throughput), a benchmark may get
+//                    before it counts as worse (default 10).
+// --count-threshold=<percent>
+//                    likewise for allocations and bytes allocated per
+//                    operation, which should hardly vary from run to run
+//                    (default 1). The bytes produced per operation (pages
+//                    rendered or written) count as worse if they change
+//                    by more than this either way, since the output
+//                    shouldn't.
+// --rss-threshold=<percent>
+//                    likewise for the peak resident set size of the whole
+//                    run (default 10), which is only known on Linux.
+//
+// lonely_planet_dataset makes inputs of any size for this.
+//
+// For each benchmark, reports the mean time per operation and the relative
+// standard deviation of the samples' means, the fastest sample's time, the
+// throughput in megabytes (10^6 bytes) a second of the input read or
+// output produced, and the number of heap allocations, and the bytes they
+// asked for, per operation. Those include the blocks taken by RapidXml's
+// pools, which go through the global operator new too. Then reports the
+// peak resident set size.
+//
+// lonely_planet_baseline.json is a baseline for the inputs made by
+// "lonely_planet_dataset --nodes=2000", run with the default options and
+// sections. Its allocation and output figures should hold anywhere
+// with the same standard library; its times are only good for the machine
+// that made them, so anywhere else make a baseline of your own first, from
+// the tree before the change to be judged.
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <sstream>
+#include <vector>
+
+#include "lonely_planet.hpp"
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace rapidxml;
+using namespace lonely_planet;
+
+// Classes:
+//
+//  Benchmark: one stage to be timed. prepare() does whatever each run needs
+//  beforehand and isn't to be timed, and run() does the timed work, saying
+//  how many operations and bytes it amounted to.
+//
+//  ParseBenchmark, ExtractBenchmark, BuildBenchmark, LookupBenchmark,
+//  RenderBenchmark, WriteBenchmark: the stages.
+//
+//  SiteBenchmark: all of the stages, as a run of the program does them.
+//
+//  BenchmarkResult: the figures for one benchmark.
+//
+//  JsonNumbers: the numbers in a JSON file, by their dotted paths (e.g.
+//  "benchmarks.parse/default.ns_per_op"), for reading a baseline.
+//
+//  BenchmarkInputs: the files and what has been made from them, shared by
+//  the benchmarks which need them.
+//
+//  setAllocationCounting, getAllocationCount, getAllocatedBytes: how many
+//  allocations there have been, and how many bytes they have asked for,
+//  counted (once counting is on) by the global operator new in
+//  lonely_planet_allocations.cpp.
+//
+//============================================================================
+// Class declarations.
+
+class Benchmark
+{
+    public:
+        Benchmark ( const string & name ) : m_name ( name ) {}
+        virtual ~Benchmark() {}
+        const string & getName() const { return m_name; }
+        virtual void prepare() {}
+        virtual void run ( size_t & operations, size_t & bytes ) = 0;
+
+    private:
+        string m_name;
+};
+
+struct BenchmarkInputs
+{
+    BenchmarkInputs
+    (   const char * taxonomyFileName,
+        const char * destinationsFileName,
+        const char * scratchDirName,
+        const set<string> & sectionNames
+    );
+
+    string m_destinationsText;      // as in the file, for parsing afresh
+    string m_taxonomyText;
+    TaxonomyReader m_taxonomyReader;
+    DestinationsReader m_destinationsReader;
+    set<string> m_sectionNames;
+    SiteModel m_siteModel;
+    vector< int > m_nodeIds;        // of usable nodes, in a jumbled order
+    string m_scratchDirName;
+};
+
+template < int Flags >
+class ParseBenchmark : public Benchmark
+{
+    public:
+        ParseBenchmark
+        (   const string & name,
+            const string & text,
+            xml_filter<char> * filter = 0
+        ) : Benchmark ( name ), m_text ( text )
+        {
+            m_document.set_filter ( filter );
+        }
+        virtual void prepare();
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        const string & m_text;
+        vector< char > m_buffer;    // parsing may change it
+        xml_document<char> m_document;
+};
+
+class ExtractBenchmark : public Benchmark
+{
+    public:
+        ExtractBenchmark ( BenchmarkInputs & inputs ) :
+            Benchmark ( "extract/descriptions" ), m_inputs ( inputs ) {}
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        BenchmarkInputs & m_inputs;
+};
+
+class BuildBenchmark : public Benchmark
+{
+    public:
+        BuildBenchmark ( BenchmarkInputs & inputs ) :
+            Benchmark ( "model/build" ), m_inputs ( inputs ) {}
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        BenchmarkInputs & m_inputs;
+};
+
+class LookupBenchmark : public Benchmark
+{
+    public:
+        LookupBenchmark ( BenchmarkInputs & inputs ) :
+            Benchmark ( "lookup/description" ), m_inputs ( inputs ),
+            m_sectionsFound ( 0 ) {}
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        BenchmarkInputs & m_inputs;
+        size_t m_sectionsFound;     // so the lookups aren't optimised away
+};
+
+class RenderBenchmark : public Benchmark
+{
+    public:
+        enum Sink
+        {
+            SINK_NONE,      // measure the page only
+            SINK_BUFFER,    // into a buffer big enough for any page
+            SINK_STRING     // into a reused string, as when writing files
+        };
+
+        RenderBenchmark
+        (   const string & name,
+            BenchmarkInputs & inputs,
+            Sink sink
+        );
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        BenchmarkInputs & m_inputs;
+        Sink m_sink;
+        HtmlGenerator m_htmlGenerator;
+        vector< char > m_buffer;
+        string m_page;
+};
+
+class WriteBenchmark : public Benchmark
+{
+    public:
+        WriteBenchmark ( BenchmarkInputs & inputs ) :
+            Benchmark ( "write/files" ), m_inputs ( inputs ),
+            m_pageBytes ( 0 ) {}
+        virtual void prepare();
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        BenchmarkInputs & m_inputs;
+        size_t m_pageBytes;
+};
+
+class SiteBenchmark : public Benchmark
+{
+    public:
+        SiteBenchmark
+        (   const char * taxonomyFileName,
+            const char * destinationsFileName,
+            BenchmarkInputs & inputs
+        ) : Benchmark ( "site/generate" ),
+            m_taxonomyFileName ( taxonomyFileName ),
+            m_destinationsFileName ( destinationsFileName ),
+            m_inputs ( inputs ) {}
+        virtual void run ( size_t & operations, size_t & bytes );
+
+    private:
+        string m_taxonomyFileName;
+        string m_destinationsFileName;
+        BenchmarkInputs & m_inputs;
+};
+
+struct BenchmarkResult
+{
+    string m_name;
+    double m_nanosecondsPerOperation;
+    double m_megabytesPerSecond;        // negative if no bytes
+    double m_allocationsPerOperation;
+    double m_allocatedBytesPerOperation;
+    double m_bytesPerOperation;
+};
+
+class JsonNumbers
+{
+    public:
+        JsonNumbers() : m_position ( 0 ) {}
+        void read ( const char * fileName );
+        // False if there is no such number.
+        bool find ( const string & path, double & number ) const;
+
+    private:
+        void parseValue ( const string & path );
+        void parseString ( string & text );
+        void skipSpace();
+        void expect ( char character );
+        void throwError ( const char * expected ) const;
+
+        string m_fileName;
+        string m_text;
+        size_t m_position;
+        map< string, double > m_numbers;
+};
+
+void setAllocationCounting ( bool counting );
+size_t getAllocationCount();
+size_t getAllocatedBytes();
+static void readWholeFile ( const char * fileName, string & text );
+static void runBenchmark
+(   Benchmark & benchmark,
+    size_t samples,
+    double minimumSeconds,
+    BenchmarkResult & result
+);
+static long getPeakResidentKilobytes();
+static void writeResultsJson
+(   const vector< BenchmarkResult > & results,
+    long peakResidentKilobytes,
+    const char * jsonFileName
+);
+static size_t compareWithBaseline
+(   const vector< BenchmarkResult > & results,
+    long peakResidentKilobytes,
+    const char * baselineFileName,
+    double thresholdPercent,
+    double countThresholdPercent,
+    double rssThresholdPercent
+);
+
+//============================================================================
+
+extern int main ( int argc, char ** argv )
+{
+    size_t samples = 5;
+    int minimumMilliseconds = 200;
+    string filter;
+    const char * jsonFileName = 0;
+    const char * baselineFileName = 0;
+    double thresholdPercent = 10;
+    double countThresholdPercent = 1;
+    double rssThresholdPercent = 10;
+    vector< const char * > arguments;
+    setAllocationCounting ( true );
+    for ( int inx = 1; inx < argc; ++inx )
+    {
+        string argument ( argv[inx] );
+        if ( argument.compare ( 0, 2, "--" ) != 0 )
+        {
+            arguments.push_back ( argv[inx] );
+        }
+        else if ( argument.compare ( 0, 10, "--samples=" ) == 0 )
+        {
+            samples = strtoul ( argument.c_str() + 10, 0, 10 );
+        }
+        else if ( argument.compare ( 0, 11, "--min-time=" ) == 0 )
+        {
+            minimumMilliseconds = atoi ( argument.c_str() + 11 );
+        }
+        else if ( argument.compare ( 0, 9, "--filter=" ) == 0 )
+        {
+            filter = argument.substr ( 9 );
+        }
+        else if ( argument.compare ( 0, 7, "--json=" ) == 0 )
+        {
+            jsonFileName = argv[inx] + 7;
+        }
+        else if ( argument.compare ( 0, 11, "--baseline=" ) == 0 )
+        {
+            baselineFileName = argv[inx] + 11;
+        }
+        else if ( argument.compare ( 0, 12, "--threshold=" ) == 0 )
+        {
+            thresholdPercent = atof ( argument.c_str() + 12 );
+        }
+        else if ( argument.compare ( 0, 18, "--count-threshold=" ) == 0 )
+        {
+            countThresholdPercent = atof ( argument.c_str() + 18 );
+        }
+        else if ( argument.compare ( 0, 16, "--rss-threshold=" ) == 0 )
+        {
+            rssThresholdPercent = atof ( argument.c_str() + 16 );
+        }
+        else
+        {
+            cerr << "Error: (" << argv[0] << ") unrecognised option "
+                 << argument << endl;
+            return 1;
+        }
+    }
+
+    // Check arguments.
+    if ( arguments.size() < 3 || samples < 1 || minimumMilliseconds < 0 )
+    {
+        cerr << "Error: (" << argv[0] << ") needs [ <options> ] "
+             << "<taxonomy-xml-file> <destinations-xml-file> "
+             << "<scratch-directory> [ <section-names> ], and at least one "
+             << "sample" << endl;
+        return 1;
+    }
+    set<string> sectionNames ( arguments.begin() + 3, arguments.end() );
+    if ( sectionNames.empty() )
+    {
+        sectionNames.insert ( "overview" );
+    }
+
+    try
+    {
+        BenchmarkInputs inputs ( arguments[0], arguments[1], arguments[2],
+                                 sectionNames );
+        SectionsFilter sectionsFilter;      // only the wanted sections
+        sectionsFilter.setSectionNames ( &inputs.m_sectionNames );
+
+        vector< unique_ptr< Benchmark > > benchmarks;
+        benchmarks.emplace_back ( new ParseBenchmark< 0 > (
+            "parse/taxonomy", inputs.m_taxonomyText ) );
+        benchmarks.emplace_back ( new ParseBenchmark< 0 > (
+            "parse/default", inputs.m_destinationsText ) );
+        benchmarks.emplace_back ( new ParseBenchmark<
+            parse_no_entity_translation > (
+            "parse/no_entity_translation", inputs.m_destinationsText ) );
+        benchmarks.emplace_back ( new ParseBenchmark< parse_non_destructive > (
+            "parse/non_destructive", inputs.m_destinationsText ) );
+        benchmarks.emplace_back ( new ParseBenchmark< parse_fastest > (
+            "parse/fastest", inputs.m_destinationsText ) );
+        benchmarks.emplace_back ( new ParseBenchmark< parse_full > (
+            "parse/full", inputs.m_destinationsText ) );
+        benchmarks.emplace_back ( new ParseBenchmark< 0 > (
+            "parse/sections", inputs.m_destinationsText, &sectionsFilter ) );
+        benchmarks.emplace_back ( new ExtractBenchmark ( inputs ) );
+        benchmarks.emplace_back ( new BuildBenchmark ( inputs ) );
+        benchmarks.emplace_back ( new LookupBenchmark ( inputs ) );
+        benchmarks.emplace_back ( new RenderBenchmark ( "render/measure",
+            inputs, RenderBenchmark::SINK_NONE ) );
+        benchmarks.emplace_back ( new RenderBenchmark ( "render/buffer",
+            inputs, RenderBenchmark::SINK_BUFFER ) );
+        benchmarks.emplace_back ( new RenderBenchmark ( "render/string",
+            inputs, RenderBenchmark::SINK_STRING ) );
+        benchmarks.emplace_back ( new WriteBenchmark ( inputs ) );
+        benchmarks.emplace_back ( new SiteBenchmark ( arguments[0],
+            arguments[1], inputs ) );
+
+        printf ( "%-28s %14s %7s %14s %10s %10s %12s\n", "benchmark",
+                 "ns/op", "+/-", "fastest", "MB/s", "allocs/op",
+                 "alloc B/op" );
+        vector< BenchmarkResult > results;
+        for ( vector< unique_ptr< Benchmark > >::iterator iter =
+                  benchmarks.begin(); iter != benchmarks.end(); ++iter )
+        {
+            if ( ( *iter )->getName().find ( filter ) != string::npos )
+            {
+                results.push_back ( BenchmarkResult() );
+                runBenchmark ( **iter, samples,
+                               minimumMilliseconds / 1000.0,
+                               results.back() );
+            }
+        }
+        long peakResidentKilobytes = getPeakResidentKilobytes();
+        if ( peakResidentKilobytes >= 0 )
+        {
+            printf ( "peak RSS: %ld KB\n", peakResidentKilobytes );
+        }
+
+        if ( jsonFileName != 0 )
+        {
+            writeResultsJson ( results, peakResidentKilobytes, jsonFileName );
+        }
+        if ( baselineFileName != 0
+             && compareWithBaseline ( results, peakResidentKilobytes,
+                                      baselineFileName, thresholdPercent,
+                                      countThresholdPercent,
+                                      rssThresholdPercent ) != 0 )
+        {
+            return 2;
+        }
+    }
+    catch ( const string & exceptionError )
+    {
+        cerr << "Error: (" << argv[0] << ") " << exceptionError << endl;
+        return 1;
+    }
+    catch ( const parse_error & exceptionError )
+    {
+        cerr << "Error: (" << argv[0] << ") parse error: "
+             << exceptionError.what() << endl;
+        return 1;
+    }
+    catch ( ... )
+    {
+        cerr << "Error: (" << argv[0] << ") unknown exception" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// Each sample repeats the benchmark until it has taken long enough, timing
+// only run(), and its time per operation is the total over the total. The
+// first run is a warm-up, and not counted. The result's time per operation
+// is the mean of the samples'.
+
+static void runBenchmark
+(   Benchmark & benchmark,
+    size_t samples,
+    double minimumSeconds,
+    BenchmarkResult & result
+)
+{
+    typedef chrono::steady_clock Clock;
+
+    size_t operations = 0;
+    size_t bytes = 0;
+    benchmark.prepare();
+    benchmark.run ( operations, bytes );
+
+    vector< double > sampleNanoseconds;
+    double totalSeconds = 0;
+    size_t totalOperations = 0;
+    size_t allocations = 0;
+    size_t allocatedBytes = 0;
+    bytes = 0;
+    for ( size_t sample = 0; sample < samples; ++sample )
+    {
+        double seconds = 0;
+        operations = 0;
+        do
+        {
+            benchmark.prepare();
+            size_t allocationsBefore = getAllocationCount();
+            size_t allocatedBytesBefore = getAllocatedBytes();
+            Clock::time_point start = Clock::now();
+            benchmark.run ( operations, bytes );
+            seconds += chrono::duration< double > (
+                Clock::now() - start ).count();
+            allocations += getAllocationCount() - allocationsBefore;
+            allocatedBytes += getAllocatedBytes() - allocatedBytesBefore;
+        }
+        while ( seconds < minimumSeconds );
+        sampleNanoseconds.push_back ( seconds * 1e9 / operations );
+        totalSeconds += seconds;
+        totalOperations += operations;
+    }
+
+    double mean = 0;
+    for ( size_t sample = 0; sample < samples; ++sample )
+    {
+        mean += sampleNanoseconds[sample];
+    }
+    mean /= samples;
+    double variance = 0;
+    for ( size_t sample = 0; sample < samples; ++sample )
+    {
+        double difference = sampleNanoseconds[sample] - mean;
+        variance += difference * difference;
+    }
+    variance /= ( samples > 1 ) ? samples - 1 : 1;
+
+    printf ( "%-28s %14.1f %6.1f%% %14.1f ", benchmark.getName().c_str(),
+             mean, mean > 0 ? 100 * sqrt ( variance ) / mean : 0.0,
+             *min_element ( sampleNanoseconds.begin(),
+                            sampleNanoseconds.end() ) );
+    if ( bytes != 0 )
+    {
+        printf ( "%10.1f ", bytes / totalSeconds / 1e6 );
+    }
+    else
+    {
+        printf ( "%10s ", "-" );
+    }
+    printf ( "%10.1f %12.1f\n", double ( allocations ) / totalOperations,
+             double ( allocatedBytes ) / totalOperations );
+    fflush ( stdout );
+
+    result.m_name = benchmark.getName();
+    result.m_nanosecondsPerOperation = mean;
+    result.m_megabytesPerSecond =
+        ( bytes != 0 ) ? bytes / totalSeconds / 1e6 : -1;
+    result.m_allocationsPerOperation =
+        double ( allocations ) / totalOperations;
+    result.m_allocatedBytesPerOperation =
+        double ( allocatedBytes ) / totalOperations;
+    result.m_bytesPerOperation = double ( bytes ) / totalOperations;
+}
+
+//----------------------------------------------------------------------------
+// Of the whole process so far; negative if not known.
+
+static long getPeakResidentKilobytes()
+{
+#ifdef __linux__
+    struct rusage usage;
+    if ( getrusage ( RUSAGE_SELF, &usage ) == 0 )
+    {
+        return usage.ru_maxrss;     // in kilobytes on Linux
+    }
+#endif
+    return -1;
+}
+
+//----------------------------------------------------------------------------
+// Figures which aren't known are left out.
+
+static void writeResultsJson
+(   const vector< BenchmarkResult > & results,
+    long peakResidentKilobytes,
+    const char * jsonFileName
+)
+{
+    ofstream jsonFile ( jsonFileName, ios::out );
+    if ( ! jsonFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open results file " << jsonFileName
+                    << " for writing";
+        throw errorStream.str();
+    }
+
+    jsonFile << "{\n";
+    if ( peakResidentKilobytes >= 0 )
+    {
+        jsonFile << "  \"peak_rss_kb\": " << peakResidentKilobytes << ",\n";
+    }
+    jsonFile << "  \"benchmarks\": {";
+    char number[32];
+    for ( vector< BenchmarkResult >::const_iterator iter = results.begin();
+          iter != results.end(); ++iter )
+    {
+        jsonFile << ( iter == results.begin() ? "\n" : ",\n" )
+                 << "    \"" << iter->m_name << "\": {";
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   iter->m_nanosecondsPerOperation );
+        jsonFile << " \"ns_per_op\": " << number;
+        if ( iter->m_megabytesPerSecond >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.1f",
+                       iter->m_megabytesPerSecond );
+            jsonFile << ", \"mb_per_s\": " << number;
+        }
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   iter->m_allocationsPerOperation );
+        jsonFile << ", \"allocs_per_op\": " << number;
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   iter->m_allocatedBytesPerOperation );
+        jsonFile << ", \"alloc_bytes_per_op\": " << number;
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   iter->m_bytesPerOperation );
+        jsonFile << ", \"bytes_per_op\": " << number << " }";
+    }
+    jsonFile << "\n  }\n}\n";
+}
+
+//----------------------------------------------------------------------------
+// Lists each figure which has changed by more than its threshold, as a
+// percentage of the baseline, and returns how many of those got worse.
+// Speed is compared as throughput where there is one, otherwise as time
+// per operation. A figure which was zero and no longer is counts as
+// infinitely worse.
+
+static size_t compareWithBaseline
+(   const vector< BenchmarkResult > & results,
+    long peakResidentKilobytes,
+    const char * baselineFileName,
+    double thresholdPercent,
+    double countThresholdPercent,
+    double rssThresholdPercent
+)
+{
+    enum Direction { LOWER_IS_BETTER, HIGHER_IS_BETTER, UNCHANGED };
+    struct Figure
+    {
+        string m_label;
+        string m_path;
+        double m_current;
+        Direction m_direction;
+        double m_thresholdPercent;
+    };
+
+    vector< Figure > figures;
+    for ( vector< BenchmarkResult >::const_iterator iter = results.begin();
+          iter != results.end(); ++iter )
+    {
+        string path ( "benchmarks." + iter->m_name + "." );
+        Figure figure;
+        figure.m_thresholdPercent = thresholdPercent;
+        if ( iter->m_megabytesPerSecond >= 0 )
+        {
+            figure.m_label = iter->m_name + " MB/s";
+            figure.m_path = path + "mb_per_s";
+            figure.m_current = iter->m_megabytesPerSecond;
+            figure.m_direction = HIGHER_IS_BETTER;
+        }
+        else
+        {
+            figure.m_label = iter->m_name + " ns/op";
+            figure.m_path = path + "ns_per_op";
+            figure.m_current = iter->m_nanosecondsPerOperation;
+            figure.m_direction = LOWER_IS_BETTER;
+        }
+        figures.push_back ( figure );
+        figure.m_label = iter->m_name + " allocs/op";
+        figure.m_path = path + "allocs_per_op";
+        figure.m_current = iter->m_allocationsPerOperation;
+        figure.m_direction = LOWER_IS_BETTER;
+        figure.m_thresholdPercent = countThresholdPercent;
+        figures.push_back ( figure );
+        figure.m_label = iter->m_name + " alloc B/op";
+        figure.m_path = path + "alloc_bytes_per_op";
+        figure.m_current = iter->m_allocatedBytesPerOperation;
+        figures.push_back ( figure );
+        figure.m_label = iter->m_name + " bytes/op";
+        figure.m_path = path + "bytes_per_op";
+        figure.m_current = iter->m_bytesPerOperation;
+        figure.m_direction = UNCHANGED;
+        figures.push_back ( figure );
+    }
+    if ( peakResidentKilobytes >= 0 )
+    {
+        Figure figure;
+        figure.m_label = "peak RSS (KB)";
+        figure.m_path = "peak_rss_kb";
+        figure.m_current = double ( peakResidentKilobytes );
+        figure.m_direction = LOWER_IS_BETTER;
+        figure.m_thresholdPercent = rssThresholdPercent;
+        figures.push_back ( figure );
+    }
+
+    JsonNumbers baseline;
+    baseline.read ( baselineFileName );
+    size_t compared = 0;
+    size_t worse = 0;
+    bool headed = false;
+    for ( vector< Figure >::const_iterator iter = figures.begin();
+          iter != figures.end(); ++iter )
+    {
+        double previous = 0;
+        if ( ! baseline.find ( iter->m_path, previous ) )
+        {
+            continue;
+        }
+        ++compared;
+        double change = ( previous != 0 )
+            ? 100 * ( iter->m_current - previous ) / previous
+            : ( iter->m_current != 0 ? HUGE_VAL : 0 );
+        bool isWorse = false;
+        switch ( iter->m_direction )
+        {
+            case LOWER_IS_BETTER:   isWorse = change > 0;     break;
+            case HIGHER_IS_BETTER:  isWorse = change < 0;     break;
+            case UNCHANGED:         isWorse = true;           break;
+        }
+        if ( fabs ( change ) <= iter->m_thresholdPercent )
+        {
+            continue;
+        }
+        if ( ! headed )
+        {
+            printf ( "\nChanged from baseline %s by more than the "
+                     "thresholds:\n%-40s %14s %14s %9s\n", baselineFileName,
+                     "figure", "baseline", "now", "change" );
+            headed = true;
+        }
+        printf ( "%-40s %14.1f %14.1f %+8.1f%% %s\n", iter->m_label.c_str(),
+                 previous, iter->m_current, change,
+                 isWorse ? "WORSE" : "better" );
+        if ( isWorse )
+        {
+            ++worse;
+        }
+    }
+    printf ( "\n%lu of %lu figures compared with baseline %s got worse.\n",
+             ( unsigned long ) worse, ( unsigned long ) compared,
+             baselineFileName );
+    return worse;
+}
+
+//============================================================================
+// Only as much JSON as --json writes: objects, numbers and strings, though
+// arrays, true, false and null are skipped over without complaint. An
+// object's members' paths are its own followed by "." and their names.
+
+void JsonNumbers::read ( const char * fileName )
+{
+    m_fileName = fileName;
+    readWholeFile ( fileName, m_text );
+    m_position = 0;
+    m_numbers.clear();
+    parseValue ( "" );
+    skipSpace();
+    if ( m_position != m_text.size() )
+    {
+        throwError ( "the end of the file" );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+bool JsonNumbers::find
+(   const string & path,
+    double & number
+) const
+{
+    map< string, double >::const_iterator iter = m_numbers.find ( path );
+    if ( iter == m_numbers.end() )
+    {
+        return false;
+    }
+    number = iter->second;
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void JsonNumbers::parseValue ( const string & path )
+{
+    skipSpace();
+    if ( m_position == m_text.size() )
+    {
+        throwError ( "a value" );
+    }
+    char character = m_text[m_position];
+    if ( character == '{' || character == '[' )
+    {
+        char closing = ( character == '{' ) ? '}' : ']';
+        ++m_position;
+        skipSpace();
+        if ( m_position < m_text.size() && m_text[m_position] == closing )
+        {
+            ++m_position;
+            return;
+        }
+        for ( size_t index = 0; ; ++index )
+        {
+            stringstream memberPath;
+            memberPath << path << ( path.empty() ? "" : "." );
+            if ( closing == '}' )
+            {
+                string name;
+                skipSpace();
+                parseString ( name );
+                expect ( ':' );
+                memberPath << name;
+            }
+            else
+            {
+                memberPath << index;
+            }
+            parseValue ( memberPath.str() );
+            skipSpace();
+            if ( m_position < m_text.size() && m_text[m_position] == ',' )
+            {
+                ++m_position;
+                continue;
+            }
+            expect ( closing );
+            return;
+        }
+    }
+    else if ( character == '"' )
+    {
+        string ignored;
+        parseString ( ignored );
+    }
+    else if ( m_text.compare ( m_position, 4, "true" ) == 0
+              || m_text.compare ( m_position, 4, "null" ) == 0 )
+    {
+        m_position += 4;
+    }
+    else if ( m_text.compare ( m_position, 5, "false" ) == 0 )
+    {
+        m_position += 5;
+    }
+    else
+    {
+        const char * start = m_text.c_str() + m_position;
+        char * end = 0;
+        double number = strtod ( start, &end );
+        if ( end == start )
+        {
+            throwError ( "a value" );
+        }
+        m_position += end - start;
+        m_numbers[path] = number;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Escapes are kept as they are, since names here don't need them.
+
+void JsonNumbers::parseString ( string & text )
+{
+    expect ( '"' );
+    size_t start = m_position;
+    while ( m_position < m_text.size() && m_text[m_position] != '"' )
+    {
+        m_position += ( m_text[m_position] == '\\' ) ? 2 : 1;
+    }
+    if ( m_position >= m_text.size() )
+    {
+        throwError ( "the end of a string" );
+    }
+    text.assign ( m_text, start, m_position - start );
+    ++m_position;
+}
+
+//----------------------------------------------------------------------------
+
+void JsonNumbers::skipSpace()
+{
+    while ( m_position < m_text.size() && isspace (
+                static_cast< unsigned char > ( m_text[m_position] ) ) )
+    {
+        ++m_position;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void JsonNumbers::expect ( char character )
+{
+    skipSpace();
+    if ( m_position >= m_text.size() || m_text[m_position] != character )
+    {
+        string expected ( "'" );
+        expected += character;
+        expected += "'";
+        throwError ( expected.c_str() );
+    }
+    ++m_position;
+}
+
+//----------------------------------------------------------------------------
+
+void JsonNumbers::throwError ( const char * expected ) const
+{
+    stringstream errorStream;
+    errorStream << "Expected " << expected << " at offset " << m_position
+                << " of JSON file " << m_fileName;
+    throw errorStream.str();
+}
+
+//============================================================================
+// Read and process everything once, as the program would, so that each
+// benchmark can start from the stage before its own. The node-ids are
+// shuffled (reproducibly) so that lookups and rendering don't just walk
+// the tables in order.
+
+BenchmarkInputs::BenchmarkInputs
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const char * scratchDirName,
+    const set<string> & sectionNames
+) : m_taxonomyReader ( taxonomyFileName ),
+    m_destinationsReader ( destinationsFileName ),
+    m_sectionNames ( sectionNames ),
+    m_scratchDirName ( scratchDirName )
+{
+    readWholeFile ( taxonomyFileName, m_taxonomyText );
+    readWholeFile ( destinationsFileName, m_destinationsText );
+    m_taxonomyReader.readAndParse();
+    m_destinationsReader.selectSections ( m_sectionNames );
+    m_destinationsReader.readAndParse();
+    m_destinationsReader.generateDestinationDescriptions ( m_sectionNames );
+    m_siteModel.build ( m_taxonomyReader, m_destinationsReader );
+
+    for ( size_t index = 0; index < m_siteModel.getNodeCount(); ++index )
+    {
+        if ( m_siteModel.getNode ( index ).m_idLength != 0 )
+        {
+            m_nodeIds.push_back ( m_siteModel.getNode ( index ).m_nodeId );
+        }
+    }
+    unsigned long long state = 1;
+    for ( size_t inx = m_nodeIds.size(); inx > 1; --inx )
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        swap ( m_nodeIds[inx - 1], m_nodeIds[( state >> 33 ) % inx] );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+static void readWholeFile
+(   const char * fileName,
+    string & text
+)
+{
+    ifstream file ( fileName, ios::in | ios::binary );
+    if ( ! file.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open " << fileName << " for reading";
+        throw errorStream.str();
+    }
+    stringstream contents;
+    contents << file.rdbuf();
+    text = contents.str();
+}
+
+//============================================================================
+// Parsing (apart from non-destructively) changes the text, so each parse
+// has a fresh copy. Clearing the document frees the memory pool's blocks,
+// as reading a file again would.
+
+template < int Flags >
+void ParseBenchmark< Flags >::prepare()
+{
+    m_buffer.assign ( m_text.begin(), m_text.end() );
+    m_buffer.push_back ( 0 );
+    m_document.clear();
+}
+
+//----------------------------------------------------------------------------
+
+template < int Flags >
+void ParseBenchmark< Flags >::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    m_document.parse< Flags > ( &m_buffer[0] );
+    ++operations;
+    bytes += m_text.size();
+}
+
+//============================================================================
+
+void ExtractBenchmark::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    m_inputs.m_destinationsReader.generateDestinationDescriptions (
+        m_inputs.m_sectionNames );
+    ++operations;
+    bytes += m_inputs.m_destinationsText.size();
+}
+
+//----------------------------------------------------------------------------
+// Into a model of its own, so as to leave the shared one alone.
+
+void BuildBenchmark::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    SiteModel siteModel;
+    siteModel.build ( m_inputs.m_taxonomyReader,
+                      m_inputs.m_destinationsReader );
+    ++operations;
+    bytes += m_inputs.m_destinationsText.size()
+             + m_inputs.m_taxonomyText.size();
+}
+
+//----------------------------------------------------------------------------
+// Each operation finds one destination's description, as rendering a page
+// does.
+
+void LookupBenchmark::run
+(   size_t & operations,
+    size_t & )
+{
+    const SiteModel & siteModel = m_inputs.m_siteModel;
+    size_t sections = 0;
+    for ( vector< int >::const_iterator iter = m_inputs.m_nodeIds.begin();
+          iter != m_inputs.m_nodeIds.end(); ++iter )
+    {
+        size_t index = siteModel.findNode ( *iter );
+        const SiteModel::Description * description =
+            siteModel.getDescription ( siteModel.getNode ( index ) );
+        sections += ( description != 0 ) ? description->m_sectionCount : 0;
+    }
+    m_sectionsFound += sections;
+    operations += m_inputs.m_nodeIds.size();
+}
+
+//============================================================================
+// Every page is rendered in each run. The buffer is made big enough for
+// the largest page beforehand.
+
+RenderBenchmark::RenderBenchmark
+(   const string & name,
+    BenchmarkInputs & inputs,
+    Sink sink
+) : Benchmark ( name ),
+    m_inputs ( inputs ),
+    m_sink ( sink ),
+    m_htmlGenerator ( inputs.m_siteModel )
+{
+    m_htmlGenerator.setSectionNames ( &inputs.m_sectionNames );
+    m_htmlGenerator.prepareToRender();
+    size_t largest = 0;
+    for ( vector< int >::const_iterator iter = m_inputs.m_nodeIds.begin();
+          iter != m_inputs.m_nodeIds.end(); ++iter )
+    {
+        size_t pageLength = 0;
+        m_htmlGenerator.renderPageForNode ( *iter, 0, 0, pageLength );
+        largest = max ( largest, pageLength );
+    }
+    m_buffer.resize ( largest + 1 );
+}
+
+//----------------------------------------------------------------------------
+
+void RenderBenchmark::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    for ( vector< int >::const_iterator iter = m_inputs.m_nodeIds.begin();
+          iter != m_inputs.m_nodeIds.end(); ++iter )
+    {
+        size_t pageLength = 0;
+        switch ( m_sink )
+        {
+            case SINK_NONE:
+                m_htmlGenerator.renderPageForNode ( *iter, 0, 0, pageLength );
+                break;
+            case SINK_BUFFER:
+                m_htmlGenerator.renderPageForNode ( *iter, &m_buffer[0],
+                    m_buffer.size(), pageLength );
+                break;
+            case SINK_STRING:
+                m_htmlGenerator.renderPageForNode ( *iter, m_page );
+                pageLength = m_page.size();
+                break;
+        }
+        bytes += pageLength;
+    }
+    operations += m_inputs.m_nodeIds.size();
+}
+
+//============================================================================
+// A fresh generator each time, as for a run of the program, writing over
+// the pages from the previous run. Each operation is one page.
+
+void WriteBenchmark::prepare()
+{
+    if ( m_pageBytes != 0 )
+    {
+        return;
+    }
+    HtmlGenerator htmlGenerator ( m_inputs.m_siteModel );
+    htmlGenerator.setSectionNames ( &m_inputs.m_sectionNames );
+    htmlGenerator.prepareToRender();
+    for ( vector< int >::const_iterator iter = m_inputs.m_nodeIds.begin();
+          iter != m_inputs.m_nodeIds.end(); ++iter )
+    {
+        size_t pageLength = 0;
+        htmlGenerator.renderPageForNode ( *iter, 0, 0, pageLength );
+        m_pageBytes += pageLength;
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void WriteBenchmark::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    HtmlGenerator htmlGenerator ( m_inputs.m_siteModel );
+    htmlGenerator.setSectionNames ( &m_inputs.m_sectionNames );
+    operations += htmlGenerator.generateFiles (
+        m_inputs.m_scratchDirName.c_str() );
+    bytes += m_pageBytes;
+}
+
+//============================================================================
+// Everything a run of the program does, from opening the files to writing
+// the pages, into the same scratch directory as write/files. Each
+// operation is one page, and the bytes are those written.
+
+void SiteBenchmark::run
+(   size_t & operations,
+    size_t & bytes
+)
+{
+    TaxonomyReader taxonomyReader ( m_taxonomyFileName.c_str() );
+    DestinationsReader destinationsReader ( m_destinationsFileName.c_str() );
+    taxonomyReader.readAndParse();
+    destinationsReader.selectSections ( m_inputs.m_sectionNames );
+    destinationsReader.readAndParse();
+    destinationsReader.generateDestinationDescriptions (
+        m_inputs.m_sectionNames );
+    SiteModel siteModel;
+    siteModel.build ( taxonomyReader, destinationsReader );
+    HtmlGenerator htmlGenerator ( siteModel );
+    htmlGenerator.setSectionNames ( &m_inputs.m_sectionNames );
+    operations += htmlGenerator.generateFiles (
+        m_inputs.m_scratchDirName.c_str() );
+    bytes += htmlGenerator.getCounts().m_bytesWritten;
+}
@@ -0,0 +1,721 @@
+// Compile (as C++14 or later) and run. Has no dependencies apart from STL.
+//
+// Writes a synthetic taxonomy and destinations file pair, in the form
+// lonely_planet_test expects, of whatever size and shape is wanted for
+// measuring how it scales. The same parameters and seed always give the
+// same files.
+//
+// Run as:
+//
+// lonely_planet_dataset [ <options> ] <taxonomy-xml-file>
+//                       <destinations-xml-file>
+// where <options> are:
+//
+// --seed=<n>         seed for the pseudo-random choices (default 1).
+// --nodes=<n>        number of destinations in the taxonomy, not counting
+//                    its "World" root (default 1000).
+// --depth=<n>        greatest depth of a destination below the root
+//                    (default 8).
+// --fan-out=uniform  each destination's parent is chosen uniformly from
+//                    those not already at the greatest depth (the default).
+// --fan-out=skewed   parents are chosen in proportion to the children they
+//                    already have, so a few destinations have very many
+//                    children and most have none.
+// --wide-nodes=<n>   additionally give <n> destinations (default 0) ...
+// --wide-fan-out=<n> ... <n> children each (default 1000), which are
+//                    leaves. These count towards --nodes.
+// --coverage=<percent>
+//                    percentage of destinations which have an entry in the
+//                    destinations file (default 100).
+// --sections=<n>     number of content sections per entry, 1-8 (default
+//                    2). "overview" is always one of them; the others are
+//                    picked from history, before_you_go, money,
+//                    local_transport, climate, business and mammals.
+// --cdata-size=<n>   average size in bytes of a section's text (default
+//                    500); sizes vary evenly from half to one and a half
+//                    times this.
+// --entities=<n>     chance in a thousand (default 10) of each word of a
+//                    name containing an entity reference, or of each word
+//                    of text containing a character HTML has to escape.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+// Classes:
+//
+//  DatasetRandom: a small pseudo-random generator (SplitMix64), used rather
+//  than the standard library's distributions so that the files come out
+//  the same whichever library built the program.
+//
+//  DatasetParameters: the options above.
+//
+//  DatasetGenerator: builds the shape of the taxonomy tree, then writes the
+//  two files from it. Names and text are made up as they are written, from
+//  a generator seeded by the destination, so need not be kept.
+//
+//============================================================================
+// Class declarations.
+
+class DatasetRandom
+{
+    public:
+        DatasetRandom ( uint64_t seed, uint64_t stream = 0 );
+        uint64_t next();
+        // Uniform in [0, limit).
+        size_t below ( size_t limit ) { return size_t ( next() % limit ); }
+        // True with the given chance in a thousand.
+        bool perMille ( int chance ) { return int ( below ( 1000 ) ) < chance; }
+
+    private:
+        uint64_t m_state;
+};
+
+struct DatasetParameters
+{
+    DatasetParameters() :
+        m_seed ( 1 ),
+        m_nodeCount ( 1000 ),
+        m_maxDepth ( 8 ),
+        m_skewedFanOut ( false ),
+        m_wideNodeCount ( 0 ),
+        m_wideFanOut ( 1000 ),
+        m_coveragePercent ( 100 ),
+        m_sectionCount ( 2 ),
+        m_cdataSize ( 500 ),
+        m_entityPerMille ( 10 )
+    {}
+
+    uint64_t m_seed;
+    size_t m_nodeCount;
+    size_t m_maxDepth;
+    bool m_skewedFanOut;
+    size_t m_wideNodeCount;
+    size_t m_wideFanOut;
+    int m_coveragePercent;
+    size_t m_sectionCount;
+    size_t m_cdataSize;
+    int m_entityPerMille;
+};
+
+class DatasetGenerator
+{
+    public:
+        DatasetGenerator ( const DatasetParameters & parameters );
+        void buildTree();
+        void writeTaxonomy ( const char * taxonomyFileName ) const;
+        void writeDestinations ( const char * destinationsFileName ) const;
+        size_t getDeepest() const;
+        size_t getWidest() const;
+
+    private:
+        enum { NO_PARENT = -1 };
+
+        int addNode ( int parent );
+        void appendName ( string & output, DatasetRandom & random,
+                          bool escaped ) const;
+        void appendWord ( string & output, DatasetRandom & random ) const;
+        void appendText ( string & output, DatasetRandom & random,
+                          size_t size ) const;
+        void flush ( ofstream & file, string & output, const char * fileName,
+                     bool force ) const;
+
+        DatasetParameters m_parameters;
+        vector< int > m_parents;            // by node index
+        vector< unsigned short > m_depths;  // by node index
+        vector< int > m_nodeIds;            // by node index
+        vector< size_t > m_childCounts;     // by node index
+        size_t m_rootChildCount;
+        vector< int > m_eligible;           // below the greatest depth
+        vector< int > m_attachments;        // weighted by children, if skewed
+};
+
+//============================================================================
+
+extern int main ( int argc, char ** argv )
+{
+    DatasetParameters parameters;
+    vector< const char * > arguments;
+    for ( int inx = 1; inx < argc; ++inx )
+    {
+        string argument ( argv[inx] );
+        string::size_type equals = argument.find ( '=' );
+        string name ( argument, 0, equals );
+        const char * value = ( equals != string::npos )
+                             ? argv[inx] + equals + 1 : "";
+        if ( argument.compare ( 0, 2, "--" ) != 0 )
+        {
+            arguments.push_back ( argv[inx] );
+        }
+        else if ( name == "--seed" )
+        {
+            parameters.m_seed = strtoull ( value, 0, 10 );
+        }
+        else if ( name == "--nodes" )
+        {
+            parameters.m_nodeCount = strtoul ( value, 0, 10 );
+        }
+        else if ( name == "--depth" )
+        {
+            parameters.m_maxDepth = strtoul ( value, 0, 10 );
+        }
+        else if ( argument == "--fan-out=uniform" )
+        {
+            parameters.m_skewedFanOut = false;
+        }
+        else if ( argument == "--fan-out=skewed" )
+        {
+            parameters.m_skewedFanOut = true;
+        }
+        else if ( name == "--wide-nodes" )
+        {
+            parameters.m_wideNodeCount = strtoul ( value, 0, 10 );
+        }
+        else if ( name == "--wide-fan-out" )
+        {
+            parameters.m_wideFanOut = strtoul ( value, 0, 10 );
+        }
+        else if ( name == "--coverage" )
+        {
+            parameters.m_coveragePercent = atoi ( value );
+        }
+        else if ( name == "--sections" )
+        {
+            parameters.m_sectionCount = strtoul ( value, 0, 10 );
+        }
+        else if ( name == "--cdata-size" )
+        {
+            parameters.m_cdataSize = strtoul ( value, 0, 10 );
+        }
+        else if ( name == "--entities" )
+        {
+            parameters.m_entityPerMille = atoi ( value );
+        }
+        else
+        {
+            cerr << "Error: (" << argv[0] << ") unrecognised option "
+                 << argument << endl;
+            return 1;
+        }
+    }
+
+    // Check arguments.
+    if ( arguments.size() != 2 )
+    {
+        cerr << "Error: (" << argv[0] << ") needs [ <options> ] "
+             << "<taxonomy-xml-file> <destinations-xml-file>" << endl;
+        return 1;
+    }
+    if ( parameters.m_nodeCount < 1 || parameters.m_maxDepth < 1
+         || parameters.m_maxDepth > 65535 )
+    {
+        cerr << "Error: (" << argv[0] << ") needs at least one node, and a "
+             << "depth of 1-65535" << endl;
+        return 1;
+    }
+    if ( parameters.m_wideNodeCount * parameters.m_wideFanOut
+         >= parameters.m_nodeCount )
+    {
+        cerr << "Error: (" << argv[0] << ") the wide nodes' children must "
+             << "leave room for other nodes within --nodes" << endl;
+        return 1;
+    }
+    if ( parameters.m_sectionCount < 1 || parameters.m_sectionCount > 8
+         || parameters.m_coveragePercent < 0
+         || parameters.m_coveragePercent > 100
+         || parameters.m_entityPerMille < 0
+         || parameters.m_entityPerMille > 1000 )
+    {
+        cerr << "Error: (" << argv[0] << ") sections must be 1-8, coverage "
+             << "0-100 and entities 0-1000" << endl;
+        return 1;
+    }
+
+    try
+    {
+        DatasetGenerator generator ( parameters );
+        generator.buildTree();
+        generator.writeTaxonomy ( arguments[0] );
+        generator.writeDestinations ( arguments[1] );
+        cout << "Wrote " << parameters.m_nodeCount << " destinations, "
+             << "at most " << generator.getDeepest() << " deep and "
+             << generator.getWidest() << " wide" << endl;
+    }
+    catch ( const string & exceptionError )
+    {
+        cerr << "Error: (" << argv[0] << ") " << exceptionError << endl;
+        return 1;
+    }
+    catch ( ... )
+    {
+        cerr << "Error: (" << argv[0] << ") unknown exception" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+//============================================================================
+// Each stream of a seed is a generator of its own, so that what is made up
+// for one destination doesn't depend on how many others there are.
+
+DatasetRandom::DatasetRandom
+(   uint64_t seed,
+    uint64_t stream
+) : m_state ( seed ^ ( stream * 0xd1342543de82ef95ULL ) )
+{
+    next();
+}
+
+//----------------------------------------------------------------------------
+
+uint64_t DatasetRandom::next()
+{
+    uint64_t result = ( m_state += 0x9e3779b97f4a7c15ULL );
+    result = ( result ^ ( result >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    result = ( result ^ ( result >> 27 ) ) * 0x94d049bb133111ebULL;
+    return result ^ ( result >> 31 );
+}
+
+//============================================================================
+
+namespace
+{
+    const char * const syllables[] =
+    {
+        "ka", "lo", "mi", "ra", "te", "su", "no", "ba", "vi", "an", "el",
+        "or", "ta", "shi", "po", "ne", "du", "ga", "ri", "zo", "me", "la",
+        "qui", "ven", "mar", "sol", "tor", "bel", "dan", "ist"
+    };
+    const size_t syllableCount = sizeof ( syllables ) / sizeof ( *syllables );
+
+    // In names, which are parsed text, these are references; in sections'
+    // text, which is CDATA, they are the characters themselves.
+    const char * const entities[] =
+    {
+        "&amp;", "&lt;", "&gt;", "&quot;", "&apos;", "&#233;"
+    };
+    const char specialCharacters[] = "&<>\"'";
+
+    // Where each section's text lies in an entry, as in the real files.
+    struct SectionPath
+    {
+        const char * m_outer;
+        const char * m_middle;
+        const char * m_name;
+    };
+    const SectionPath sectionPaths[] =
+    {
+        { "introductory", "introduction", "overview" },
+        { "history", "history", "history" },
+        { "practical_information", "health_and_safety", "before_you_go" },
+        { "practical_information", "money_and_costs", "money" },
+        { "transport", "getting_around", "local_transport" },
+        { "weather", "when_to_go", "climate" },
+        { "work_live_study", "work", "business" },
+        { "wildlife", "animals", "mammals" }
+    };
+    const size_t sectionPathCount =
+        sizeof ( sectionPaths ) / sizeof ( *sectionPaths );
+
+    const size_t FLUSH_SIZE = 1 << 20;
+    const int FIRST_NODE_ID = 100000;
+}
+
+//----------------------------------------------------------------------------
+
+DatasetGenerator::DatasetGenerator
+(   const DatasetParameters & parameters
+) : m_parameters ( parameters ),
+    m_rootChildCount ( 0 )
+{}
+
+//----------------------------------------------------------------------------
+// Grow the tree one node at a time, each hung from a parent chosen from
+// those with room below them, then add the wide nodes' children. Node-ids
+// are then shuffled, so that their order says nothing about the tree's.
+
+void DatasetGenerator::buildTree()
+{
+    DatasetRandom random ( m_parameters.m_seed );
+    size_t wideChildren =
+        m_parameters.m_wideNodeCount * m_parameters.m_wideFanOut;
+
+    m_parents.clear();
+    m_depths.clear();
+    m_childCounts.clear();
+    m_eligible.assign ( 1, NO_PARENT );
+    m_attachments.assign ( 1, NO_PARENT );
+    m_parents.reserve ( m_parameters.m_nodeCount );
+    m_depths.reserve ( m_parameters.m_nodeCount );
+    m_childCounts.reserve ( m_parameters.m_nodeCount );
+    m_rootChildCount = 0;
+
+    while ( m_parents.size() < m_parameters.m_nodeCount - wideChildren )
+    {
+        const vector< int > & candidates =
+            m_parameters.m_skewedFanOut ? m_attachments : m_eligible;
+        addNode ( candidates[random.below ( candidates.size() )] );
+    }
+
+    // The wide nodes are picked from those with room below them; when
+    // there are fewer of those than asked for, some get picked again.
+    // The children added meanwhile aren't candidates.
+    vector< bool > picked ( m_parents.size(), false );
+    size_t eligibleCount = m_eligible.size();
+    size_t unpicked = eligibleCount - 1;
+    for ( size_t wide = 0; wide < m_parameters.m_wideNodeCount; ++wide )
+    {
+        int parent = m_eligible[random.below ( eligibleCount )];
+        while ( unpicked != 0 && ( parent == NO_PARENT || picked[parent] ) )
+        {
+            parent = m_eligible[random.below ( eligibleCount )];
+        }
+        if ( parent != NO_PARENT && ! picked[parent] )
+        {
+            picked[parent] = true;
+            --unpicked;
+        }
+        for ( size_t child = 0; child < m_parameters.m_wideFanOut; ++child )
+        {
+            addNode ( parent );
+        }
+    }
+
+    m_nodeIds.resize ( m_parents.size() );
+    for ( size_t inx = 0; inx < m_nodeIds.size(); ++inx )
+    {
+        m_nodeIds[inx] = FIRST_NODE_ID + int ( inx );
+    }
+    for ( size_t inx = m_nodeIds.size() - 1; inx > 0; --inx )
+    {
+        swap ( m_nodeIds[inx], m_nodeIds[random.below ( inx + 1 )] );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Returns the new node's index.
+
+int DatasetGenerator::addNode
+(   int parent
+)
+{
+    int node = int ( m_parents.size() );
+    size_t depth = ( parent == NO_PARENT ) ? 1 : m_depths[parent] + 1;
+    m_parents.push_back ( parent );
+    m_depths.push_back ( static_cast< unsigned short > ( depth ) );
+    m_childCounts.push_back ( 0 );
+    ++( parent == NO_PARENT ? m_rootChildCount : m_childCounts[parent] );
+    m_attachments.push_back ( parent );
+    if ( depth < m_parameters.m_maxDepth )
+    {
+        m_eligible.push_back ( node );
+        m_attachments.push_back ( node );
+    }
+    return node;
+}
+
+//----------------------------------------------------------------------------
+
+size_t DatasetGenerator::getDeepest() const
+{
+    size_t deepest = 0;
+    for ( size_t inx = 0; inx < m_depths.size(); ++inx )
+    {
+        deepest = max ( deepest, size_t ( m_depths[inx] ) );
+    }
+    return deepest;
+}
+
+//----------------------------------------------------------------------------
+
+size_t DatasetGenerator::getWidest() const
+{
+    size_t widest = m_rootChildCount;
+    for ( size_t inx = 0; inx < m_childCounts.size(); ++inx )
+    {
+        widest = max ( widest, m_childCounts[inx] );
+    }
+    return widest;
+}
+
+//----------------------------------------------------------------------------
+// The children of each node are laid out together (in order of creation)
+// so the tree can be written depth-first, with a stack of where each open
+// node has got to rather than by recursion, since trees may be deep.
+
+void DatasetGenerator::writeTaxonomy
+(   const char * taxonomyFileName
+) const
+{
+    ofstream taxonomyFile ( taxonomyFileName, ios::out | ios::binary );
+    if ( ! taxonomyFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open taxonomy file " << taxonomyFileName
+                    << " for writing";
+        throw errorStream.str();
+    }
+
+    size_t nodeCount = m_parents.size();
+    vector< size_t > firstChild ( nodeCount + 2, 0 );    // root is nodeCount
+    for ( size_t inx = 0; inx < nodeCount; ++inx )
+    {
+        size_t parent = ( m_parents[inx] == NO_PARENT )
+                        ? nodeCount : size_t ( m_parents[inx] );
+        ++firstChild[parent + 1];
+    }
+    for ( size_t inx = 1; inx < firstChild.size(); ++inx )
+    {
+        firstChild[inx] += firstChild[inx - 1];
+    }
+    vector< int > children ( nodeCount );
+    vector< size_t > filled ( firstChild.begin(), firstChild.end() - 1 );
+    for ( size_t inx = 0; inx < nodeCount; ++inx )
+    {
+        size_t parent = ( m_parents[inx] == NO_PARENT )
+                        ? nodeCount : size_t ( m_parents[inx] );
+        children[filled[parent]++] = int ( inx );
+    }
+
+    string output;
+    output.reserve ( FLUSH_SIZE + 4096 );
+    output.append ( "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                    "<taxonomies>\n  <taxonomy>\n"
+                    "    <taxonomy_name>World</taxonomy_name>\n" );
+
+    // Each stack entry is an open node and the next of its children to
+    // write; the root is at the bottom.
+    vector< pair< size_t, size_t > > stack;
+    stack.push_back ( make_pair ( nodeCount, firstChild[nodeCount] ) );
+    while ( ! stack.empty() )
+    {
+        size_t node = stack.back().first;
+        size_t & nextChild = stack.back().second;
+        string indent ( 2 * stack.size() + 2, ' ' );
+        if ( nextChild == firstChild[node + 1] )
+        {
+            stack.pop_back();
+            if ( node != nodeCount )
+            {
+                output.append ( indent, 0, indent.size() - 2 );
+                output.append ( "</node>\n" );
+            }
+            continue;
+        }
+
+        int child = children[nextChild++];
+        char nodeId[16];
+        snprintf ( nodeId, sizeof ( nodeId ), "%d", m_nodeIds[child] );
+        DatasetRandom random ( m_parameters.m_seed, m_nodeIds[child] );
+        output.append ( indent );
+        output.append ( "<node atlas_node_id = \"" );
+        output.append ( nodeId );
+        output.append ( "\" ethyl_content_object_id=\"\" geo_id = \"" );
+        output.append ( nodeId );
+        output.append ( "\">\n" );
+        output.append ( indent );
+        output.append ( "  <node_name>" );
+        appendName ( output, random, true );
+        output.append ( "</node_name>\n" );
+        stack.push_back ( make_pair ( size_t ( child ),
+                                      firstChild[child] ) );
+        flush ( taxonomyFile, output, taxonomyFileName, false );
+    }
+
+    output.append ( "  </taxonomy>\n</taxonomies>\n" );
+    flush ( taxonomyFile, output, taxonomyFileName, true );
+}
+
+//----------------------------------------------------------------------------
+// One entry per covered destination, in order of creation. The name is made
+// up again from the same seed as in the taxonomy, and the text continues
+// from there.
+
+void DatasetGenerator::writeDestinations
+(   const char * destinationsFileName
+) const
+{
+    ofstream destinationsFile ( destinationsFileName,
+                                ios::out | ios::binary );
+    if ( ! destinationsFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open destinations file "
+                    << destinationsFileName << " for writing";
+        throw errorStream.str();
+    }
+
+    string output;
+    output.reserve ( FLUSH_SIZE + 4096 );
+    output.append ( "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                    "<destinations>\n" );
+    DatasetRandom coverageRandom ( m_parameters.m_seed, 0 );
+    for ( size_t node = 0; node < m_nodeIds.size(); ++node )
+    {
+        if ( int ( coverageRandom.below ( 100 ) )
+             >= m_parameters.m_coveragePercent )
+        {
+            continue;
+        }
+
+        char nodeId[16];
+        snprintf ( nodeId, sizeof ( nodeId ), "%d", m_nodeIds[node] );
+        DatasetRandom random ( m_parameters.m_seed, m_nodeIds[node] );
+        output.append ( "  <destination atlas_id=\"" );
+        output.append ( nodeId );
+        output.append ( "\" asset_id=\"" );
+        output.append ( nodeId );
+        output.append ( "-1\" title=\"" );
+        appendName ( output, random, true );
+        output.append ( "\">\n" );
+
+        // "overview" and then any others, written in the usual order.
+        vector< bool > chosen ( sectionPathCount, false );
+        chosen[0] = true;
+        for ( size_t count = 1; count < m_parameters.m_sectionCount; ++count )
+        {
+            size_t section = 1 + random.below ( sectionPathCount - 1 );
+            while ( chosen[section] )
+            {
+                section = 1 + section % ( sectionPathCount - 1 );
+            }
+            chosen[section] = true;
+        }
+        for ( size_t section = 0; section < sectionPathCount; ++section )
+        {
+            if ( ! chosen[section] )
+            {
+                continue;
+            }
+            const SectionPath & path = sectionPaths[section];
+            output.append ( "    <" ).append ( path.m_outer ).append ( ">\n" );
+            output.append ( "      <" ).append ( path.m_middle );
+            output.append ( ">\n        <" ).append ( path.m_name );
+            output.append ( "><![CDATA[" );
+            size_t size = m_parameters.m_cdataSize / 2
+                          + random.below ( m_parameters.m_cdataSize + 1 );
+            appendText ( output, random, size );
+            output.append ( "]]></" ).append ( path.m_name );
+            output.append ( ">\n      </" ).append ( path.m_middle );
+            output.append ( ">\n    </" ).append ( path.m_outer );
+            output.append ( ">\n" );
+            flush ( destinationsFile, output, destinationsFileName, false );
+        }
+        output.append ( "  </destination>\n" );
+    }
+
+    output.append ( "</destinations>\n" );
+    flush ( destinationsFile, output, destinationsFileName, true );
+}
+
+//----------------------------------------------------------------------------
+// One to three capitalised words. Escaped, for parsed text and attributes,
+// a word may carry an entity reference.
+
+void DatasetGenerator::appendName
+(   string & output,
+    DatasetRandom & random,
+    bool escaped
+) const
+{
+    size_t words = 1 + random.below ( 3 );
+    for ( size_t word = 0; word < words; ++word )
+    {
+        if ( word != 0 )
+        {
+            output.push_back ( ' ' );
+        }
+        size_t start = output.size();
+        appendWord ( output, random );
+        output[start] = char ( toupper ( output[start] ) );
+        if ( escaped && random.perMille ( m_parameters.m_entityPerMille ) )
+        {
+            output.append ( entities[random.below (
+                sizeof ( entities ) / sizeof ( *entities ) )] );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void DatasetGenerator::appendWord
+(   string & output,
+    DatasetRandom & random
+) const
+{
+    size_t count = 1 + random.below ( 3 );
+    for ( size_t syllable = 0; syllable < count; ++syllable )
+    {
+        output.append ( syllables[random.below ( syllableCount )] );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Sentences of words, of about the given size, with special characters
+// scattered among them. Never contains "]]>", so is safe within CDATA.
+
+void DatasetGenerator::appendText
+(   string & output,
+    DatasetRandom & random,
+    size_t size
+) const
+{
+    size_t end = output.size() + size;
+    bool sentenceStart = true;
+    while ( output.size() < end )
+    {
+        size_t start = output.size();
+        appendWord ( output, random );
+        if ( sentenceStart )
+        {
+            output[start] = char ( toupper ( output[start] ) );
+        }
+        if ( random.perMille ( m_parameters.m_entityPerMille ) )
+        {
+            output.push_back ( specialCharacters[random.below (
+                sizeof ( specialCharacters ) - 1 )] );
+        }
+        sentenceStart = random.below ( 10 ) == 0;
+        output.append ( sentenceStart ? ". " : " " );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Write out what has built up, once there is enough of it (or regardless,
+// at the end).
+
+void DatasetGenerator::flush
+(   ofstream & file,
+    string & output,
+    const char * fileName,
+    bool force
+) const
+{
+    if ( ! force && output.size() < FLUSH_SIZE )
+    {
+        return;
+    }
+    file.write ( output.data(), output.size() );
+    if ( force )
+    {
+        file.close();
+    }
+    if ( ! file )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to write " << fileName;
+        throw errorStream.str();
+    }
+    output.clear();
+}
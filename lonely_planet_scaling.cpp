@@ -0,0 +1,499 @@
+// Compile (as C++14 or later) with lonely_planet.cpp, preferably with -O2,
+// link with -pthread and run. Linux only: each measurement is made in a
+// child process of its own, so that its peak memory is its own too.
+//
+// Runs the whole of generation, from reading the XML files to writing the
+// pages, for each of several inputs and each of several worker counts (see
+// lonely_planet_test's --workers), and writes a CSV table of how long it
+// took and where the time went, to show how far the generator scales and
+// what stops it.
+//
+// Run as:
+//
+// lonely_planet_scaling [ <options> ] <scratch-directory>
+//                       <taxonomy-xml-file> <destinations-xml-file>
+//                       [ <taxonomy-xml-file> <destinations-xml-file> ... ]
+// where each pair of files is one input (lonely_planet_dataset makes them
+// in any size), the pages are written beneath <scratch-directory> (which is
+// created if necessary), and <options> are:
+//
+// --workers=<list>   comma-separated worker counts to try (default
+//                    1,2,4,8). The first is what the others are compared
+//                    with.
+// --repeats=<n>      measure each combination <n> times (default 3) and
+//                    keep the fastest.
+// --sections=<list>  comma-separated section names to show (default
+//                    overview).
+// --csv=<file>       write the table to <file> rather than the standard
+//                    output.
+//
+// The table has a row for each input and worker count, with columns:
+//
+//  input, nodes, input_bytes, workers, pages: what was generated.
+//  read_ms: reading the files, which is I/O.
+//  parse_model_ms: parsing them, extracting the descriptions and building
+//  the model, which is CPU, and always in one thread.
+//  generate_ms: rendering and writing the pages, in the workers.
+//  total_ms, pages_per_sec: the whole run.
+//  speedup, efficiency: of the whole run against the first worker count's,
+//  and that speedup per worker added (1 is perfect scaling).
+//  generate_speedup, generate_efficiency: the same for generate_ms alone.
+//  generate_user_ms, generate_system_ms: CPU time in the workers, in user
+//  space (rendering, mostly) and in the kernel (writing files, mostly).
+//  generate_off_cpu_ms: the rest of the workers' time, spent waiting for
+//  the disk, for a CPU or for each other.
+//  peak_rss_kb: the peak resident set size of the whole run.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lonely_planet.hpp"
+
+using namespace std;
+using namespace rapidxml;
+using namespace lonely_planet;
+
+// Classes:
+//
+//  ScalingMeasurement: what one run found. Passed back from the child
+//  process that made it as it is, so holds no pointers.
+//
+//  ScalingRow: the measurement kept for one input and worker count, with
+//  what was worked out from it.
+//
+//============================================================================
+// Class declarations.
+
+struct ScalingMeasurement
+{
+    bool m_succeeded;
+    char m_error[256];
+    size_t m_nodeCount;
+    size_t m_inputBytes;
+    size_t m_pages;
+    double m_readSeconds;
+    double m_parseModelSeconds;
+    double m_generateSeconds;
+    double m_generateUserSeconds;
+    double m_generateSystemSeconds;
+    long m_peakResidentKilobytes;
+};
+
+struct ScalingRow
+{
+    string m_inputName;
+    unsigned int m_workerCount;
+    ScalingMeasurement m_measurement;
+};
+
+static void splitList
+(   const string & list,
+    vector< string > & items
+);
+static ScalingMeasurement measureInChild
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const string & outputDirName,
+    const set<string> & sectionNames,
+    unsigned int workerCount
+);
+static void measure
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const string & outputDirName,
+    const set<string> & sectionNames,
+    unsigned int workerCount,
+    ScalingMeasurement & measurement
+);
+static double getSeconds ( const struct timeval & time );
+static void writeTable
+(   ostream & output,
+    const vector< ScalingRow > & rows
+);
+
+//============================================================================
+
+extern int main ( int argc, char ** argv )
+{
+    vector< unsigned int > workerCounts;
+    size_t repeats = 3;
+    set<string> sectionNames;
+    const char * csvFileName = 0;
+    vector< const char * > arguments;
+    for ( int inx = 1; inx < argc; ++inx )
+    {
+        string argument ( argv[inx] );
+        if ( argument.compare ( 0, 2, "--" ) != 0 )
+        {
+            arguments.push_back ( argv[inx] );
+        }
+        else if ( argument.compare ( 0, 10, "--workers=" ) == 0 )
+        {
+            vector< string > items;
+            splitList ( argument.substr ( 10 ), items );
+            for ( vector< string >::const_iterator iter = items.begin();
+                  iter != items.end(); ++iter )
+            {
+                int workerCount = atoi ( iter->c_str() );
+                if ( workerCount < 1 )
+                {
+                    cerr << "Error: (" << argv[0] << ") worker counts must "
+                         << "be at least 1" << endl;
+                    return 1;
+                }
+                workerCounts.push_back ( workerCount );
+            }
+        }
+        else if ( argument.compare ( 0, 10, "--repeats=" ) == 0 )
+        {
+            repeats = strtoul ( argument.c_str() + 10, 0, 10 );
+        }
+        else if ( argument.compare ( 0, 11, "--sections=" ) == 0 )
+        {
+            vector< string > items;
+            splitList ( argument.substr ( 11 ), items );
+            sectionNames.insert ( items.begin(), items.end() );
+        }
+        else if ( argument.compare ( 0, 6, "--csv=" ) == 0 )
+        {
+            csvFileName = argv[inx] + 6;
+        }
+        else
+        {
+            cerr << "Error: (" << argv[0] << ") unrecognised option "
+                 << argument << endl;
+            return 1;
+        }
+    }
+
+    // Check arguments.
+    if ( arguments.size() < 3 || arguments.size() % 2 != 1 || repeats < 1 )
+    {
+        cerr << "Error: (" << argv[0] << ") needs [ <options> ] "
+             << "<scratch-directory> and one or more pairs of "
+             << "<taxonomy-xml-file> <destinations-xml-file>, and at least "
+             << "one repeat" << endl;
+        return 1;
+    }
+    if ( workerCounts.empty() )
+    {
+        workerCounts.push_back ( 1 );
+        workerCounts.push_back ( 2 );
+        workerCounts.push_back ( 4 );
+        workerCounts.push_back ( 8 );
+    }
+    if ( sectionNames.empty() )
+    {
+        sectionNames.insert ( "overview" );
+    }
+    cerr << "Hardware threads: " << thread::hardware_concurrency() << endl;
+
+    // Each input gets a directory of its own, written over by every run.
+    mkdir ( arguments[0], 0777 );
+    vector< ScalingRow > rows;
+    for ( size_t input = 1; input < arguments.size(); input += 2 )
+    {
+        stringstream outputDirName;
+        outputDirName << arguments[0] << "/input" << ( input + 1 ) / 2;
+        for ( vector< unsigned int >::const_iterator workerIter =
+                  workerCounts.begin(); workerIter != workerCounts.end();
+              ++workerIter )
+        {
+            ScalingRow row;
+            row.m_inputName = arguments[input];
+            row.m_workerCount = *workerIter;
+            for ( size_t repeat = 0; repeat < repeats; ++repeat )
+            {
+                ScalingMeasurement measurement = measureInChild (
+                    arguments[input], arguments[input + 1],
+                    outputDirName.str(), sectionNames, *workerIter );
+                if ( ! measurement.m_succeeded )
+                {
+                    cerr << "Error: (" << argv[0] << ") "
+                         << measurement.m_error << endl;
+                    return 1;
+                }
+                double seconds = measurement.m_readSeconds
+                                 + measurement.m_parseModelSeconds
+                                 + measurement.m_generateSeconds;
+                const ScalingMeasurement & best = row.m_measurement;
+                if ( repeat == 0 || seconds < best.m_readSeconds
+                                              + best.m_parseModelSeconds
+                                              + best.m_generateSeconds )
+                {
+                    row.m_measurement = measurement;
+                }
+            }
+            cerr << row.m_inputName << " with " << row.m_workerCount
+                 << " worker(s): " << row.m_measurement.m_pages
+                 << " pages" << endl;
+            rows.push_back ( row );
+        }
+    }
+
+    if ( csvFileName == 0 )
+    {
+        writeTable ( cout, rows );
+    }
+    else
+    {
+        ofstream csvFile ( csvFileName, ios::out );
+        if ( ! csvFile.is_open() )
+        {
+            cerr << "Error: (" << argv[0] << ") failed to open "
+                 << csvFileName << " for writing" << endl;
+            return 1;
+        }
+        writeTable ( csvFile, rows );
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+
+static void splitList
+(   const string & list,
+    vector< string > & items
+)
+{
+    stringstream listStream ( list );
+    string item;
+    while ( getline ( listStream, item, ',' ) )
+    {
+        if ( ! item.empty() )
+        {
+            items.push_back ( item );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// The child measures, sends the measurement back down a pipe, and exits
+// without tidying up, since its memory goes with it anyway.
+
+static ScalingMeasurement measureInChild
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const string & outputDirName,
+    const set<string> & sectionNames,
+    unsigned int workerCount
+)
+{
+    ScalingMeasurement measurement;
+    memset ( &measurement, 0, sizeof ( measurement ) );
+    int pipeEnds[2];
+    if ( pipe ( pipeEnds ) != 0 )
+    {
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "failed to create a pipe: %s", strerror ( errno ) );
+        return measurement;
+    }
+    cout.flush();
+    pid_t child = fork();
+    if ( child == 0 )
+    {
+        close ( pipeEnds[0] );
+        measure ( taxonomyFileName, destinationsFileName, outputDirName,
+                  sectionNames, workerCount, measurement );
+        ssize_t written = write ( pipeEnds[1], &measurement,
+                                  sizeof ( measurement ) );
+        _exit ( written == ssize_t ( sizeof ( measurement ) ) ? 0 : 1 );
+    }
+    close ( pipeEnds[1] );
+    if ( child < 0 )
+    {
+        close ( pipeEnds[0] );
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "failed to start a child process: %s",
+                   strerror ( errno ) );
+        return measurement;
+    }
+
+    size_t received = 0;
+    char * destination = reinterpret_cast< char * > ( &measurement );
+    while ( received < sizeof ( measurement ) )
+    {
+        ssize_t got = read ( pipeEnds[0], destination + received,
+                             sizeof ( measurement ) - received );
+        if ( got <= 0 )
+        {
+            break;
+        }
+        received += got;
+    }
+    close ( pipeEnds[0] );
+    int status = 0;
+    waitpid ( child, &status, 0 );
+    if ( received != sizeof ( measurement ) )
+    {
+        memset ( &measurement, 0, sizeof ( measurement ) );
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "child process ended without a measurement (status %d)",
+                   status );
+    }
+    return measurement;
+}
+
+//----------------------------------------------------------------------------
+// What a run of lonely_planet_test does, timed by phase. The workers' CPU
+// time is the process's over the generate phase, which is all theirs.
+
+static void measure
+(   const char * taxonomyFileName,
+    const char * destinationsFileName,
+    const string & outputDirName,
+    const set<string> & sectionNames,
+    unsigned int workerCount,
+    ScalingMeasurement & measurement
+)
+{
+    typedef chrono::steady_clock Clock;
+    try
+    {
+        Clock::time_point start = Clock::now();
+        TaxonomyReader taxonomyReader ( taxonomyFileName );
+        DestinationsReader destinationsReader ( destinationsFileName );
+        taxonomyReader.read();
+        destinationsReader.read();
+        Clock::time_point readEnd = Clock::now();
+        taxonomyReader.parse();
+        destinationsReader.selectSections ( sectionNames );
+        destinationsReader.parse();
+        destinationsReader.generateDestinationDescriptions ( sectionNames );
+        SiteModel siteModel;
+        siteModel.build ( taxonomyReader, destinationsReader );
+        HtmlGenerator htmlGenerator ( siteModel );
+        htmlGenerator.setSectionNames ( &sectionNames );
+        htmlGenerator.setWorkerCount ( workerCount );
+        htmlGenerator.prepareToRender();
+        Clock::time_point modelEnd = Clock::now();
+
+        struct rusage usageBefore;
+        getrusage ( RUSAGE_SELF, &usageBefore );
+        measurement.m_pages = htmlGenerator.generateFiles (
+            outputDirName.c_str() );
+        struct rusage usageAfter;
+        getrusage ( RUSAGE_SELF, &usageAfter );
+        Clock::time_point generateEnd = Clock::now();
+
+        measurement.m_nodeCount = siteModel.getNodeCount();
+        measurement.m_inputBytes = taxonomyReader.getBytesRead()
+                                   + destinationsReader.getBytesRead();
+        measurement.m_readSeconds =
+            chrono::duration< double > ( readEnd - start ).count();
+        measurement.m_parseModelSeconds =
+            chrono::duration< double > ( modelEnd - readEnd ).count();
+        measurement.m_generateSeconds =
+            chrono::duration< double > ( generateEnd - modelEnd ).count();
+        measurement.m_generateUserSeconds =
+            getSeconds ( usageAfter.ru_utime )
+            - getSeconds ( usageBefore.ru_utime );
+        measurement.m_generateSystemSeconds =
+            getSeconds ( usageAfter.ru_stime )
+            - getSeconds ( usageBefore.ru_stime );
+        measurement.m_peakResidentKilobytes = usageAfter.ru_maxrss;
+        measurement.m_succeeded = true;
+    }
+    catch ( const string & exceptionError )
+    {
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "%s", exceptionError.c_str() );
+    }
+    catch ( const parse_error & exceptionError )
+    {
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "parse error: %s", exceptionError.what() );
+    }
+    catch ( ... )
+    {
+        snprintf ( measurement.m_error, sizeof ( measurement.m_error ),
+                   "unknown exception" );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+static double getSeconds ( const struct timeval & time )
+{
+    return time.tv_sec + time.tv_usec / 1e6;
+}
+
+//----------------------------------------------------------------------------
+// Speedups are against the first row for the same input, which has the
+// first worker count asked for.
+
+static void writeTable
+(   ostream & output,
+    const vector< ScalingRow > & rows
+)
+{
+    output << "input,nodes,input_bytes,workers,pages,read_ms,"
+           << "parse_model_ms,generate_ms,total_ms,pages_per_sec,speedup,"
+           << "efficiency,generate_speedup,generate_efficiency,"
+           << "generate_user_ms,generate_system_ms,generate_off_cpu_ms,"
+           << "peak_rss_kb\n";
+    const ScalingRow * base = 0;
+    char line[400];
+    for ( vector< ScalingRow >::const_iterator iter = rows.begin();
+          iter != rows.end(); ++iter )
+    {
+        if ( base == 0 || base->m_inputName != iter->m_inputName )
+        {
+            base = &*iter;
+        }
+        const ScalingMeasurement & measurement = iter->m_measurement;
+        const ScalingMeasurement & baseMeasurement = base->m_measurement;
+        double totalSeconds = measurement.m_readSeconds
+                              + measurement.m_parseModelSeconds
+                              + measurement.m_generateSeconds;
+        double baseTotalSeconds = baseMeasurement.m_readSeconds
+                                  + baseMeasurement.m_parseModelSeconds
+                                  + baseMeasurement.m_generateSeconds;
+        double workerRatio =
+            double ( iter->m_workerCount ) / base->m_workerCount;
+        double speedup = baseTotalSeconds / totalSeconds;
+        double generateSpeedup = baseMeasurement.m_generateSeconds
+                                 / measurement.m_generateSeconds;
+        double cpuSeconds = measurement.m_generateUserSeconds
+                            + measurement.m_generateSystemSeconds;
+        double offCpuSeconds = max ( 0.0, measurement.m_generateSeconds
+                                          * iter->m_workerCount
+                                          - cpuSeconds );
+        snprintf ( line, sizeof ( line ),
+                   ",%lu,%lu,%u,%lu,%.3f,%.3f,%.3f,%.3f,%.1f,%.3f,%.3f,"
+                   "%.3f,%.3f,%.3f,%.3f,%.3f,%ld\n",
+                   ( unsigned long ) measurement.m_nodeCount,
+                   ( unsigned long ) measurement.m_inputBytes,
+                   iter->m_workerCount,
+                   ( unsigned long ) measurement.m_pages,
+                   measurement.m_readSeconds * 1000,
+                   measurement.m_parseModelSeconds * 1000,
+                   measurement.m_generateSeconds * 1000,
+                   totalSeconds * 1000,
+                   measurement.m_pages / totalSeconds,
+                   speedup, speedup / workerRatio,
+                   generateSpeedup, generateSpeedup / workerRatio,
+                   measurement.m_generateUserSeconds * 1000,
+                   measurement.m_generateSystemSeconds * 1000,
+                   offCpuSeconds * 1000,
+                   measurement.m_peakResidentKilobytes );
+        output << iter->m_inputName << line;
+    }
+}
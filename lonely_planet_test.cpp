@@ -1,238 +1,874 @@
-// Compile, link and run. Simples.
-// Has no external library dependencies apart from STL.
+// Compile (as C++14 or later) with lonely_planet.cpp and
+// lonely_planet_allocations.cpp, link (with -pthread on Linux) and run.
+// Simples. Has no external library dependencies apart from STL, unless built
+// with the optional compression support described under --gzip and --brotli
+// below.
 //
 // Uses RapidXml for XML parsing. This was a fairly arbitrary choice.
 //
 // Run as:
 //
-// lonely_planet_test <taxonomy-xml-file> <destinations-xml-file>
+// lonely_planet_test [ <options> ] <taxonomy-xml-file> <destinations-xml-file>
 //                    <output-directory> [ <section-names> ]
-// where <section-names> defaults to "overview".
+// where <section-names> defaults to "overview" and <options> are:
 //
-// Creates <output-directory> if necessary.
+// --layout=flat      write every page as <output-directory>/lp_<node-id>.html
+//                    (the default).
+// --layout=hashed    spread pages over a two-level tree of 256x256
+//                    directories chosen by a hash of the node-id, e.g.
+//                    <output-directory>/3f/a2/lp_<node-id>.html.
+// --layout=prefix    spread pages over a two-level tree of 100x100
+//                    directories named after the leading four digits of the
+//                    (zero-padded) node-id, e.g. 35/50/lp_355064.html.
+// --gzip[=<level>]   also write lp_<node-id>.html.gz alongside each page,
+//                    compressed at zlib level 1-9 (default 9). Needs a build
+//                    with -DLP_WITH_ZLIB, linked with -lz.
+// --brotli[=<quality>]
+//                    also write lp_<node-id>.html.br alongside each page,
+//                    compressed at brotli quality 0-11 (default 11). Needs a
+//                    build with -DLP_WITH_BROTLI, linked with -lbrotlienc.
+// --template=<file>  lay pages out according to <file> rather than the
+//                    built-in template. The file is HTML containing any of
+//                    the placeholders {{title}} (destination name),
+//                    {{navigation}} (links up and down the hierarchy),
+//                    {{content}} (the requested sections) and {{root}}
+//                    (relative path from the page to <output-directory>,
+//                    for links to stylesheets etc.).
+// --workers=<n>      write the pages from <n> threads at once (default 1),
+//                    which --watch ignores.
+// --max-depth=<n>    fail with a parse error on input nested more than <n>
+//                    elements deep (default no limit).
+// --lazy-destinations
+//                    don't parse the destinations file up front: just find
+//                    where each destination lies in it, and parse one only
+//                    when its page is first rendered. Worth it with --serve,
+//                    or where many destinations never get a page. Can't be
+//                    combined with --tasks, --watch or snapshots, and
+//                    malformed destinations only come to light when parsed.
+// --watch[=<ms>]     after generating, keep running (Linux only): watch the
+//                    two input files and, once changes to them have settled
+//                    for <ms> milliseconds (default 200), re-parse whichever
+//                    changed and rewrite just the pages which differ.
+// --serve=<port>     write nothing; instead serve HTTP on 127.0.0.1:<port>
+//                    (Linux only), rendering each lp_<node-id>.html page
+//                    when it is asked for, whatever directories precede it.
+//                    Any other file is served as-is from <output-directory>.
+// --cache-pages=<n>  with --serve, keep up to <n> of the most recently
+//                    requested pages (default 10000) rather than rendering
+//                    them again.
+// --tasks=<file>     run several generation tasks, one per line of <file>,
+//                    in place of the positional arguments. Each line holds
+//                    [ <options> ] <taxonomy-xml-file> <destinations-xml-file>
+//                    <output-directory> [ <section-names> ], where <options>
+//                    are any of --layout, --gzip, --brotli, --template and
+//                    --workers, which default to those on the command line.
+//                    Each input file is parsed once however many tasks use
+//                    it, and the tasks run concurrently. "#" starts a
+//                    comment.
+// --save-snapshot=<file>
+//                    also save the parsed inputs, for the requested
+//                    sections, to <file> in a binary form.
+// --load-snapshot=<file>
+//                    start from a snapshot saved earlier instead of parsing
+//                    the XML, which takes milliseconds however large it is.
+//                    The positional arguments are then just
+//                    <output-directory> [ <section-names> ], where
+//                    <section-names> defaults to every section saved. It is
+//                    up to you to save the snapshot again when the inputs
+//                    change.
+// --stats[=<file>]   print the wall and CPU time taken by each phase of the
+//                    run (read, parse, extract, model, generate, and the
+//                    rendering part of generate, added up over threads),
+//                    and counts of bytes read, taxonomy nodes, destinations
+//                    indexed, pages rendered, files written, bytes written
+//                    and directories created. Also shows the heap
+//                    allocations made in each phase, the bytes they asked
+//                    for and how much of that was RapidXml's pools for the
+//                    parsed documents, and the allocations and bytes per
+//                    page rendered. On Linux, also shows the resident
+//                    memory at the end of each phase, its growth in the
+//                    phase and its peak so far, and which of the input
+//                    text, the DOM pools, the description maps, the site
+//                    model and rendering hold how much of it at the end.
+//                    With <file>, also write them there as JSON.
+// --perf-counters    with --stats, also count cycles, instructions, cache
+//                    references and misses, branches and branch misses (all
+//                    in user space), and context switches, in each phase,
+//                    and show instructions per cycle and the miss rates.
+//                    Needs perf_event_open (Linux), and hardware counters
+//                    for most of them; whatever can't be counted is shown
+//                    as "-".
+// --trace=<file>     write a timeline of the run to <file> as Chrome trace
+//                    events (open it in Perfetto or chrome://tracing):
+//                    reading, parsing and extracting from each file,
+//                    building the model, each task, the subtrees of the
+//                    taxonomy down to three levels, and a sample of pages,
+//                    each span with its thread and any node-id.
+// --trace-pages=<n>  with --trace, record one page in <n> (default 100).
 //
-// TODO: read template from external file.
-
-#ifdef WIN32
-// For _mkdir()
-#include <direct.h>
-#define MKDIR _mkdir
-#else
-#define MKDIR mkdir
-#endif
+// Creates <output-directory> if necessary.
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <fstream>
 #include <iostream>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <rapidxml.hpp>
-#include <rapidxml_print.hpp>
+#include "lonely_planet.hpp"
+
+#ifdef __linux__
+// For --watch
+#include <poll.h>
+#include <sys/inotify.h>
+// For --serve
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// For --perf-counters
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
 
 using namespace std;
 using namespace rapidxml;
+using namespace lonely_planet;
 
 // Classes:
 //
-//  XmlReader: reads a given XML file and uses RapidXml to parse it (once).
-//  XmlReader TODO:
-//  TODO: (1) make XmlReader abstract and/or make its constructor protected.
-//  TODO: (2) destructor should really close m_file if not already closed.
+//  The readers, SiteModel, HtmlGenerator and HtmlTemplate are described in
+//  lonely_planet.hpp.
+//
+//  InputWatcher: (Linux only) uses inotify to wait for changes to the input
+//  files, for --watch.
+//
+//  PageCache: a bounded least-recently-used cache of rendered pages.
 //
-//  TaxonomyReader: vanilla specialisation of XmlReader, used by HtmlGenerator
-//  to extract from the XML a doubly-linked tree of destinations (well,
-//  RapidXml does that for us).
-//  TaxonomyReader TODO:
-//  TODO: (1) move the tree-traversal from HtmlGenerator::generateFilesForTree
-//  TODO: into a TaxonomyReader method, since HtmlGenerator has no business
-//  TODO: making assumptions about the form of the XML tree.
-//  TODO: (2) Similarly move the level-skipping into TaxonomyReader; also
-//  TODO: factorise it into a private method called N times.
+//  PageServer: (Linux only) an HTTP server for --serve, which renders pages
+//  with an HtmlGenerator when they are requested. A pool of worker threads
+//  shares one epoll instance.
 //
-//  DestinationsReader: specialisation of XmlReader which generates map of
-//  destination-to-description.
-//  DestinationsReader TODO:
-//  DONE: (1) allow nicely for distinguishing multiple content sections in
-//  DONE: description.
+//  GenerationTask: the inputs, output directory, sections and options of
+//  one generation task: the command line's, or one line of a --tasks file.
 //
-//  HtmlGenerator: generates the HTML files (who would have guessed?) by
-//  descending the tree held in TaxonomyReader and correlating the node-ids
-//  with the data mapped in DestinationsReader.
-//  HtmlGenerator TODO:
-//  TODO: (1) copy other necessary files e.g. stylesheet.
-//  TODO: (2) destructor should if necessary close currently-open html file
-//  TODO: stream (which hence should be a member).
-//  TODO: (3) consider generating links on each page to entire ancestor line
-//  TODO: of destinations rather than just immediate parent.
-//  TODO: (4) consider generating index page which displays entire destination
-//  TODO: hierarchy (possibly collapsible).
-//  TODO: (5) see also TaxonomyReader TODOs.
+//  PerfCounters: the process's (and its threads') hardware and software
+//  performance counters, as far as perf_event_open can provide them.
 //
-//  HtmlTemplate: singleton class to hold the HTML template strings.
-//  HtmlTemplate TODO:
-//  TODO: (1) read from template file instead of having it inline (yuk). Need
-//  TODO: to work out how to do the interpolation/substitution, though.
+//  RunStatistics: times the phases of a run, and adds up what was done in
+//  them, for --stats.
+//
+//  setAllocationCounting, getAllocationCount, getAllocatedBytes: how many
+//  allocations there have been, and how many bytes they have asked for,
+//  counted (once counting is on) by the global operator new in
+//  lonely_planet_allocations.cpp.
 //
 //  Main program:
 //  Main program TODO:
-//  TODO: (1) improve argument-handling: add flags.
+//  DONE: (1) improve argument-handling: add flags.
 //  TODO: (2) plausibly allow handing in of format for generated file names
 //  TODO: (rather than hard-coding "lp_<node-id>.html").
-//  TODO: (3) cope with multiple tasks in one invocation.
-//  TODO: (4) investigate scalability.
-//  TODO: (5) investigate robustness, for example what happens if the
-//  TODO: recursive descent runs out of stack? (Well we know what happens, but
-//  TODO: how best to cope?)
-//  TODO: (6) consider generalisation. This is currently stand-alone and
-//  TODO: specialised, but the parse-some-xml-files-and-build-some-html could
-//  TODO: be useful in other contexts.
+//  DONE: (3) cope with multiple tasks in one invocation.
+//  DONE: (4) investigate scalability. Pages can be written from several
+//  DONE: threads (--workers), and lonely_planet_scaling measures how well
+//  DONE: that and the rest of a run scale with input size and workers.
+//  DONE: (5) investigate robustness, for example what happens if the
+//  DONE: recursive descent runs out of stack? Nothing recurses any more:
+//  DONE: our own descent of the trees (extraction, site model, generation,
+//  DONE: and each page's links up to its ancestors) and the RapidXml parser
+//  DONE: all loop instead, and --max-depth turns absurdly deep input into a
+//  DONE: parse error.
+//  DONE: (6) consider generalisation. The readers and the generator are now
+//  DONE: a library (lonely_planet.hpp, and lonely_planet.h for C), which
+//  DONE: this program is one user of.
 //
 //============================================================================
-// Class declarations. Normally I would put these in a header for external
-// use, but this is stand-alone.
+// Class declarations.
 
-class XmlReader
+#ifdef __linux__
+// Editors often replace a file rather than rewrite it, so it is the
+// directories containing the input files which are watched, for files
+// being closed after writing or moved into place.
+class InputWatcher
 {
     public:
-        XmlReader ( const char * fileSignifier,
-                    const char * fileName
-                  );
-        virtual void readAndParse();
-        const xml_document<char> & getDocument() const;
-
-    protected:
-        xml_document<char> m_document;
+        InputWatcher
+        (   const char * taxonomyFileName,
+            const char * destinationsFileName
+        );
+        ~InputWatcher();
+        void waitForChanges
+        (   int debounceMilliseconds,
+            bool & taxonomyChanged,
+            bool & destinationsChanged
+        );
 
     private:
-        ifstream m_file;
-        string m_contents;
+        struct WatchedFile
+        {
+            int m_watchDescriptor;
+            string m_baseName;
+        };
+
+        void addWatch ( const char * fileName, WatchedFile & watchedFile );
+        bool readEvents
+        (   int timeoutMilliseconds,
+            bool & taxonomyChanged,
+            bool & destinationsChanged
+        );
+
+        int m_inotifyDescriptor;
+        WatchedFile m_taxonomyFile;
+        WatchedFile m_destinationsFile;
 };
 
-class TaxonomyReader : public XmlReader
+void watchAndRegenerate
+(   TaxonomyReader & taxonomyReader,
+    DestinationsReader & destinationsReader,
+    SiteModel & siteModel,
+    HtmlGenerator & htmlGenerator,
+    const char * outputDirName,
+    int debounceMilliseconds
+);
+#endif
+
+// Shared by all of a server's workers. Pages are handed out by shared
+// pointer, so one can be evicted while it is still being sent.
+class PageCache
 {
     public:
-        TaxonomyReader ( const char * fileName ) :
-            XmlReader ( "taxonomy", fileName ) {}
+        PageCache ( size_t capacity ) : m_capacity ( capacity ) {}
+        shared_ptr< const string > find ( int nodeId );
+        void insert ( int nodeId, const shared_ptr< const string > & page );
+
+    private:
+        typedef list< pair< int, shared_ptr< const string > > > PageList;
+
+        mutex m_mutex;
+        size_t m_capacity;
+        PageList m_pages;   // most recently used first
+        unordered_map< int, PageList::iterator > m_pageIndex;
 };
 
-class DestinationsReader : public XmlReader
+#ifdef __linux__
+// Every socket is registered one-shot, so only one worker at a time ever
+// handles a given connection, and a connection's state needs no locking.
+class PageServer
 {
     public:
-        DestinationsReader ( const char * fileName ) :
-            XmlReader ( "destinations", fileName ) {}
-        void generateDestinationDescriptions
-        (   const set<string> & sectionNames
+        PageServer
+        (   const HtmlGenerator & htmlGenerator,
+            const char * documentRoot,
+            size_t cachePages
         );
-        void getDestinationDescription
-        (   int node_id,
-            map< string, string > & description
-        ) const;
+        ~PageServer();
+        void serve ( int port, unsigned int workerCount );
 
     private:
-        void getSubTreeContent ( xml_node< char > * node );
+        struct Connection
+        {
+            int m_socket;
+            string m_input;
+            string m_output;
+            size_t m_outputSent;
+            bool m_closeAfterOutput;
+        };
+
+        // Each worker's own, reused from request to request.
+        struct RenderBuffers
+        {
+            string m_page;
+        };
+
+        void runWorker();
+        void acceptConnections();
+        void handleEvent
+        (   Connection * connection,
+            unsigned int events,
+            RenderBuffers & buffers
+        );
+        bool readRequests ( Connection & connection, RenderBuffers & buffers );
+        bool writeOutput ( Connection & connection );
+        void handleRequest
+        (   const string & request,
+            Connection & connection,
+            RenderBuffers & buffers
+        );
+        bool getPage
+        (   int nodeId,
+            RenderBuffers & buffers,
+            shared_ptr< const string > & page
+        );
+        bool readStaticFile
+        (   const string & path,
+            string & contents,
+            const char * & contentType
+        ) const;
+        void respond
+        (   Connection & connection,
+            const char * status,
+            const char * contentType,
+            const char * body,
+            size_t bodyLength,
+            bool headOnly
+        ) const;
+        bool watchSocket
+        (   int socket,
+            Connection * connection,
+            unsigned int events,
+            int operation
+        ) const;
+        void closeConnection ( Connection * connection ) const;
+
+        const HtmlGenerator & m_htmlGenerator;
+        string m_documentRoot;
+        PageCache m_pageCache;
+        int m_listenSocket;
+        int m_epollDescriptor;
+};
+#endif
 
-        const set<string> * m_sectionNames;
-        map< int, map<string, string> > m_descriptions;
-        map< string, string> m_combinedContents;
+struct GenerationTask
+{
+    GenerationTask() :
+        m_outputLayout ( HtmlGenerator::LAYOUT_FLAT ),
+        m_gzipLevel ( -1 ),
+        m_brotliQuality ( -1 ),
+        m_workerCount ( 1 )
+    {}
+    const char * getTemplateFileName() const
+    {
+        return m_templateFileName.empty() ? 0 : m_templateFileName.c_str();
+    }
+
+    string m_taxonomyFileName;
+    string m_destinationsFileName;
+    string m_outputDirName;
+    set<string> m_sectionNames;
+    HtmlGenerator::OutputLayout m_outputLayout;
+    int m_gzipLevel;
+    int m_brotliQuality;
+    string m_templateFileName;  // empty for the built-in template
+    unsigned int m_workerCount;
 };
 
-// I could put the template parts in an external file(s) and read them
-// (just once of course).
-// I could reduce the number of parts by having substitution points.
-class HtmlTemplate
+// The counters are opened to count from then on in this thread and in any
+// threads it starts later, so should be opened before any others start.
+// Other threads' counts are added in as they finish.
+// Those which can't be opened (no PMU in a virtual machine, a restrictive
+// perf_event_paranoid, not Linux) are simply left out.
+class PerfCounters
 {
     public:
-        static HtmlTemplate * createHtmlTemplate(); // enforce singleton
-        const string & getPart1() const { return m_part1; }
-        const string & getPart2() const { return m_part2; }
-        const string & getPart3() const { return m_part3; }
-        const string & getPart4() const { return m_part4; }
-        const string & getPart5() const { return m_part5; }
+        enum Counter
+        {
+            CYCLES,
+            INSTRUCTIONS,
+            CACHE_REFERENCES,
+            CACHE_MISSES,
+            BRANCHES,
+            BRANCH_MISSES,
+            CONTEXT_SWITCHES,
+            COUNTER_COUNT
+        };
+
+        PerfCounters();
+        ~PerfCounters();
+        static const char * getName ( Counter counter );
+        bool isAnyAvailable() const;
+        // Why the first counter that couldn't be opened couldn't be.
+        const string & getUnavailableReason() const
+        {
+            return m_unavailableReason;
+        }
+        // Negative where a counter isn't available.
+        void read ( double values[COUNTER_COUNT] ) const;
 
     private:
-        HtmlTemplate(); // enforce singleton
-        string m_part1;
-        string m_part2;
-        string m_part3;
-        string m_part4;
-        string m_part5;
+        PerfCounters ( const PerfCounters & );      // not copyable
+        PerfCounters & operator= ( const PerfCounters & );
+
+        int m_descriptors[COUNTER_COUNT];   // negative if not open
+        string m_unavailableReason;
 };
 
-class HtmlGenerator
+// Does nothing until enabled, so the phases can be marked out regardless
+// at the cost of a test each.
+class RunStatistics
 {
     public:
-        HtmlGenerator
-        (   const TaxonomyReader & taxonomyReader,
-            const DestinationsReader & destinationsReader
-        ) : m_taxonomyReader ( taxonomyReader ),
-            m_destinationsReader ( destinationsReader ),
-            m_outputDirectory ( "" ),
-            m_template ( HtmlTemplate::createHtmlTemplate() )
+        RunStatistics() :
+            m_enabled ( false ),
+            m_inPhase ( false ),
+            m_perfCounters ( 0 ),
+            m_livePoolBytes ( 0 )
         {}
-        void generateFiles ( const char * outputDirName );
+        void enable() { m_enabled = true; }
+        bool isEnabled() const { return m_enabled; }
+        // Also take the counters' readings over each phase.
+        void setPerfCounters ( const PerfCounters * perfCounters )
+        {
+            m_perfCounters = perfCounters;
+        }
+        // Ends any phase already begun.
+        void beginPhase ( const char * phaseName );
+        void endPhase();
+        // Counts of the same name are added together.
+        void addCount ( const char * countName, double count );
+        void addReaderCounts ( const XmlReader & xmlReader );
+        void addReaderCounts ( const DestinationsReader & destinationsReader );
+        void addIndexCounts ( const DestinationsIndex & destinationsIndex );
+        void addModelCounts ( const SiteModel & siteModel );
+        void addGeneratorCounts ( const HtmlGenerator & htmlGenerator );
+        void print ( ostream & output ) const;
+        void writeJson ( const char * jsonFileName ) const;
 
     private:
-        void createDirectoryRecursively ( const string & directoryName ) const;
-        void createDirectory ( const string & directoryName ) const;
-        void generateFilesForTree ( xml_node<char> * node ) const;
-        void generateFile ( xml_node<char> * node ) const;
-        string makeHtmlFileName ( xml_attribute< char > * node_id ) const;
-
-        const TaxonomyReader & m_taxonomyReader;
-        const DestinationsReader & m_destinationsReader;
-        string m_outputDirectory;
-        HtmlTemplate * m_template;
+        struct Phase
+        {
+            string m_name;
+            double m_wallSeconds;
+            double m_cpuSeconds;    // negative if not known
+            double m_counters[PerfCounters::COUNTER_COUNT]; // negative too
+            double m_allocations;                           // negative too
+            double m_allocatedBytes;
+            double m_poolBytes;
+            long m_residentKilobytes;       // at the end; negative too
+            long m_residentGrowthKilobytes;
+            long m_peakResidentKilobytes;   // so far
+            size_t m_livePoolBytes;         // at the end
+        };
+
+        void addMemory ( const char * ownerName, double bytes );
+        void printAllocationsPerPage ( ostream & output ) const;
+        void printMemory ( ostream & output ) const;
+        double getCount ( const char * countName ) const;
+        const Phase * findPhase ( const char * phaseName ) const;
+        void printPerfCounters ( ostream & output ) const;
+        void writePerfCountersJson ( ostream & output,
+                                     const Phase & phase ) const;
+
+        bool m_enabled;
+        bool m_inPhase;
+        const PerfCounters * m_perfCounters;
+        double m_phaseCountersStart[PerfCounters::COUNTER_COUNT];
+        size_t m_phaseAllocationsStart;
+        size_t m_phaseAllocatedBytesStart;
+        size_t m_phasePoolBytesStart;
+        long m_phaseResidentStart;
+        size_t m_livePoolBytes;         // at the end of the last phase
+        vector< Phase > m_phases;
+        vector< pair< string, double > > m_counts;  // in order of first use
+        vector< pair< string, double > > m_memory;  // bytes, likewise
+        chrono::steady_clock::time_point m_phaseStart;
+        clock_t m_phaseCpuStart;
 };
 
+string applyTaskOption ( const string & argument, GenerationTask & task );
+bool getOptionLevel
+(   const string & argument,
+    size_t nameLength,
+    int defaultLevel,
+    int & level
+);
+void readTasksFile
+(   const char * tasksFileName,
+    const GenerationTask & defaults,
+    vector< GenerationTask > & tasks
+);
+bool runTasks
+(   const vector< GenerationTask > & tasks,
+    RunStatistics & statistics
+);
+void checkSnapshotSections
+(   const SiteModel & siteModel,
+    const char * snapshotFileName,
+    const set<string> & sectionNames
+);
+void runTaskWorker
+(   const vector< GenerationTask > & tasks,
+    const vector< unique_ptr< HtmlGenerator > > & htmlGenerators,
+    vector< string > & errors,
+    atomic< size_t > & nextTask
+);
+void writeTrace
+(   TraceRecorder * traceRecorder,
+    const char * traceFileName
+);
+void setAllocationCounting ( bool counting );
+size_t getAllocationCount();
+size_t getAllocatedBytes();
+void readMemoryStatus
+(   long & residentKilobytes,
+    long & peakResidentKilobytes
+);
+
 //============================================================================
 
 extern int main ( int argc, char ** argv )
 {
+    // Separate options from positional arguments. Those options which
+    // describe the generation itself go into the task, where they are also
+    // the defaults for every task in a --tasks file.
+    GenerationTask commandLineTask;
+    const char * tasksFileName = 0;
+    const char * saveSnapshotFileName = 0;
+    const char * loadSnapshotFileName = 0;
+    RunStatistics statistics;
+    const char * statisticsFileName = 0;
+    bool perfCountersWanted = false;
+    const char * traceFileName = 0;
+    size_t tracePageInterval = 100;
+    int watchDebounceMilliseconds = -1;
+    int servePort = -1;
+    size_t cachePages = 10000;
+    bool lazyDestinations = false;
+    vector< const char * > arguments;
+    for ( int inx = 1; inx < argc; ++inx )
+    {
+        string argument ( argv[inx] );
+        if ( argument.compare ( 0, 2, "--" ) != 0 )
+        {
+            arguments.push_back ( argv[inx] );
+        }
+        else if ( argument.compare ( 0, 8, "--tasks=" ) == 0 )
+        {
+            tasksFileName = argv[inx] + 8;
+        }
+        else if ( argument.compare ( 0, 16, "--save-snapshot=" ) == 0 )
+        {
+            saveSnapshotFileName = argv[inx] + 16;
+        }
+        else if ( argument.compare ( 0, 16, "--load-snapshot=" ) == 0 )
+        {
+            loadSnapshotFileName = argv[inx] + 16;
+        }
+        else if ( argument.compare ( 0, 7, "--watch" ) == 0
+                  && ( argument.size() == 7 || argument[7] == '=' ) )
+        {
+#ifdef __linux__
+            watchDebounceMilliseconds =
+                ( argument.size() > 8 ) ? atoi ( argument.c_str() + 8 ) : 200;
+#else
+            cerr << "Error: (" << argv[0] << ") --watch needs inotify "
+                 << "(Linux)" << endl;
+            return 1;
+#endif
+        }
+        else if ( argument.compare ( 0, 8, "--serve=" ) == 0 )
+        {
+#ifdef __linux__
+            servePort = atoi ( argument.c_str() + 8 );
+            if ( servePort < 1 || servePort > 65535 )
+            {
+                cerr << "Error: (" << argv[0] << ") port must be 1-65535"
+                     << endl;
+                return 1;
+            }
+#else
+            cerr << "Error: (" << argv[0] << ") --serve needs epoll "
+                 << "(Linux)" << endl;
+            return 1;
+#endif
+        }
+        else if ( argument.compare ( 0, 14, "--cache-pages=" ) == 0 )
+        {
+            cachePages = strtoul ( argument.c_str() + 14, 0, 10 );
+        }
+        else if ( argument.compare ( 0, 7, "--stats" ) == 0
+                  && ( argument.size() == 7 || argument[7] == '=' ) )
+        {
+            statistics.enable();
+            setAllocationCounting ( true );
+            statisticsFileName =
+                ( argument.size() > 8 ) ? argv[inx] + 8 : 0;
+        }
+        else if ( argument == "--perf-counters" )
+        {
+            perfCountersWanted = true;
+        }
+        else if ( argument.compare ( 0, 8, "--trace=" ) == 0 )
+        {
+            traceFileName = argv[inx] + 8;
+        }
+        else if ( argument.compare ( 0, 14, "--trace-pages=" ) == 0 )
+        {
+            tracePageInterval = strtoul ( argument.c_str() + 14, 0, 10 );
+        }
+        else if ( argument == "--lazy-destinations" )
+        {
+            lazyDestinations = true;
+        }
+        else if ( argument.compare ( 0, 12, "--max-depth=" ) == 0 )
+        {
+            XmlReader::setMaxDepth (
+                strtoul ( argument.c_str() + 12, 0, 10 ) );
+        }
+        else
+        {
+            string error = applyTaskOption ( argument, commandLineTask );
+            if ( ! error.empty() )
+            {
+                cerr << "Error: (" << argv[0] << ") " << error << endl;
+                return 1;
+            }
+        }
+    }
+
     // Check arguments.
-    if ( argc < 4 )
+    if ( perfCountersWanted && ! statistics.isEnabled() )
+    {
+        cerr << "Error: (" << argv[0] << ") --perf-counters goes with "
+             << "--stats" << endl;
+        return 1;
+    }
+    if ( servePort >= 0 && watchDebounceMilliseconds >= 0 )
+    {
+        cerr << "Error: (" << argv[0] << ") --serve and --watch can't be "
+             << "combined" << endl;
+        return 1;
+    }
+    if ( loadSnapshotFileName != 0
+         && ( saveSnapshotFileName != 0 || watchDebounceMilliseconds >= 0 ) )
+    {
+        cerr << "Error: (" << argv[0] << ") --load-snapshot takes the place "
+             << "of the XML files, so can't be combined with "
+             << "--save-snapshot or --watch" << endl;
+        return 1;
+    }
+    if ( lazyDestinations
+         && ( tasksFileName != 0 || watchDebounceMilliseconds >= 0
+              || saveSnapshotFileName != 0 || loadSnapshotFileName != 0 ) )
+    {
+        cerr << "Error: (" << argv[0] << ") --lazy-destinations can't be "
+             << "combined with --tasks, --watch or snapshots" << endl;
+        return 1;
+    }
+    if ( tasksFileName != 0 )
+    {
+        if ( ! arguments.empty() || servePort >= 0
+             || watchDebounceMilliseconds >= 0
+             || saveSnapshotFileName != 0 || loadSnapshotFileName != 0 )
+        {
+            cerr << "Error: (" << argv[0] << ") --tasks takes the place of "
+                 << "the positional arguments, and can't be combined with "
+                 << "--serve, --watch or snapshots" << endl;
+            return 1;
+        }
+    }
+    else if ( loadSnapshotFileName != 0 )
+    {
+        if ( arguments.empty() )
+        {
+            cerr << "Error: (" << argv[0] << ") --load-snapshot needs "
+                 << "<output-directory> [ <section-names> ]" << endl;
+            return 1;
+        }
+        commandLineTask.m_outputDirName = arguments[0];
+        commandLineTask.m_sectionNames.insert ( arguments.begin() + 1,
+                                                arguments.end() );
+    }
+    else if ( arguments.size() < 3 )
     {
         cerr << "Error: (" << argv[0]
-             << ") needs <taxonomy-xml-file> <destinations-xml-file> "
-             << "<output-directory> [ <section-names> ]" << endl;
+             << ") needs [ <options> ] <taxonomy-xml-file> "
+             << "<destinations-xml-file> <output-directory> "
+             << "[ <section-names> ], or --tasks=<file>" << endl;
         return 1;
     }
+    else
+    {
+        commandLineTask.m_taxonomyFileName = arguments[0];
+        commandLineTask.m_destinationsFileName = arguments[1];
+        commandLineTask.m_outputDirName = arguments[2];
+
+        // Get optional section names. If none supplied, use "overview".
+        for ( size_t inx = 3; inx < arguments.size(); ++inx )
+        {
+            commandLineTask.m_sectionNames.insert ( arguments[inx] );
+        }
+        if ( commandLineTask.m_sectionNames.empty() )
+        {
+            commandLineTask.m_sectionNames.insert ( "overview" );
+        }
+    }
 
-    // Get optional section names. If none supplied, use "overview".
-    set<string> sectionNames;
-    for ( int inx = 4; inx < argc; ++inx )
+    // Opened before any other threads start, so as to count in them too.
+    unique_ptr< PerfCounters > perfCounters;
+    if ( perfCountersWanted )
     {
-        sectionNames.insert ( argv[inx] );
+        perfCounters.reset ( new PerfCounters );
+        if ( ! perfCounters->getUnavailableReason().empty() )
+        {
+            cerr << "Warning: (" << argv[0] << ") "
+                 << perfCounters->getUnavailableReason() << endl;
+        }
+        statistics.setPerfCounters ( perfCounters.get() );
     }
-    if ( sectionNames.empty() )
+    unique_ptr< TraceRecorder > traceRecorder;
+    if ( traceFileName != 0 )
     {
-        sectionNames.insert ( "overview" );
+        traceRecorder.reset ( new TraceRecorder ( tracePageInterval ) );
+        TraceRecorder::setActive ( traceRecorder.get() );
     }
 
     try
     {
-        // Slurp and parse entire files. Note that because of the way that
-        // RapidXml works, we need to hang on to the file content strings as
-        // well as the generated XML tree (because the tree points directly
-        // back into the parsed text rather than making its own string
-        // copies).
-        TaxonomyReader taxonomyReader ( argv[1] );
-        taxonomyReader.readAndParse();
+        if ( tasksFileName != 0 )
+        {
+            vector< GenerationTask > tasks;
+            readTasksFile ( tasksFileName, commandLineTask, tasks );
+            bool succeeded = runTasks ( tasks, statistics );
+            statistics.print ( cout );
+            statistics.writeJson ( statisticsFileName );
+            writeTrace ( traceRecorder.get(), traceFileName );
+            return succeeded ? 0 : 1;
+        }
+
+        SiteModel siteModel;
+        unique_ptr< TaxonomyReader > taxonomyReader;
+        unique_ptr< DestinationsReader > destinationsReader;
+        unique_ptr< DestinationsIndex > destinationsIndex;
+        if ( loadSnapshotFileName != 0 )
+        {
+            statistics.beginPhase ( "snapshot" );
+            siteModel.loadSnapshot ( loadSnapshotFileName );
+            checkSnapshotSections ( siteModel, loadSnapshotFileName,
+                                    commandLineTask.m_sectionNames );
+        }
+        else if ( lazyDestinations )
+        {
+            taxonomyReader.reset ( new TaxonomyReader (
+                commandLineTask.m_taxonomyFileName.c_str() ) );
+            destinationsIndex.reset ( new DestinationsIndex (
+                commandLineTask.m_destinationsFileName.c_str() ) );
+            statistics.beginPhase ( "read" );
+            taxonomyReader->read();
+            statistics.beginPhase ( "parse" );
+            taxonomyReader->parse();
+            statistics.beginPhase ( "index" );
+            destinationsIndex->build ( commandLineTask.m_sectionNames );
+            statistics.beginPhase ( "model" );
+            siteModel.build ( *taxonomyReader,
+                              commandLineTask.m_sectionNames );
+            statistics.endPhase();
+            statistics.addReaderCounts ( *taxonomyReader );
+        }
+        else
+        {
+            // Slurp and parse entire files. Note that because of the way
+            // that RapidXml works, we need to hang on to the file content
+            // strings as well as the generated XML tree (because the tree
+            // points directly back into the parsed text rather than making
+            // its own string copies).
+            taxonomyReader.reset ( new TaxonomyReader (
+                commandLineTask.m_taxonomyFileName.c_str() ) );
+            destinationsReader.reset ( new DestinationsReader (
+                commandLineTask.m_destinationsFileName.c_str() ) );
+            statistics.beginPhase ( "read" );
+            taxonomyReader->read();
+            destinationsReader->read();
+            statistics.beginPhase ( "parse" );
+            taxonomyReader->parse();
+            destinationsReader->selectSections (
+                commandLineTask.m_sectionNames );
+            destinationsReader->parse();
+            statistics.beginPhase ( "extract" );
+            destinationsReader->generateDestinationDescriptions (
+                commandLineTask.m_sectionNames );
+
+            statistics.beginPhase ( "model" );
+            siteModel.build ( *taxonomyReader, *destinationsReader );
+            if ( saveSnapshotFileName != 0 )
+            {
+                siteModel.saveSnapshot ( saveSnapshotFileName );
+            }
+            statistics.endPhase();
+            statistics.addReaderCounts ( *taxonomyReader );
+            statistics.addReaderCounts ( *destinationsReader );
+        }
+        statistics.addModelCounts ( siteModel );
 
-        DestinationsReader destinationsReader ( argv[2] );
-        destinationsReader.readAndParse();
-        destinationsReader.generateDestinationDescriptions ( sectionNames );
+        HtmlGenerator htmlGenerator ( siteModel,
+            commandLineTask.m_outputLayout,
+            commandLineTask.getTemplateFileName() );
+        if ( ! commandLineTask.m_sectionNames.empty() )
+        {
+            htmlGenerator.setSectionNames ( &commandLineTask.m_sectionNames );
+        }
+        htmlGenerator.setGzipLevel ( commandLineTask.m_gzipLevel );
+        htmlGenerator.setBrotliQuality ( commandLineTask.m_brotliQuality );
+        htmlGenerator.setWorkerCount ( commandLineTask.m_workerCount );
+        htmlGenerator.setSkipUnchangedPages ( watchDebounceMilliseconds >= 0 );
+        htmlGenerator.setTimeRendering ( statistics.isEnabled() );
+        htmlGenerator.setDestinationsIndex ( destinationsIndex.get() );
+        const char * outputDirName = commandLineTask.m_outputDirName.c_str();
+
+#ifdef __linux__
+        if ( servePort >= 0 )
+        {
+            if ( destinationsIndex )
+            {
+                statistics.addIndexCounts ( *destinationsIndex );
+            }
+            statistics.print ( cout );
+            statistics.writeJson ( statisticsFileName );
+            writeTrace ( traceRecorder.get(), traceFileName );
+            htmlGenerator.prepareToRender();
+            PageServer pageServer ( htmlGenerator, outputDirName, cachePages );
+            unsigned int workerCount = thread::hardware_concurrency();
+            pageServer.serve ( servePort, workerCount != 0 ? workerCount : 4 );
+            return 0;
+        }
+#endif
+        statistics.beginPhase ( "generate" );
+        htmlGenerator.generateFiles ( outputDirName );
+        statistics.endPhase();
+        statistics.addGeneratorCounts ( htmlGenerator );
+        if ( destinationsIndex )
+        {
+            statistics.addIndexCounts ( *destinationsIndex );
+        }
+        statistics.print ( cout );
+        statistics.writeJson ( statisticsFileName );
+        writeTrace ( traceRecorder.get(), traceFileName );
 
-        HtmlGenerator htmlGenerator ( taxonomyReader, destinationsReader );
-        htmlGenerator.generateFiles ( argv[3] );
+#ifdef __linux__
+        if ( watchDebounceMilliseconds >= 0 )
+        {
+            watchAndRegenerate ( *taxonomyReader, *destinationsReader,
+                                 siteModel, htmlGenerator, outputDirName,
+                                 watchDebounceMilliseconds );
+        }
+#endif
     }
     catch ( const string & error )
     {
         cerr << "Caught exception: " << error << endl;
         return 1;
     }
+    catch ( const parse_error & error )
+    {
+        cerr << "Parse error: " << error.what() << endl;
+        return 1;
+    }
     catch ( ... )
     {
         cerr << "Caught unknown exception" << endl;
@@ -243,483 +879,1910 @@ extern int main ( int argc, char ** argv )
 }
 
 //============================================================================
+// Apply one of the options which describe a generation task. Returns an
+// error message, or an empty string if all is well.
 
-XmlReader::XmlReader
-(   const char * fileSignifier,
-    const char * fileName
-)
+string applyTaskOption ( const string & argument, GenerationTask & task )
 {
-    m_file.open ( fileName, ios::in );
-    if ( ! m_file.is_open() )
+    if ( argument == "--layout=flat" )
     {
-        stringstream errorStream;
-        errorStream << "Failed to open " << fileSignifier << " file "
-                    << fileName << " for reading";
-        throw errorStream.str();
+        task.m_outputLayout = HtmlGenerator::LAYOUT_FLAT;
     }
-}
-
-//----------------------------------------------------------------------------
-
-void XmlReader::readAndParse()
-{
-    string fileLine;
-    while ( getline ( m_file, fileLine ) )
+    else if ( argument == "--layout=hashed" )
     {
-        m_contents.append ( fileLine );
+        task.m_outputLayout = HtmlGenerator::LAYOUT_HASHED;
     }
-    m_file.close();
-
-    // Vile rapidxml declares input arg as char*, not const char *.
-    // 0 means default parse flags
-    m_document.parse<0> ( const_cast<char*>(m_contents.c_str()) );
-
-}
-
-//----------------------------------------------------------------------------
-// Standard "getter".
-
-const xml_document<char> & XmlReader::getDocument() const
-{
-    return m_document;
-}
-
-//============================================================================
-// Look through all the "destination" children of the top-level "destinations"
-// node and get their descriptions.
-
-void DestinationsReader::generateDestinationDescriptions
-(   const set<string> & sectionNames
-)
-{
-    m_sectionNames = &sectionNames;
-    xml_node<char> * destinationsChild = m_document.first_node (
-        "destinations" );
-    if ( destinationsChild != 0 )
+    else if ( argument == "--layout=prefix" )
     {
-        for ( xml_node<char> * destination = destinationsChild->first_node (
-                  "destination" );
-              destination != 0;
-              destination = destination->next_sibling ( "destination" ) )
+        task.m_outputLayout = HtmlGenerator::LAYOUT_ID_PREFIX;
+    }
+    else if ( argument.compare ( 0, 11, "--template=" ) == 0 )
+    {
+        task.m_templateFileName = argument.substr ( 11 );
+    }
+    else if ( argument.compare ( 0, 6, "--gzip" ) == 0
+              && ( argument.size() == 6 || argument[6] == '=' ) )
+    {
+#ifdef LP_WITH_ZLIB
+        if ( ! getOptionLevel ( argument, 6, 9, task.m_gzipLevel )
+             || task.m_gzipLevel < 1 || task.m_gzipLevel > 9 )
         {
-            xml_attribute< char > * atlas_id =
-                destination->first_attribute ( "atlas_id" );
-            if ( atlas_id != 0 )
-            {
-                for ( set<string>::const_iterator iter = m_sectionNames->begin();
-                      iter != m_sectionNames->end(); ++iter )
-                {
-                    m_combinedContents[*iter] = "";
-                }
-                // Pick up all content from sub-tree.
-                getSubTreeContent ( destination );
-                for ( set<string>::const_iterator iter = m_sectionNames->begin();
-                      iter != m_sectionNames->end(); ++iter )
-                m_descriptions.insert ( pair< int, map< string, string > > (
-                    atoi ( atlas_id->value() ), m_combinedContents ) );
-            }
+            return "gzip level must be 1-9";
         }
+#else
+        return "built without gzip support (LP_WITH_ZLIB)";
+#endif
     }
-}
-
-//----------------------------------------------------------------------------
-// Recursively gather up all the relevant sections.
-
-void DestinationsReader::getSubTreeContent
-(   xml_node< char > * node
-)
-{
-    if ( m_sectionNames->find ( node->name() ) != m_sectionNames->end() )
+    else if ( argument.compare ( 0, 10, "--workers=" ) == 0 )
+    {
+        int workerCount = atoi ( argument.c_str() + 10 );
+        if ( workerCount < 1 )
+        {
+            return "workers must be at least 1";
+        }
+        task.m_workerCount = workerCount;
+    }
+    else if ( argument.compare ( 0, 8, "--brotli" ) == 0
+              && ( argument.size() == 8 || argument[8] == '=' ) )
     {
-        xml_node< char > * contentData = node->first_node();
-        if ( contentData != 0 )
+#ifdef LP_WITH_BROTLI
+        if ( ! getOptionLevel ( argument, 8, 11, task.m_brotliQuality )
+             || task.m_brotliQuality < 0 || task.m_brotliQuality > 11 )
         {
-            string & combinedContent = m_combinedContents[node->name()];
-            combinedContent.append ( "<p>" );
-            combinedContent.append ( contentData->value() );
-            combinedContent.append ( "</p>" );
+            return "brotli quality must be 0-11";
         }
+#else
+        return "built without brotli support (LP_WITH_BROTLI)";
+#endif
     }
-    for ( xml_node<char> * child = node->first_node();
-          child != 0; child = child->next_sibling() )
+    else
     {
-        getSubTreeContent ( child );
+        return "unrecognised option " + argument;
     }
+    return "";
 }
 
 //----------------------------------------------------------------------------
-// Find description for given node_id.
-
-void DestinationsReader::getDestinationDescription
-(   int node_id,
-    map< string, string > & description
-) const
+// For an option which may be given a level: "--<name>" alone means the
+// default level, and "--<name>=<level>" needs a number, nothing else.
+// Returns false if the level isn't one.
+
+bool getOptionLevel
+(   const string & argument,
+    size_t nameLength,
+    int defaultLevel,
+    int & level
+)
 {
-    map< int, map< string, string > >::const_iterator descriptionIter =
-        m_descriptions.find ( node_id );
-    if ( descriptionIter != m_descriptions.end() )
+    if ( argument.size() == nameLength )
+    {
+        level = defaultLevel;
+        return true;
+    }
+    const char * value = argument.c_str() + nameLength + 1;
+    char * valueEnd;
+    long number = strtol ( value, &valueEnd, 10 );
+    if ( valueEnd == value || *valueEnd != 0 || number < INT_MIN
+         || number > INT_MAX )
     {
-        description = descriptionIter->second;
+        return false;
     }
+    level = int ( number );
+    return true;
 }
 
-//============================================================================
-
-void HtmlGenerator::generateFiles ( const char * outputDirName )
+//----------------------------------------------------------------------------
+// One task per line, laid out like a command line without the program name:
+// [ <options> ] <taxonomy-xml-file> <destinations-xml-file>
+// <output-directory> [ <section-names> ], separated by white space. Blank
+// lines, and anything after a "#", are ignored. Each task starts from the
+// given defaults.
+
+void readTasksFile
+(   const char * tasksFileName,
+    const GenerationTask & defaults,
+    vector< GenerationTask > & tasks
+)
 {
-    // First we have to skip some assumed higher-level nodes.
-    const char * taxonomiesString = "taxonomies";
-    xml_node<char> * taxonomiesChild =
-        m_taxonomyReader.getDocument().first_node ( taxonomiesString );
-    if ( 0 == taxonomiesChild )
+    ifstream tasksFile ( tasksFileName, ios::in );
+    if ( ! tasksFile.is_open() )
     {
         stringstream errorStream;
-        errorStream << "Mal-formed taxonomy document: found no first-level \""
-                    << taxonomiesString << "\" element";
+        errorStream << "Failed to open tasks file " << tasksFileName
+                    << " for reading";
         throw errorStream.str();
     }
 
-    const char * taxonomyString = "taxonomy";
-    xml_node<char> * taxonomyChild = taxonomiesChild->first_node (
-        taxonomyString );
-    if ( 0 == taxonomyChild )
+    string fileLine;
+    for ( int lineNumber = 1; getline ( tasksFile, fileLine ); ++lineNumber )
     {
-        stringstream errorStream;
-        errorStream << "Mal-formed taxonomy document: found no second-level \""
-                    << taxonomyString << "\" element";
-        throw errorStream.str();
-    }
+        string::size_type commentStart = fileLine.find ( '#' );
+        if ( commentStart != string::npos )
+        {
+            fileLine.erase ( commentStart );
+        }
 
-    // Fudge a root node for "World".
-
-    // A usable node has an attribute "atlas_node_id" and a child_node
-    // identified as "node_name".
-    // Its children are all the child_nodes identified as "node".
-    // So we start with this:
-
-    //  <taxonomies>
-    //    <taxonomy>
-    //      <taxonomy_name>World</taxonomy_name>
-    //      <node atlas_node_id = "355064" ethyl_content_object_id="82534" geo_id = "355064">
-    //        <node_name>Africa</node_name>
-    //        <node atlas_node_id = "355611" ethyl_content_object_id="3210" geo_id = "355611">
-    //          <node_name>South Africa</node_name>
-    //          <node atlas_node_id = "355612" ethyl_content_object_id="35474" geo_id = "355612">
-    //            <node_name>Cape Town</node_name>
-    //            <node atlas_node_id = "355613" ethyl_content_object_id="" geo_id = "355613">
-    //              <node_name>Table Mountain National Park</node_name>
-    //            </node>
-    //          </node>
-
-    // but we want to end up with this:
-
-    // ...
-    //
-    //    <node atlas_node_id = "1">
-    //      <node_name>World</node_name>
-    //
-    //      <node atlas_node_id = "355064" ethyl_content_object_id="82534" geo_id = "355064">
-    //        <node_name>Africa</node_name>
-    //        <node atlas_node_id = "355611" ethyl_content_object_id="3210" geo_id = "355611">
-    //          <node_name>South Africa</node_name>
-    //          <node atlas_node_id = "355612" ethyl_content_object_id="35474" geo_id = "355612">
-    //            <node_name>Cape Town</node_name>
-    //            <node atlas_node_id = "355613" ethyl_content_object_id="" geo_id = "355613">
-    //              <node_name>Table Mountain National Park</node_name>
-    //            </node>
-    //          </node>
-
-    // Modify <taxonomy> to have an atlas_node_id=1 attribute.
-    xml_attribute<char> * atlasNodeIdAttr = new xml_attribute<char>;
-    string atlasNodeIdAttrName ( "atlas_node_id" );
-    atlasNodeIdAttr->name ( atlasNodeIdAttrName.c_str() );
-    string atlasNodeIdAttrValue ( "1" );
-    atlasNodeIdAttr->value ( atlasNodeIdAttrValue.c_str() );
-    taxonomyChild->append_attribute ( atlasNodeIdAttr );
-
-    // Give <taxonomy> a child data node <node_name>.
-    xml_node<char> * nodeNameNode = new xml_node<char> ( node_data );
-    string nodeNameNodeName ( "node_name" );
-    nodeNameNode->name ( nodeNameNodeName.c_str() );
-    string nodeNameNodeValue ( "World" );
-    nodeNameNode->value ( nodeNameNodeValue.c_str() );
-    taxonomyChild->append_node ( nodeNameNode );
-
-    // Rename <taxonomy> as <node>.
-    string taxonomyName ( "node" );
-    taxonomyChild->name ( taxonomyName.c_str() );
-
-    // Generate hierarchy.
-    createDirectory ( outputDirName );
-    m_outputDirectory = outputDirName;
-    m_outputDirectory.append ( "/" );
-    generateFilesForTree ( taxonomyChild );
-}
-
-//----------------------------------------------------------------------------
-// Given a/b/c/d:
-// recursively call with a/b/c
-// recursively call with a/b
-// recursively call with a
-// create a
-// create a/b
-// create a/b/c
-// create a/b/c/d.
-
-void HtmlGenerator::createDirectoryRecursively
-(   const string & directoryName
-) const
-{
-    size_t lastSeparatorIndex = directoryName.find_last_of ( "\\/" );
-    if ( lastSeparatorIndex != string::npos )
-    {
-        createDirectoryRecursively ( directoryName.substr ( 0, lastSeparatorIndex ) );
+        GenerationTask task ( defaults );
+        vector< string > arguments;
+        istringstream lineStream ( fileLine );
+        string argument;
+        while ( lineStream >> argument )
+        {
+            if ( argument.compare ( 0, 2, "--" ) != 0 )
+            {
+                arguments.push_back ( argument );
+                continue;
+            }
+            string error = applyTaskOption ( argument, task );
+            if ( ! error.empty() )
+            {
+                stringstream errorStream;
+                errorStream << "Tasks file " << tasksFileName << " line "
+                            << lineNumber << ": " << error;
+                throw errorStream.str();
+            }
+        }
+        if ( arguments.empty() )
+        {
+            continue;
+        }
+        if ( arguments.size() < 3 )
+        {
+            stringstream errorStream;
+            errorStream << "Tasks file " << tasksFileName << " line "
+                        << lineNumber << ": needs <taxonomy-xml-file> "
+                        << "<destinations-xml-file> <output-directory> "
+                        << "[ <section-names> ]";
+            throw errorStream.str();
+        }
+
+        task.m_taxonomyFileName = arguments[0];
+        task.m_destinationsFileName = arguments[1];
+        task.m_outputDirName = arguments[2];
+        task.m_sectionNames.insert ( arguments.begin() + 3, arguments.end() );
+        if ( task.m_sectionNames.empty() )
+        {
+            task.m_sectionNames.insert ( "overview" );
+        }
+        tasks.push_back ( task );
     }
-    // Blithely ignoring errors for now since we will eventually try to
-    // create files and that will indicate any mkdir failure implicitly.
-    // An error could merely indicate that the directory already exists.
-    MKDIR ( directoryName.c_str() );
 }
 
 //----------------------------------------------------------------------------
-// Given a/b/c/d:
-// create a
-// create a/b
-// create a/b/c
-// create a/b/c/d.
-
-void HtmlGenerator::createDirectory
-(   const string & directoryName
-) const
+// Parse each distinct input file just once, however many tasks use it. A
+// destinations file's descriptions are generated for every section that
+// any of its tasks asks for, and each task's generator then picks out its
+// own from the model of its pair of files. Nothing parsed is changed after
+// that, so the tasks can all share it and run at the same time, as many at
+// once as there are hardware threads. Each phase is done for every file
+// before the next begins, so that it can be timed. Returns false if any
+// task failed.
+
+bool runTasks
+(   const vector< GenerationTask > & tasks,
+    RunStatistics & statistics
+)
 {
-    size_t start = 0;
-    for(;;)
+    map< string, set<string> > destinationsSections;
+    map< string, unique_ptr< TaxonomyReader > > taxonomyReaders;
+    map< string, unique_ptr< DestinationsReader > > destinationsReaders;
+    for ( vector< GenerationTask >::const_iterator taskIter = tasks.begin();
+          taskIter != tasks.end(); ++taskIter )
     {
-        size_t firstSeparatorIndex = directoryName.find_first_of ( "\\/", start );
-        string dirName = directoryName.substr ( 0, firstSeparatorIndex );
-        // Blithely ignoring errors for now since we will eventually try to
-        // create files and that will indicate any mkdir failure implicitly.
-        // An error could merely indicate that the directory already exists.
-        MKDIR ( dirName.c_str() );
-        if ( firstSeparatorIndex == string::npos )
+        destinationsSections[taskIter->m_destinationsFileName].insert (
+            taskIter->m_sectionNames.begin(), taskIter->m_sectionNames.end() );
+
+        unique_ptr< TaxonomyReader > & taxonomyReader =
+            taxonomyReaders[taskIter->m_taxonomyFileName];
+        if ( ! taxonomyReader )
         {
-            break;
+            taxonomyReader.reset ( new TaxonomyReader (
+                taskIter->m_taxonomyFileName.c_str() ) );
+        }
+        unique_ptr< DestinationsReader > & destinationsReader =
+            destinationsReaders[taskIter->m_destinationsFileName];
+        if ( ! destinationsReader )
+        {
+            destinationsReader.reset ( new DestinationsReader (
+                taskIter->m_destinationsFileName.c_str() ) );
         }
-        start = firstSeparatorIndex+1;
     }
-}
-
-//----------------------------------------------------------------------------
-// Recursive descent.
 
-void HtmlGenerator::generateFilesForTree ( xml_node<char> * node ) const
-{
-    generateFile ( node );
-    for ( xml_node<char> * child = node->first_node ( "node" );
-          child != 0; child = child->next_sibling ( "node" ) )
+    map< string, unique_ptr< TaxonomyReader > >::iterator taxonomyIter;
+    map< string, unique_ptr< DestinationsReader > >::iterator
+        destinationsIter;
+    statistics.beginPhase ( "read" );
+    for ( taxonomyIter = taxonomyReaders.begin();
+          taxonomyIter != taxonomyReaders.end(); ++taxonomyIter )
     {
-        generateFilesForTree ( child );
+        taxonomyIter->second->read();
     }
-}
-
-//----------------------------------------------------------------------------
-// Create HTML file according to template.
-// A usable node has an attribute "atlas_node_id" and a child_node identified
-// as "node_name".
-// Its children are all the child_nodes identified as "node".
-
-void HtmlGenerator::generateFile ( xml_node<char> * node ) const
-{
-#if 0
-    cout << "HtmlGenerator::generateFile: node " << node << " has value " << node->value() << endl;
-    for (xml_attribute<> *attr = node->first_attribute();
-         attr; attr = attr->next_attribute())
+    for ( destinationsIter = destinationsReaders.begin();
+          destinationsIter != destinationsReaders.end(); ++destinationsIter )
     {
-        cout << "    Attribute " << attr->name() << " ";
-        cout << "with value " << attr->value() << endl;
+        destinationsIter->second->read();
     }
-    for ( xml_node<char> * child = node->first_node ();
-          child != 0; child = child->next_sibling () )
+    statistics.beginPhase ( "parse" );
+    for ( taxonomyIter = taxonomyReaders.begin();
+          taxonomyIter != taxonomyReaders.end(); ++taxonomyIter )
     {
-        cout << "    Child node " << child << " with name "<< child->name() << " and value " << child->value() << endl;
+        taxonomyIter->second->parse();
     }
-#endif
-
-    // Usable node?
-    xml_attribute< char > * atlas_node_id =
-        node->first_attribute ( "atlas_node_id" );
-    if ( 0 == atlas_node_id )    // not a usable node
+    for ( destinationsIter = destinationsReaders.begin();
+          destinationsIter != destinationsReaders.end(); ++destinationsIter )
     {
-        return;
+        destinationsIter->second->selectSections (
+            destinationsSections[destinationsIter->first] );
+        destinationsIter->second->parse();
     }
-
-    xml_node< char > * node_name = node->first_node ( "node_name" );
-    if ( 0 == node_name )   // not a usable node
+    statistics.beginPhase ( "extract" );
+    for ( destinationsIter = destinationsReaders.begin();
+          destinationsIter != destinationsReaders.end(); ++destinationsIter )
     {
-        return;
+        destinationsIter->second->generateDestinationDescriptions (
+            destinationsSections[destinationsIter->first] );
     }
 
-    // Construct filename and try to open it for write.
-    string htmlFileName ( makeHtmlFileName ( atlas_node_id ) );
-    string htmlFilePath ( m_outputDirectory );
-    htmlFilePath.append ( htmlFileName );
-    ofstream htmlFile ( htmlFilePath.c_str(), ios::out );
-    if ( ! htmlFile.is_open() )
+    statistics.beginPhase ( "model" );
+    map< pair< string, string >, unique_ptr< SiteModel > > siteModels;
+    vector< unique_ptr< HtmlGenerator > > htmlGenerators;
+    for ( vector< GenerationTask >::const_iterator taskIter = tasks.begin();
+          taskIter != tasks.end(); ++taskIter )
     {
-        stringstream errorStream;
-        errorStream << "Failed to open html file " << htmlFilePath
-                    << " for writing";
-        throw errorStream.str();
-    }
+        unique_ptr< SiteModel > & siteModel = siteModels[make_pair (
+            taskIter->m_taxonomyFileName, taskIter->m_destinationsFileName )];
+        if ( ! siteModel )
+        {
+            siteModel.reset ( new SiteModel );
+            siteModel->build ( *taxonomyReaders[taskIter->m_taxonomyFileName],
+                *destinationsReaders[taskIter->m_destinationsFileName] );
+            statistics.addModelCounts ( *siteModel );
+        }
 
-    // Write template+substitutions.
-    htmlFile << m_template->getPart1() << node_name->value()
-             << m_template->getPart2();
+        // The generators are all made here, before any task starts, because
+        // they share templates which are compiled on first use.
+        HtmlGenerator * htmlGenerator = new HtmlGenerator ( *siteModel,
+            taskIter->m_outputLayout, taskIter->getTemplateFileName() );
+        htmlGenerators.push_back ( unique_ptr< HtmlGenerator > (
+            htmlGenerator ) );
+        htmlGenerator->setGzipLevel ( taskIter->m_gzipLevel );
+        htmlGenerator->setBrotliQuality ( taskIter->m_brotliQuality );
+        htmlGenerator->setSectionNames ( &taskIter->m_sectionNames );
+        htmlGenerator->setWorkerCount ( taskIter->m_workerCount );
+        htmlGenerator->setTimeRendering ( statistics.isEnabled() );
+    }
 
-    vector< xml_node<char>* > ancestors;
-    for ( xml_node<char>* parent = node->parent(); parent != 0; parent = parent->parent() )
+    statistics.beginPhase ( "generate" );
+    vector< string > errors ( tasks.size() );
+    atomic< size_t > nextTask ( 0 );
+    unsigned int workerCount = thread::hardware_concurrency();
+    workerCount = min< size_t > ( workerCount != 0 ? workerCount : 4,
+                                  tasks.size() );
+    vector< thread > workers;
+    for ( unsigned int workerNumber = 0; workerNumber < workerCount;
+          ++workerNumber )
     {
-        ancestors.push_back ( parent );
+        workers.push_back ( thread ( runTaskWorker, cref ( tasks ),
+            cref ( htmlGenerators ), ref ( errors ), ref ( nextTask ) ) );
     }
-    for ( vector< xml_node<char>* >::reverse_iterator riter = ancestors.rbegin();
-          riter != ancestors.rend(); ++riter )
+    for ( vector< thread >::iterator workerIter = workers.begin();
+          workerIter != workers.end(); ++workerIter )
     {
-        xml_attribute< char > * parent_atlas_node_id =
-            (*riter)->first_attribute ( "atlas_node_id" );
-        xml_node< char > * parent_node_name =
-            (*riter)->first_node ( "node_name" );
-        if ( parent_atlas_node_id != 0 && parent_node_name != 0 )
-        {
-            htmlFile << "<p>Up to <a href=\""
-                     << makeHtmlFileName ( parent_atlas_node_id ) << "\">"
-                     << parent_node_name->value() << "</a></p>";
-        }
+        workerIter->join();
+    }
+    statistics.endPhase();
+    for ( taxonomyIter = taxonomyReaders.begin();
+          taxonomyIter != taxonomyReaders.end(); ++taxonomyIter )
+    {
+        statistics.addReaderCounts ( *taxonomyIter->second );
+    }
+    for ( destinationsIter = destinationsReaders.begin();
+          destinationsIter != destinationsReaders.end(); ++destinationsIter )
+    {
+        statistics.addReaderCounts ( *destinationsIter->second );
+    }
+    for ( vector< unique_ptr< HtmlGenerator > >::const_iterator generatorIter =
+              htmlGenerators.begin();
+          generatorIter != htmlGenerators.end(); ++generatorIter )
+    {
+        statistics.addGeneratorCounts ( **generatorIter );
     }
 
-    for ( xml_node<char> * child = node->first_node ( "node" );
-          child != 0; child = child->next_sibling ( "node" ) )
+    bool succeeded = true;
+    for ( size_t inx = 0; inx < tasks.size(); ++inx )
     {
-        xml_attribute< char > * child_atlas_node_id =
-            child->first_attribute ( "atlas_node_id" );
-        xml_node< char > * child_node_name =
-            child->first_node ( "node_name" );
-        if ( child_atlas_node_id != 0 && child_node_name != 0 )
+        if ( ! errors[inx].empty() )
         {
-            htmlFile << "<p><a href=\""
-                     << makeHtmlFileName ( child_atlas_node_id ) << "\">"
-                     << child_node_name->value() << "</a></p>";
+            cerr << "Task " << inx + 1 << " (" << tasks[inx].m_outputDirName
+                 << ") failed: " << errors[inx] << endl;
+            succeeded = false;
         }
     }
+    return succeeded;
+}
 
-    htmlFile << m_template->getPart3() << node_name->value()
-             << m_template->getPart4();
-    map< string, string > description;
-    m_destinationsReader.getDestinationDescription ( atoi ( atlas_node_id->value() ), description );
-    for ( map< string, string >::const_iterator iter = description.begin();
-          iter != description.end(); ++iter )
+//----------------------------------------------------------------------------
+// A snapshot only holds the sections it was saved with.
+
+void checkSnapshotSections
+(   const SiteModel & siteModel,
+    const char * snapshotFileName,
+    const set<string> & sectionNames
+)
+{
+    set<string> savedSectionNames;
+    for ( size_t nameIndex = 0; nameIndex < siteModel.getSectionNameCount();
+          ++nameIndex )
     {
-        string heading ( iter->first );
-        heading[0] = toupper ( heading[0] );
-        htmlFile << "<h3>" << heading << "</h3>" << iter->second;
+        const SiteModel::SectionName & sectionName =
+            siteModel.getSectionName ( nameIndex );
+        savedSectionNames.insert ( string (
+            siteModel.getText ( sectionName.m_offset ),
+            sectionName.m_length ) );
     }
-    htmlFile << m_template->getPart5();
 
-    // Done.
-    htmlFile.close();
+    for ( set<string>::const_iterator nameIter = sectionNames.begin();
+          nameIter != sectionNames.end(); ++nameIter )
+    {
+        if ( savedSectionNames.count ( *nameIter ) == 0 )
+        {
+            stringstream errorStream;
+            errorStream << "Snapshot file " << snapshotFileName
+                        << " holds no section \"" << *nameIter << "\"";
+            throw errorStream.str();
+        }
+    }
 }
 
 //----------------------------------------------------------------------------
-// Build "lp_<nodeid>.html".
+// Take tasks in turn until there are none left, recording any failures.
 
-string HtmlGenerator::makeHtmlFileName
-(   xml_attribute< char > * node_id
+void runTaskWorker
+(   const vector< GenerationTask > & tasks,
+    const vector< unique_ptr< HtmlGenerator > > & htmlGenerators,
+    vector< string > & errors,
+    atomic< size_t > & nextTask
+)
+{
+    for ( size_t taskIndex = nextTask++; taskIndex < tasks.size();
+          taskIndex = nextTask++ )
+    {
+        TraceRecorder::Span span ( "task",
+                                   tasks[taskIndex].m_outputDirName.c_str() );
+        try
+        {
+            htmlGenerators[taskIndex]->generateFiles (
+                tasks[taskIndex].m_outputDirName.c_str() );
+        }
+        catch ( const string & error )
+        {
+            errors[taskIndex] = error;
+        }
+        catch ( ... )
+        {
+            errors[taskIndex] = "unknown exception";
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Once the pages have been generated the trace is complete: anything after
+// that (--watch, --serve) goes on indefinitely, so isn't recorded.
+
+void writeTrace
+(   TraceRecorder * traceRecorder,
+    const char * traceFileName
+)
+{
+    if ( traceRecorder == 0 )
+    {
+        return;
+    }
+    TraceRecorder::setActive ( 0 );
+    traceRecorder->write ( traceFileName );
+}
+
+//============================================================================
+// CPU time is the whole process's, so takes in every thread.
+
+void RunStatistics::beginPhase ( const char * phaseName )
+{
+    if ( ! m_enabled )
+    {
+        return;
+    }
+    endPhase();
+    Phase phase;
+    phase.m_name = phaseName;
+    phase.m_wallSeconds = 0;
+    phase.m_cpuSeconds = 0;
+    fill ( phase.m_counters, phase.m_counters + PerfCounters::COUNTER_COUNT,
+           -1.0 );
+    phase.m_allocations = 0;
+    phase.m_allocatedBytes = 0;
+    phase.m_poolBytes = 0;
+    phase.m_residentKilobytes = -1;
+    phase.m_residentGrowthKilobytes = -1;
+    phase.m_peakResidentKilobytes = -1;
+    phase.m_livePoolBytes = 0;
+    m_phases.push_back ( phase );
+    m_inPhase = true;
+    if ( m_perfCounters != 0 )
+    {
+        m_perfCounters->read ( m_phaseCountersStart );
+    }
+    m_phaseAllocationsStart = getAllocationCount();
+    m_phaseAllocatedBytesStart = getAllocatedBytes();
+    m_phasePoolBytesStart = XmlReader::getPoolCounts().m_bytes;
+    long peakResidentKilobytes;
+    readMemoryStatus ( m_phaseResidentStart, peakResidentKilobytes );
+    m_phaseCpuStart = clock();
+    m_phaseStart = chrono::steady_clock::now();
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::endPhase()
+{
+    if ( ! m_inPhase )
+    {
+        return;
+    }
+    Phase & phase = m_phases.back();
+    phase.m_wallSeconds = chrono::duration< double > (
+        chrono::steady_clock::now() - m_phaseStart ).count();
+    phase.m_cpuSeconds = double ( clock() - m_phaseCpuStart ) / CLOCKS_PER_SEC;
+    phase.m_allocations = double ( getAllocationCount()
+                                   - m_phaseAllocationsStart );
+    phase.m_allocatedBytes = double ( getAllocatedBytes()
+                                      - m_phaseAllocatedBytesStart );
+    phase.m_poolBytes = double ( XmlReader::getPoolCounts().m_bytes
+                                 - m_phasePoolBytesStart );
+    phase.m_livePoolBytes = XmlReader::getPoolCounts().m_liveBytes;
+    m_livePoolBytes = phase.m_livePoolBytes;
+    readMemoryStatus ( phase.m_residentKilobytes,
+                       phase.m_peakResidentKilobytes );
+    if ( phase.m_residentKilobytes >= 0 && m_phaseResidentStart >= 0 )
+    {
+        phase.m_residentGrowthKilobytes =
+            phase.m_residentKilobytes - m_phaseResidentStart;
+    }
+    if ( m_perfCounters != 0 )
+    {
+        m_perfCounters->read ( phase.m_counters );
+        for ( int counter = 0; counter < PerfCounters::COUNTER_COUNT;
+              ++counter )
+        {
+            if ( phase.m_counters[counter] >= 0 )
+            {
+                phase.m_counters[counter] -= m_phaseCountersStart[counter];
+            }
+        }
+    }
+    m_inPhase = false;
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::addCount
+(   const char * countName,
+    double count
+)
+{
+    if ( ! m_enabled )
+    {
+        return;
+    }
+    for ( vector< pair< string, double > >::iterator iter = m_counts.begin();
+          iter != m_counts.end(); ++iter )
+    {
+        if ( iter->first == countName )
+        {
+            iter->second += count;
+            return;
+        }
+    }
+    m_counts.push_back ( make_pair ( string ( countName ), count ) );
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::addReaderCounts ( const XmlReader & xmlReader )
+{
+    addCount ( "bytes read", xmlReader.getBytesRead() );
+    addMemory ( "input text", xmlReader.getContentsBytes() );
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::addReaderCounts
+(   const DestinationsReader & destinationsReader
+)
+{
+    addReaderCounts ( static_cast< const XmlReader & > ( destinationsReader ) );
+    addMemory ( "description maps",
+                destinationsReader.getDescriptionsBytes() );
+}
+
+//----------------------------------------------------------------------------
+// The index's whole file counts as read, since the scan goes through it all,
+// and it only becomes resident as it's read. The model has no descriptions,
+// so these are the destinations indexed.
+
+void RunStatistics::addIndexCounts
+(   const DestinationsIndex & destinationsIndex
+)
+{
+    addCount ( "bytes read", destinationsIndex.getFileSize() );
+    addCount ( "destinations indexed",
+               destinationsIndex.getDestinationCount() );
+    addCount ( "destinations parsed", destinationsIndex.getParsedCount() );
+    addMemory ( "input text", destinationsIndex.getFileSize() );
+    addMemory ( "description maps", destinationsIndex.getSectionsBytes() );
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::addModelCounts ( const SiteModel & siteModel )
+{
+    addCount ( "taxonomy nodes", siteModel.getNodeCount() );
+    addCount ( "destinations indexed", siteModel.getDescriptionCount() );
+    addMemory ( "site model", siteModel.getTablesBytes() );
+}
+
+//----------------------------------------------------------------------------
+// What each owner holds, as it was when added; owners of the same name are
+// added together.
+
+void RunStatistics::addMemory
+(   const char * ownerName,
+    double bytes
+)
+{
+    if ( ! m_enabled )
+    {
+        return;
+    }
+    for ( vector< pair< string, double > >::iterator iter = m_memory.begin();
+          iter != m_memory.end(); ++iter )
+    {
+        if ( iter->first == ownerName )
+        {
+            iter->second += bytes;
+            return;
+        }
+    }
+    m_memory.push_back ( make_pair ( string ( ownerName ), bytes ) );
+}
+
+//----------------------------------------------------------------------------
+// Rendering is part of the generate phase, and was timed in whichever
+// threads it happened in, so is only known by wall time.
+
+void RunStatistics::addGeneratorCounts ( const HtmlGenerator & htmlGenerator )
+{
+    if ( ! m_enabled )
+    {
+        return;
+    }
+    const HtmlGenerator::Counts & counts = htmlGenerator.getCounts();
+    addCount ( "pages rendered", counts.m_pagesRendered );
+    addCount ( "files written", counts.m_filesWritten );
+    addCount ( "bytes written", counts.m_bytesWritten );
+    addCount ( "directories created", counts.m_directoriesCreated );
+    addMemory ( "rendering", htmlGenerator.getRenderBytes() );
+
+    if ( m_phases.empty() || m_phases.back().m_name != "render" )
+    {
+        Phase phase;
+        phase.m_name = "render";
+        phase.m_wallSeconds = 0;
+        phase.m_cpuSeconds = -1;
+        fill ( phase.m_counters,
+               phase.m_counters + PerfCounters::COUNTER_COUNT, -1.0 );
+        phase.m_allocations = -1;
+        phase.m_allocatedBytes = -1;
+        phase.m_poolBytes = -1;
+        phase.m_residentKilobytes = -1;
+        phase.m_residentGrowthKilobytes = -1;
+        phase.m_peakResidentKilobytes = -1;
+        phase.m_livePoolBytes = 0;
+        m_phases.push_back ( phase );
+    }
+    m_phases.back().m_wallSeconds += counts.m_renderSeconds;
+}
+
+//----------------------------------------------------------------------------
+
+void RunStatistics::print ( ostream & output ) const
+{
+    if ( ! m_enabled )
+    {
+        return;
+    }
+    char line[100];
+    snprintf ( line, sizeof ( line ), "%-24s %12s %12s %10s %10s %10s\n",
+               "phase", "wall (ms)", "cpu (ms)", "allocs", "alloc (KB)",
+               "pool (KB)" );
+    output << line;
+    for ( vector< Phase >::const_iterator iter = m_phases.begin();
+          iter != m_phases.end(); ++iter )
+    {
+        string name ( iter->m_name == "render" ? "  render (in generate)"
+                                               : iter->m_name );
+        if ( iter->m_cpuSeconds < 0 )
+        {
+            snprintf ( line, sizeof ( line ),
+                       "%-24s %12.3f %12s %10s %10s %10s\n",
+                       name.c_str(), iter->m_wallSeconds * 1000, "-", "-",
+                       "-", "-" );
+        }
+        else
+        {
+            snprintf ( line, sizeof ( line ),
+                       "%-24s %12.3f %12.3f %10.0f %10.1f %10.1f\n",
+                       name.c_str(), iter->m_wallSeconds * 1000,
+                       iter->m_cpuSeconds * 1000, iter->m_allocations,
+                       iter->m_allocatedBytes / 1024,
+                       iter->m_poolBytes / 1024 );
+        }
+        output << line;
+    }
+    for ( vector< pair< string, double > >::const_iterator iter =
+              m_counts.begin(); iter != m_counts.end(); ++iter )
+    {
+        snprintf ( line, sizeof ( line ), "%-24s %12.0f\n",
+                   iter->first.c_str(), iter->second );
+        output << line;
+    }
+    printAllocationsPerPage ( output );
+    printMemory ( output );
+    printPerfCounters ( output );
+}
+
+//----------------------------------------------------------------------------
+// Resident memory at the end of each phase, how much it grew in the phase,
+// the peak so far, and what RapidXml's pools held; then who holds what at
+// the end, the DOM pools included, and how much of the resident memory
+// that leaves unaccounted for (the allocator's own, the program, the
+// libraries, and whatever was freed but not given back).
+
+void RunStatistics::printMemory ( ostream & output ) const
+{
+    long residentKilobytes = -1;
+    char line[100];
+    snprintf ( line, sizeof ( line ), "%-12s %10s %11s %10s %10s\n",
+               "phase", "rss (MB)", "growth (MB)", "peak (MB)", "dom (MB)" );
+    output << line;
+    for ( vector< Phase >::const_iterator iter = m_phases.begin();
+          iter != m_phases.end(); ++iter )
+    {
+        if ( iter->m_residentKilobytes < 0 )
+        {
+            continue;       // derived, or not known here
+        }
+        residentKilobytes = iter->m_residentKilobytes;
+        snprintf ( line, sizeof ( line ),
+                   "%-12s %10.1f %+11.1f %10.1f %10.1f\n",
+                   iter->m_name.c_str(), iter->m_residentKilobytes / 1024.0,
+                   iter->m_residentGrowthKilobytes / 1024.0,
+                   iter->m_peakResidentKilobytes / 1024.0,
+                   iter->m_livePoolBytes / 1048576.0 );
+        output << line;
+    }
+
+    snprintf ( line, sizeof ( line ), "%-24s %10s\n", "memory held by",
+               "(MB)" );
+    output << line;
+    double heldBytes = 0;
+    for ( vector< pair< string, double > >::const_iterator iter =
+              m_memory.begin(); iter != m_memory.end(); ++iter )
+    {
+        snprintf ( line, sizeof ( line ), "%-24s %10.1f\n",
+                   iter->first.c_str(), iter->second / 1048576 );
+        output << line;
+        heldBytes += iter->second;
+    }
+    snprintf ( line, sizeof ( line ), "%-24s %10.1f\n", "DOM pools",
+               m_livePoolBytes / 1048576.0 );
+    output << line;
+    heldBytes += m_livePoolBytes;
+    if ( residentKilobytes >= 0 )
+    {
+        snprintf ( line, sizeof ( line ), "%-24s %10.1f\n", "unattributed",
+                   ( residentKilobytes * 1024.0 - heldBytes ) / 1048576 );
+        output << line;
+    }
+}
+
+//----------------------------------------------------------------------------
+// The generate phase's allocations spread over the pages it rendered, which
+// is what each extra temporary in rendering or writing a page shows up in.
+
+void RunStatistics::printAllocationsPerPage ( ostream & output ) const
+{
+    const Phase * generatePhase = findPhase ( "generate" );
+    double pages = getCount ( "pages rendered" );
+    if ( generatePhase == 0 || pages <= 0 )
+    {
+        return;
+    }
+    char line[80];
+    snprintf ( line, sizeof ( line ), "%-24s %12.1f\n", "allocs per page",
+               generatePhase->m_allocations / pages );
+    output << line;
+    snprintf ( line, sizeof ( line ), "%-24s %12.1f\n",
+               "alloc bytes per page",
+               generatePhase->m_allocatedBytes / pages );
+    output << line;
+}
+
+//----------------------------------------------------------------------------
+// Zero if there is no such count.
+
+double RunStatistics::getCount ( const char * countName ) const
+{
+    for ( vector< pair< string, double > >::const_iterator iter =
+              m_counts.begin(); iter != m_counts.end(); ++iter )
+    {
+        if ( iter->first == countName )
+        {
+            return iter->second;
+        }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// The first phase of the name, or 0.
+
+const RunStatistics::Phase * RunStatistics::findPhase
+(   const char * phaseName
+) const
+{
+    for ( vector< Phase >::const_iterator iter = m_phases.begin();
+          iter != m_phases.end(); ++iter )
+    {
+        if ( iter->m_name == phaseName )
+        {
+            return &*iter;
+        }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// Millions of cycles and instructions, instructions per cycle, cache and
+// branch misses as percentages of references and branches, and context
+// switches; "-" for what wasn't counted.
+
+void RunStatistics::printPerfCounters ( ostream & output ) const
+{
+    if ( m_perfCounters == 0 || ! m_perfCounters->isAnyAvailable() )
+    {
+        return;
+    }
+    char line[100];
+    snprintf ( line, sizeof ( line ), "%-12s %10s %10s %6s %8s %8s %9s\n",
+               "phase", "Mcycles", "Minstrs", "IPC", "cache%", "branch%",
+               "switches" );
+    output << line;
+    for ( vector< Phase >::const_iterator iter = m_phases.begin();
+          iter != m_phases.end(); ++iter )
+    {
+        const double * counters = iter->m_counters;
+        if ( iter->m_cpuSeconds < 0 )
+        {
+            continue;       // derived, so not counted separately
+        }
+        string fields[6];
+        char number[32];
+        if ( counters[PerfCounters::CYCLES] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.1f",
+                       counters[PerfCounters::CYCLES] / 1e6 );
+            fields[0] = number;
+        }
+        if ( counters[PerfCounters::INSTRUCTIONS] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.1f",
+                       counters[PerfCounters::INSTRUCTIONS] / 1e6 );
+            fields[1] = number;
+        }
+        if ( counters[PerfCounters::CYCLES] > 0
+             && counters[PerfCounters::INSTRUCTIONS] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.2f",
+                       counters[PerfCounters::INSTRUCTIONS]
+                       / counters[PerfCounters::CYCLES] );
+            fields[2] = number;
+        }
+        if ( counters[PerfCounters::CACHE_REFERENCES] > 0
+             && counters[PerfCounters::CACHE_MISSES] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.2f",
+                       100 * counters[PerfCounters::CACHE_MISSES]
+                       / counters[PerfCounters::CACHE_REFERENCES] );
+            fields[3] = number;
+        }
+        if ( counters[PerfCounters::BRANCHES] > 0
+             && counters[PerfCounters::BRANCH_MISSES] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.2f",
+                       100 * counters[PerfCounters::BRANCH_MISSES]
+                       / counters[PerfCounters::BRANCHES] );
+            fields[4] = number;
+        }
+        if ( counters[PerfCounters::CONTEXT_SWITCHES] >= 0 )
+        {
+            snprintf ( number, sizeof ( number ), "%.0f",
+                       counters[PerfCounters::CONTEXT_SWITCHES] );
+            fields[5] = number;
+        }
+        for ( size_t field = 0; field < 6; ++field )
+        {
+            if ( fields[field].empty() )
+            {
+                fields[field] = "-";
+            }
+        }
+        snprintf ( line, sizeof ( line ),
+                   "%-12s %10s %10s %6s %8s %8s %9s\n",
+                   iter->m_name.c_str(), fields[0].c_str(),
+                   fields[1].c_str(), fields[2].c_str(), fields[3].c_str(),
+                   fields[4].c_str(), fields[5].c_str() );
+        output << line;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Names become JSON keys with underscores for spaces. A CPU time that isn't
+// known is null.
+
+void RunStatistics::writeJson ( const char * jsonFileName ) const
+{
+    if ( ! m_enabled || jsonFileName == 0 )
+    {
+        return;
+    }
+    ofstream jsonFile ( jsonFileName, ios::out );
+    if ( ! jsonFile.is_open() )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to open statistics file " << jsonFileName
+                    << " for writing";
+        throw errorStream.str();
+    }
+
+    jsonFile << "{\n  \"phases\": [";
+    char number[32];
+    for ( vector< Phase >::const_iterator iter = m_phases.begin();
+          iter != m_phases.end(); ++iter )
+    {
+        snprintf ( number, sizeof ( number ), "%.3f",
+                   iter->m_wallSeconds * 1000 );
+        jsonFile << ( iter == m_phases.begin() ? "\n" : ",\n" )
+                 << "    { \"name\": \"" << iter->m_name
+                 << "\", \"wall_ms\": " << number << ", \"cpu_ms\": ";
+        if ( iter->m_cpuSeconds < 0 )
+        {
+            jsonFile << "null }";
+        }
+        else
+        {
+            snprintf ( number, sizeof ( number ), "%.3f",
+                       iter->m_cpuSeconds * 1000 );
+            jsonFile << number;
+            snprintf ( number, sizeof ( number ), "%.0f",
+                       iter->m_allocations );
+            jsonFile << ", \"allocations\": " << number;
+            snprintf ( number, sizeof ( number ), "%.0f",
+                       iter->m_allocatedBytes );
+            jsonFile << ", \"allocated_bytes\": " << number;
+            snprintf ( number, sizeof ( number ), "%.0f",
+                       iter->m_poolBytes );
+            jsonFile << ", \"pool_bytes\": " << number;
+            if ( iter->m_residentKilobytes >= 0 )
+            {
+                jsonFile << ", \"rss_kb\": " << iter->m_residentKilobytes
+                         << ", \"rss_growth_kb\": "
+                         << iter->m_residentGrowthKilobytes
+                         << ", \"peak_rss_kb\": "
+                         << iter->m_peakResidentKilobytes
+                         << ", \"live_pool_bytes\": "
+                         << iter->m_livePoolBytes;
+            }
+            writePerfCountersJson ( jsonFile, *iter );
+            jsonFile << " }";
+        }
+    }
+    jsonFile << "\n  ]";
+    const Phase * generatePhase = findPhase ( "generate" );
+    double pages = getCount ( "pages rendered" );
+    if ( generatePhase != 0 && pages > 0 )
+    {
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   generatePhase->m_allocations / pages );
+        jsonFile << ",\n  \"per_page\": { \"allocations\": " << number;
+        snprintf ( number, sizeof ( number ), "%.1f",
+                   generatePhase->m_allocatedBytes / pages );
+        jsonFile << ", \"allocated_bytes\": " << number << " }";
+    }
+    jsonFile << ",\n  \"memory_bytes\": {";
+    for ( vector< pair< string, double > >::const_iterator iter =
+              m_memory.begin(); iter != m_memory.end(); ++iter )
+    {
+        string key ( iter->first );
+        replace ( key.begin(), key.end(), ' ', '_' );
+        snprintf ( number, sizeof ( number ), "%.0f", iter->second );
+        jsonFile << "\n    \"" << key << "\": " << number << ",";
+    }
+    jsonFile << "\n    \"dom_pools\": " << m_livePoolBytes
+             << "\n  },\n  \"counts\": {";
+    for ( vector< pair< string, double > >::const_iterator iter =
+              m_counts.begin(); iter != m_counts.end(); ++iter )
+    {
+        string key ( iter->first );
+        replace ( key.begin(), key.end(), ' ', '_' );
+        snprintf ( number, sizeof ( number ), "%.0f", iter->second );
+        jsonFile << ( iter == m_counts.begin() ? "\n" : ",\n" )
+                 << "    \"" << key << "\": " << number;
+    }
+    jsonFile << "\n  }\n}\n";
+}
+
+//----------------------------------------------------------------------------
+// The raw counts for the phase, null where not counted.
+
+void RunStatistics::writePerfCountersJson
+(   ostream & output,
+    const Phase & phase
 ) const
 {
-    string htmlFileName ( "lp_" );
-    htmlFileName.append ( node_id->value() );
-    htmlFileName.append ( ".html" );
-    return htmlFileName;
+    if ( m_perfCounters == 0 )
+    {
+        return;
+    }
+    output << ", \"counters\": {";
+    for ( int counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter )
+    {
+        output << ( counter == 0 ? " \"" : ", \"" )
+               << PerfCounters::getName ( PerfCounters::Counter ( counter ) )
+               << "\": ";
+        if ( phase.m_counters[counter] < 0 )
+        {
+            output << "null";
+        }
+        else
+        {
+            char number[32];
+            snprintf ( number, sizeof ( number ), "%.0f",
+                       phase.m_counters[counter] );
+            output << number;
+        }
+    }
+    output << " }";
+}
+
+//----------------------------------------------------------------------------
+// VmRSS and VmHWM from /proc/self/status, in kilobytes; negative where not
+// known (not Linux).
+
+void readMemoryStatus
+(   long & residentKilobytes,
+    long & peakResidentKilobytes
+)
+{
+    residentKilobytes = -1;
+    peakResidentKilobytes = -1;
+#ifdef __linux__
+    ifstream statusFile ( "/proc/self/status", ios::in );
+    string statusLine;
+    while ( getline ( statusFile, statusLine ) )
+    {
+        if ( statusLine.compare ( 0, 6, "VmRSS:" ) == 0 )
+        {
+            residentKilobytes = atol ( statusLine.c_str() + 6 );
+        }
+        else if ( statusLine.compare ( 0, 6, "VmHWM:" ) == 0 )
+        {
+            peakResidentKilobytes = atol ( statusLine.c_str() + 6 );
+        }
+    }
+#endif
 }
 
 //============================================================================
+// Hardware counters count user space only, which is all that a
+// perf_event_paranoid of 2 allows; context switches are counted by the
+// kernel regardless. Each counter inherits into threads started later.
 
-HtmlTemplate * HtmlTemplate::createHtmlTemplate()
-{
-    static HtmlTemplate * singleton = 0;
-    if ( singleton == 0 )
-    {
-        singleton = new HtmlTemplate;
-    }
-    return singleton;
-}
-
-//----------------------------------------------------------------------------
-// I should put the template parts in an external file(s) and read them
-// (just once of course).
-// I could reduce the number of parts by having substitution points.
-
-HtmlTemplate::HtmlTemplate()
-{
-    // Oh the joys of inline C++ string constants...
-
-    m_part1 = "<!DOCTYPE html>\n\
-<html>\n\
-  <head>\n\
-    <meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">\n\
-    <title>Lonely Planet</title>\n\
-    <link href=\"static/all.css\" media=\"screen\" rel=\"stylesheet\" type=\"text/css\">\n\
-  </head>\n\
-\n\
-  <body>\n\
-    <div id=\"container\">\n\
-      <div id=\"header\">\n\
-        <div id=\"logo\"></div>\n\
-        <h1>Lonely Planet: ";
-
-    // {DESTINATION NAME}
-
-    m_part2 = "</h1>\n\
-      </div>\n\
-\n\
-      <div id=\"wrapper\">\n\
-        <div id=\"sidebar\">\n\
-          <div class=\"block\">\n\
-            <h3>Navigation</h3>\n\
-            <div class=\"content\">\n\
-              <div class=\"inner\">\n";
-
-    // HIERARCHY NAVIGATION GOES HERE
-
-    m_part3 = "\n\
-              </div>\n\
-            </div>\n\
-          </div>\n\
-        </div>\n\
-\n\
-        <div id=\"main\">\n\
-          <div class=\"block\">\n\
-            <div class=\"secondary-navigation\">\n\
-              <ul>\n\
-                <li class=\"first\"><a href=\"#\">";
-
-    // {DESTINATION NAME}
-
-    m_part4 = "</a></li>\n\
-              </ul>\n\
-              <div class=\"clear\"></div>\n\
-            </div>\n\
-            <div class=\"content\">\n\
-              <div class=\"inner\">\n";
-
-    // CONTENT GOES HERE
-
-    m_part5 = "\n\
-              </div>\n\
-            </div>\n\
-          </div>\n\
-        </div>\n\
-      </div>\n\
-    </div>\n\
-  </body>\n\
-</html>\n";
+PerfCounters::PerfCounters()
+{
+    fill ( m_descriptors, m_descriptors + COUNTER_COUNT, -1 );
+#ifdef __linux__
+    static const struct
+    {
+        uint32_t m_type;
+        uint64_t m_config;
+    } events[COUNTER_COUNT] =
+    {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+    };
+    for ( int counter = 0; counter < COUNTER_COUNT; ++counter )
+    {
+        perf_event_attr attributes;
+        memset ( &attributes, 0, sizeof ( attributes ) );
+        attributes.size = sizeof ( attributes );
+        attributes.type = events[counter].m_type;
+        attributes.config = events[counter].m_config;
+        attributes.inherit = 1;
+        attributes.exclude_kernel =
+            ( events[counter].m_type == PERF_TYPE_HARDWARE ) ? 1 : 0;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                                 | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        m_descriptors[counter] = int ( syscall ( SYS_perf_event_open,
+            &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC ) );
+        if ( m_descriptors[counter] < 0 && m_unavailableReason.empty() )
+        {
+            stringstream reasonStream;
+            reasonStream << "can't count " << getName ( Counter ( counter ) )
+                         << " (or maybe others): " << strerror ( errno );
+            m_unavailableReason = reasonStream.str();
+        }
+    }
+#else
+    m_unavailableReason = "performance counters need perf_event_open (Linux)";
+#endif
 }
+
+//----------------------------------------------------------------------------
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for ( int counter = 0; counter < COUNTER_COUNT; ++counter )
+    {
+        if ( m_descriptors[counter] >= 0 )
+        {
+            close ( m_descriptors[counter] );
+        }
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Names as in the JSON.
+
+const char * PerfCounters::getName ( Counter counter )
+{
+    static const char * const names[COUNTER_COUNT] =
+    {
+        "cycles", "instructions", "cache_references", "cache_misses",
+        "branches", "branch_misses", "context_switches"
+    };
+    return names[counter];
+}
+
+//----------------------------------------------------------------------------
+
+bool PerfCounters::isAnyAvailable() const
+{
+    for ( int counter = 0; counter < COUNTER_COUNT; ++counter )
+    {
+        if ( m_descriptors[counter] >= 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//----------------------------------------------------------------------------
+// When there are more counters than the PMU has room for, the kernel takes
+// turns with them, so each count is scaled up by how long it was enabled
+// over how long it actually ran.
+
+void PerfCounters::read ( double values[COUNTER_COUNT] ) const
+{
+    for ( int counter = 0; counter < COUNTER_COUNT; ++counter )
+    {
+        values[counter] = -1;
+#ifdef __linux__
+        uint64_t reading[3];    // value, time enabled, time running
+        if ( m_descriptors[counter] < 0
+             || ::read ( m_descriptors[counter], reading,
+                         sizeof ( reading ) ) != sizeof ( reading ) )
+        {
+            continue;
+        }
+        values[counter] = double ( reading[0] );
+        if ( reading[2] != 0 && reading[2] < reading[1] )
+        {
+            values[counter] *= double ( reading[1] ) / reading[2];
+        }
+#endif
+    }
+}
+
+#ifdef __linux__
+//============================================================================
+
+InputWatcher::InputWatcher
+(   const char * taxonomyFileName,
+    const char * destinationsFileName
+)
+{
+    m_inotifyDescriptor = inotify_init1 ( IN_CLOEXEC );
+    if ( m_inotifyDescriptor < 0 )
+    {
+        throw string ( "Failed to initialise inotify" );
+    }
+    addWatch ( taxonomyFileName, m_taxonomyFile );
+    addWatch ( destinationsFileName, m_destinationsFile );
+}
+
+//----------------------------------------------------------------------------
+
+InputWatcher::~InputWatcher()
+{
+    close ( m_inotifyDescriptor );
+}
+
+//----------------------------------------------------------------------------
+// Watch the file's directory. Both files may well be in the same one, in
+// which case inotify hands back the same watch descriptor twice.
+
+void InputWatcher::addWatch
+(   const char * fileName,
+    WatchedFile & watchedFile
+)
+{
+    string directoryName ( fileName );
+    string::size_type slash = directoryName.rfind ( '/' );
+    if ( slash == string::npos )
+    {
+        watchedFile.m_baseName = directoryName;
+        directoryName = ".";
+    }
+    else
+    {
+        watchedFile.m_baseName = directoryName.substr ( slash + 1 );
+        directoryName.erase ( slash == 0 ? 1 : slash );
+    }
+
+    watchedFile.m_watchDescriptor = inotify_add_watch ( m_inotifyDescriptor,
+        directoryName.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO );
+    if ( watchedFile.m_watchDescriptor < 0 )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to watch directory " << directoryName
+                    << " for changes to " << fileName;
+        throw errorStream.str();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Block until at least one of the files has changed, then carry on
+// collecting changes until there have been none for the debounce period, so
+// that a burst of writes is picked up once.
+
+void InputWatcher::waitForChanges
+(   int debounceMilliseconds,
+    bool & taxonomyChanged,
+    bool & destinationsChanged
+)
+{
+    taxonomyChanged = false;
+    destinationsChanged = false;
+    while ( ! taxonomyChanged && ! destinationsChanged )
+    {
+        readEvents ( -1, taxonomyChanged, destinationsChanged );
+    }
+    while ( readEvents ( debounceMilliseconds, taxonomyChanged,
+                         destinationsChanged ) )
+    {
+    }
+}
+
+//----------------------------------------------------------------------------
+// Returns false if nothing happened within the timeout (-1 means wait
+// indefinitely).
+
+bool InputWatcher::readEvents
+(   int timeoutMilliseconds,
+    bool & taxonomyChanged,
+    bool & destinationsChanged
+)
+{
+    pollfd pollDescriptor;
+    pollDescriptor.fd = m_inotifyDescriptor;
+    pollDescriptor.events = POLLIN;
+    int ready = poll ( &pollDescriptor, 1, timeoutMilliseconds );
+    if ( ready <= 0 )
+    {
+        return false;
+    }
+
+    char buffer[4096]
+        __attribute__ ( ( aligned ( __alignof__ ( inotify_event ) ) ) );
+    ssize_t length = read ( m_inotifyDescriptor, buffer, sizeof ( buffer ) );
+    if ( length <= 0 )
+    {
+        return false;
+    }
+
+    for ( const char * next = buffer; next < buffer + length; )
+    {
+        const inotify_event * event =
+            reinterpret_cast< const inotify_event * > ( next );
+        if ( event->len != 0 )
+        {
+            if ( event->wd == m_taxonomyFile.m_watchDescriptor
+                 && m_taxonomyFile.m_baseName == event->name )
+            {
+                taxonomyChanged = true;
+            }
+            if ( event->wd == m_destinationsFile.m_watchDescriptor
+                 && m_destinationsFile.m_baseName == event->name )
+            {
+                destinationsChanged = true;
+            }
+        }
+        next += sizeof ( inotify_event ) + event->len;
+    }
+    return true;
+}
+
+//============================================================================
+// Re-parse just the file(s) which changed. A new taxonomy can move any link
+// on any page, so every page is rendered again, but only those which come
+// out differently are written; new descriptions only affect their own
+// destinations' pages. Failures are reported and the file is tried again
+// on its next change, leaving the pages as they were meanwhile.
+
+void watchAndRegenerate
+(   TaxonomyReader & taxonomyReader,
+    DestinationsReader & destinationsReader,
+    SiteModel & siteModel,
+    HtmlGenerator & htmlGenerator,
+    const char * outputDirName,
+    int debounceMilliseconds
+)
+{
+    InputWatcher inputWatcher ( taxonomyReader.getFileName(),
+                                destinationsReader.getFileName() );
+    cout << "Watching for changes..." << endl;
+
+    bool taxonomyStale = false;
+    bool destinationsStale = false;
+    for ( ;; )
+    {
+        bool taxonomyChanged;
+        bool destinationsChanged;
+        inputWatcher.waitForChanges ( debounceMilliseconds, taxonomyChanged,
+                                      destinationsChanged );
+        taxonomyStale = taxonomyStale || taxonomyChanged;
+        destinationsStale = destinationsStale || destinationsChanged;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        try
+        {
+            set<int> changedNodeIds;
+            if ( destinationsStale )
+            {
+                destinationsReader.readAndParse();
+                destinationsReader.regenerateDestinationDescriptions (
+                    changedNodeIds );
+                destinationsStale = false;
+            }
+
+            size_t pagesWritten = 0;
+            if ( taxonomyStale )
+            {
+                taxonomyReader.readAndParse();
+                taxonomyStale = false;
+                siteModel.build ( taxonomyReader, destinationsReader );
+                pagesWritten = htmlGenerator.generateFiles ( outputDirName );
+            }
+            else if ( ! changedNodeIds.empty() )
+            {
+                siteModel.build ( taxonomyReader, destinationsReader );
+                pagesWritten = htmlGenerator.regenerateFiles ( changedNodeIds );
+            }
+
+            chrono::milliseconds elapsed =
+                chrono::duration_cast< chrono::milliseconds > (
+                    chrono::steady_clock::now() - start );
+            cout << "Regenerated " << pagesWritten << " page(s) in "
+                 << elapsed.count() << " ms" << endl;
+        }
+        catch ( const string & error )
+        {
+            cerr << "Caught exception: " << error << endl;
+        }
+        catch ( const parse_error & error )
+        {
+            cerr << "Parse error: " << error.what() << endl;
+        }
+    }
+}
+#endif
+
+//============================================================================
+// Look up a page, making it the most recently used. Returns a null pointer
+// if it isn't cached.
+
+shared_ptr< const string > PageCache::find ( int nodeId )
+{
+    lock_guard< mutex > lock ( m_mutex );
+    unordered_map< int, PageList::iterator >::iterator indexIter =
+        m_pageIndex.find ( nodeId );
+    if ( indexIter == m_pageIndex.end() )
+    {
+        return shared_ptr< const string >();
+    }
+    m_pages.splice ( m_pages.begin(), m_pages, indexIter->second );
+    return indexIter->second->second;
+}
+
+//----------------------------------------------------------------------------
+// Two workers may render the same page at once; the second one in just
+// replaces the first's copy.
+
+void PageCache::insert
+(   int nodeId,
+    const shared_ptr< const string > & page
+)
+{
+    if ( 0 == m_capacity )
+    {
+        return;
+    }
+
+    lock_guard< mutex > lock ( m_mutex );
+    unordered_map< int, PageList::iterator >::iterator indexIter =
+        m_pageIndex.find ( nodeId );
+    if ( indexIter != m_pageIndex.end() )
+    {
+        indexIter->second->second = page;
+        m_pages.splice ( m_pages.begin(), m_pages, indexIter->second );
+        return;
+    }
+
+    if ( m_pages.size() >= m_capacity )
+    {
+        m_pageIndex.erase ( m_pages.back().first );
+        m_pages.pop_back();
+    }
+    m_pages.push_front ( make_pair ( nodeId, page ) );
+    m_pageIndex[nodeId] = m_pages.begin();
+}
+
+#ifdef __linux__
+//============================================================================
+
+PageServer::PageServer
+(   const HtmlGenerator & htmlGenerator,
+    const char * documentRoot,
+    size_t cachePages
+) : m_htmlGenerator ( htmlGenerator ),
+    m_documentRoot ( documentRoot ),
+    m_pageCache ( cachePages ),
+    m_listenSocket ( -1 ),
+    m_epollDescriptor ( -1 )
+{
+}
+
+//----------------------------------------------------------------------------
+
+PageServer::~PageServer()
+{
+    if ( m_listenSocket >= 0 )
+    {
+        close ( m_listenSocket );
+    }
+    if ( m_epollDescriptor >= 0 )
+    {
+        close ( m_epollDescriptor );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Listen on the loopback interface only, then run the workers: this one
+// and workerCount-1 others. Doesn't return unless the event loop fails.
+
+void PageServer::serve ( int port, unsigned int workerCount )
+{
+    m_listenSocket = socket ( AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+                              SOCK_CLOEXEC, 0 );
+    int reuseAddress = 1;
+    setsockopt ( m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress,
+                 sizeof ( reuseAddress ) );
+    sockaddr_in address;
+    memset ( &address, 0, sizeof ( address ) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons ( port );
+    address.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+    if ( m_listenSocket < 0
+         || bind ( m_listenSocket, reinterpret_cast< sockaddr * > ( &address ),
+                   sizeof ( address ) ) != 0
+         || listen ( m_listenSocket, SOMAXCONN ) != 0 )
+    {
+        stringstream errorStream;
+        errorStream << "Failed to listen on port " << port << ": "
+                    << strerror ( errno );
+        throw errorStream.str();
+    }
+
+    m_epollDescriptor = epoll_create1 ( EPOLL_CLOEXEC );
+    if ( m_epollDescriptor < 0 )
+    {
+        throw string ( "Failed to create epoll instance" );
+    }
+    watchSocket ( m_listenSocket, 0, EPOLLIN, EPOLL_CTL_ADD );
+
+    cout << "Serving on http://127.0.0.1:" << port << "/ with "
+         << workerCount << " worker(s)" << endl;
+    vector< thread > workers;
+    for ( unsigned int workerNumber = 1; workerNumber < workerCount;
+          ++workerNumber )
+    {
+        workers.push_back ( thread ( &PageServer::runWorker, this ) );
+    }
+    runWorker();
+    for ( vector< thread >::iterator workerIter = workers.begin();
+          workerIter != workers.end(); ++workerIter )
+    {
+        workerIter->join();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Take one event at a time, so that a slow request holds up no others.
+
+void PageServer::runWorker()
+{
+    RenderBuffers buffers;
+    for ( ;; )
+    {
+        epoll_event event;
+        int eventCount = epoll_wait ( m_epollDescriptor, &event, 1, -1 );
+        if ( eventCount < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            cerr << "epoll_wait failed: " << strerror ( errno ) << endl;
+            return;
+        }
+        if ( 0 == eventCount )
+        {
+            continue;
+        }
+
+        Connection * connection =
+            static_cast< Connection * > ( event.data.ptr );
+        if ( 0 == connection )
+        {
+            acceptConnections();
+        }
+        else
+        {
+            handleEvent ( connection, event.events, buffers );
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Accept everything that is waiting, then listen again.
+
+void PageServer::acceptConnections()
+{
+    for ( ;; )
+    {
+        int socket = accept4 ( m_listenSocket, 0, 0,
+                               SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( socket < 0 )
+        {
+            break;
+        }
+        int noDelay = 1;
+        setsockopt ( socket, IPPROTO_TCP, TCP_NODELAY, &noDelay,
+                     sizeof ( noDelay ) );
+
+        Connection * connection = new Connection;
+        connection->m_socket = socket;
+        connection->m_outputSent = 0;
+        connection->m_closeAfterOutput = false;
+        if ( ! watchSocket ( socket, connection, EPOLLIN | EPOLLRDHUP,
+                             EPOLL_CTL_ADD ) )
+        {
+            closeConnection ( connection );
+        }
+    }
+    watchSocket ( m_listenSocket, 0, EPOLLIN, EPOLL_CTL_MOD );
+}
+
+//----------------------------------------------------------------------------
+// Finish sending any earlier responses before reading more requests, then
+// wait for whichever of those can't be done yet.
+
+void PageServer::handleEvent
+(   Connection * connection,
+    unsigned int events,
+    RenderBuffers & buffers
+)
+{
+    bool open = ( events & EPOLLERR ) == 0;
+    if ( open && ! connection->m_output.empty() )
+    {
+        open = writeOutput ( *connection );
+    }
+    if ( open && connection->m_output.empty() )
+    {
+        open = readRequests ( *connection, buffers );
+    }
+
+    if ( ! open )
+    {
+        closeConnection ( connection );
+    }
+    else
+    {
+        watchSocket ( connection->m_socket, connection,
+                      connection->m_output.empty() ? EPOLLIN | EPOLLRDHUP
+                                                   : EPOLLOUT,
+                      EPOLL_CTL_MOD );
+    }
+}
+
+//----------------------------------------------------------------------------
+// Read whatever has arrived and answer every complete request in it.
+// Returns false if the connection should be closed.
+
+bool PageServer::readRequests
+(   Connection & connection,
+    RenderBuffers & buffers
+)
+{
+    bool peerClosed = false;
+    for ( ;; )
+    {
+        char buffer[16384];
+        ssize_t length = recv ( connection.m_socket, buffer, sizeof ( buffer ),
+                                0 );
+        if ( length > 0 )
+        {
+            connection.m_input.append ( buffer, length );
+        }
+        else if ( length < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            break;
+        }
+        else if ( length < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        else
+        {
+            peerClosed = true;
+            break;
+        }
+    }
+
+    for ( ;; )
+    {
+        string::size_type requestEnd = connection.m_input.find ( "\r\n\r\n" );
+        if ( requestEnd == string::npos )
+        {
+            break;
+        }
+        handleRequest ( connection.m_input.substr ( 0, requestEnd ),
+                        connection, buffers );
+        connection.m_input.erase ( 0, requestEnd + 4 );
+        if ( connection.m_closeAfterOutput )
+        {
+            connection.m_input.clear();
+            break;
+        }
+    }
+    if ( connection.m_input.size() > 65536 )    // headers too large
+    {
+        connection.m_closeAfterOutput = true;
+        connection.m_input.clear();
+        respond ( connection, "431 Request Header Fields Too Large",
+                  "text/plain", "", 0, false );
+    }
+
+    if ( connection.m_output.empty() )
+    {
+        return ! peerClosed && ! connection.m_closeAfterOutput;
+    }
+    return writeOutput ( connection ) && ! peerClosed;
+}
+
+//----------------------------------------------------------------------------
+// Send as much as the socket will take. Returns false if the connection
+// should be closed: it failed, or everything has been sent and it was the
+// last response.
+
+bool PageServer::writeOutput ( Connection & connection )
+{
+    while ( connection.m_outputSent < connection.m_output.size() )
+    {
+        ssize_t length = send ( connection.m_socket,
+            connection.m_output.data() + connection.m_outputSent,
+            connection.m_output.size() - connection.m_outputSent,
+            MSG_NOSIGNAL );
+        if ( length > 0 )
+        {
+            connection.m_outputSent += length;
+        }
+        else if ( length < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            return true;
+        }
+        else if ( length < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    connection.m_output.clear();
+    connection.m_outputSent = 0;
+    return ! connection.m_closeAfterOutput;
+}
+
+//----------------------------------------------------------------------------
+// Only GET and HEAD, and nothing with a body. Pages are recognised by their
+// file name alone, so that links work whichever layout they were rendered
+// for; "/" is the World page.
+
+void PageServer::handleRequest
+(   const string & request,
+    Connection & connection,
+    RenderBuffers & buffers
+)
+{
+    string::size_type methodEnd = request.find ( ' ' );
+    string::size_type pathEnd = ( methodEnd == string::npos ) ? string::npos
+        : request.find ( ' ', methodEnd + 1 );
+    string::size_type lineEnd = request.find ( "\r\n" );
+    if ( pathEnd == string::npos || pathEnd > lineEnd )
+    {
+        connection.m_closeAfterOutput = true;
+        respond ( connection, "400 Bad Request", "text/plain", "", 0, false );
+        return;
+    }
+
+    string method ( request, 0, methodEnd );
+    string path ( request, methodEnd + 1, pathEnd - methodEnd - 1 );
+    string version ( request, pathEnd + 1, lineEnd - pathEnd - 1 );
+    string headers ( request, lineEnd == string::npos ? request.size()
+                                                      : lineEnd );
+    transform ( headers.begin(), headers.end(), headers.begin(), ::tolower );
+    if ( version == "HTTP/1.0"
+         ? headers.find ( "\r\nconnection: keep-alive" ) == string::npos
+         : headers.find ( "\r\nconnection: close" ) != string::npos )
+    {
+        connection.m_closeAfterOutput = true;
+    }
+
+    bool headOnly = ( method == "HEAD" );
+    if ( ! headOnly && method != "GET" )
+    {
+        connection.m_closeAfterOutput = true;   // any body is left unread
+        respond ( connection, "405 Method Not Allowed", "text/plain", "", 0,
+                  false );
+        return;
+    }
+
+    string::size_type queryStart = path.find ( '?' );
+    if ( queryStart != string::npos )
+    {
+        path.erase ( queryStart );
+    }
+
+    string fileName ( path, path.rfind ( '/' ) + 1 );
+    int nodeId = 0;
+    if ( path == "/" )
+    {
+        nodeId = 1;
+    }
+    else if ( fileName.size() > 8
+              && fileName.compare ( 0, 3, "lp_" ) == 0
+              && fileName.compare ( fileName.size() - 5, 5, ".html" ) == 0 )
+    {
+        nodeId = atoi ( fileName.c_str() + 3 );
+    }
+
+    if ( nodeId != 0 )
+    {
+        shared_ptr< const string > page;
+        bool found;
+        try
+        {
+            found = getPage ( nodeId, buffers, page );
+        }
+        catch ( const parse_error & error )
+        {
+            // A lazily indexed destination which turned out to be malformed:
+            // this page can't be had, but the rest still can.
+            cerr << "Parse error rendering page " << nodeId << ": "
+                 << error.what() << endl;
+            respond ( connection, "500 Internal Server Error", "text/plain",
+                      "", 0, headOnly );
+            return;
+        }
+        if ( found )
+        {
+            respond ( connection, "200 OK", "text/html; charset=utf-8",
+                      page->data(), page->size(), headOnly );
+            return;
+        }
+    }
+    else
+    {
+        string contents;
+        const char * contentType;
+        if ( readStaticFile ( path, contents, contentType ) )
+        {
+            respond ( connection, "200 OK", contentType, contents.data(),
+                      contents.size(), headOnly );
+            return;
+        }
+    }
+    respond ( connection, "404 Not Found", "text/plain", "", 0, headOnly );
+}
+
+//----------------------------------------------------------------------------
+// From the cache if possible, otherwise rendered into this worker's buffer
+// and then cached.
+
+bool PageServer::getPage
+(   int nodeId,
+    RenderBuffers & buffers,
+    shared_ptr< const string > & page
+)
+{
+    page = m_pageCache.find ( nodeId );
+    if ( page )
+    {
+        return true;
+    }
+    if ( ! m_htmlGenerator.renderPageForNode ( nodeId, buffers.m_page ) )
+    {
+        return false;
+    }
+    page = make_shared< const string > ( buffers.m_page );
+    m_pageCache.insert ( nodeId, page );
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// A regular file under the document root; nothing which climbs out of it.
+
+bool PageServer::readStaticFile
+(   const string & path,
+    string & contents,
+    const char * & contentType
+) const
+{
+    if ( path.empty() || path[0] != '/' || path.find ( ".." ) != string::npos )
+    {
+        return false;
+    }
+    string filePath ( m_documentRoot );
+    filePath.append ( path );
+    struct stat fileStatus;
+    if ( stat ( filePath.c_str(), &fileStatus ) != 0
+         || ! S_ISREG ( fileStatus.st_mode ) )
+    {
+        return false;
+    }
+    ifstream file ( filePath.c_str(), ios::in | ios::binary );
+    if ( ! file.is_open() )
+    {
+        return false;
+    }
+    stringstream contentStream;
+    contentStream << file.rdbuf();
+    contents = contentStream.str();
+
+    static const char * const contentTypes[][2] =
+    {
+        { ".html", "text/html; charset=utf-8" },
+        { ".css",  "text/css" },
+        { ".js",   "application/javascript" },
+        { ".png",  "image/png" },
+        { ".jpg",  "image/jpeg" },
+        { ".gif",  "image/gif" },
+        { ".svg",  "image/svg+xml" },
+        { ".ico",  "image/x-icon" }
+    };
+    contentType = "application/octet-stream";
+    string::size_type extensionStart = path.rfind ( '.' );
+    if ( extensionStart != string::npos )
+    {
+        string extension ( path, extensionStart );
+        for ( size_t inx = 0;
+              inx < sizeof ( contentTypes ) / sizeof ( contentTypes[0] );
+              ++inx )
+        {
+            if ( extension == contentTypes[inx][0] )
+            {
+                contentType = contentTypes[inx][1];
+            }
+        }
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+// Queue a response behind any others still to be sent on the connection.
+
+void PageServer::respond
+(   Connection & connection,
+    const char * status,
+    const char * contentType,
+    const char * body,
+    size_t bodyLength,
+    bool headOnly
+) const
+{
+    stringstream headerStream;
+    headerStream << "HTTP/1.1 " << status << "\r\n"
+                 << "Content-Type: " << contentType << "\r\n"
+                 << "Content-Length: " << bodyLength << "\r\n"
+                 << "Connection: "
+                 << ( connection.m_closeAfterOutput ? "close" : "keep-alive" )
+                 << "\r\n\r\n";
+    connection.m_output.append ( headerStream.str() );
+    if ( ! headOnly )
+    {
+        connection.m_output.append ( body, bodyLength );
+    }
+}
+
+//----------------------------------------------------------------------------
+// (Re-)arm a socket for one event. A null connection means the listening
+// socket.
+
+bool PageServer::watchSocket
+(   int socket,
+    Connection * connection,
+    unsigned int events,
+    int operation
+) const
+{
+    epoll_event event;
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = connection;
+    if ( epoll_ctl ( m_epollDescriptor, operation, socket, &event ) != 0 )
+    {
+        cerr << "epoll_ctl failed: " << strerror ( errno ) << endl;
+        return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+void PageServer::closeConnection ( Connection * connection ) const
+{
+    close ( connection->m_socket );     // also removes it from epoll
+    delete connection;
+}
+#endif
@@ -10,6 +10,7 @@
 #if !defined(RAPIDXML_NO_STDLIB)
     #include <cstdlib>      // For std::size_t
     #include <cassert>      // For assert
+    #include <cstring>      // For std::strchr
     #include <new>          // For placement new
 #endif
 
@@ -131,6 +132,17 @@ namespace rapidxml
     #define RAPIDXML_ALIGNMENT sizeof(void *)
 #endif
 
+///////////////////////////////////////////////////////////////////////////
+// Nesting depth
+
+#ifndef RAPIDXML_MAX_DEPTH
+    // Default maximum depth to which elements may be nested, for xml_document::parse().
+    // Define RAPIDXML_MAX_DEPTH before including rapidxml.hpp if you want to override the default value.
+    // The parser does not recurse, so it copes with any depth; this limit is for the code which walks the document afterwards.
+    // Deeper elements cause a parse_error. 0 means no limit.
+    #define RAPIDXML_MAX_DEPTH 0
+#endif
+
 namespace rapidxml
 {
     // Forward declarations
@@ -152,6 +164,37 @@ namespace rapidxml
         node_pi             //!< A PI node. Name contains target. Value contains instructions.
     };
 
+    //! Enumeration listing what an xml_filter can have the parser do with an element.
+    //! See xml_document::set_filter() function.
+    enum filter_action
+    {
+        filter_keep,        //!< Build the element and everything in it, as if there were no filter.
+        filter_select,      //!< Build the element and its attributes, and offer each child element to the filter in turn.
+        filter_transparent, //!< Build nothing for the element, its attributes or its text, but offer each child element to the filter, building any it keeps as children of the nearest element built.
+        filter_skip         //!< Build nothing for the element or anything in it.
+    };
+
+    //! Base class for filters deciding which elements the parser builds nodes for.
+    //! Derive from it and pass an instance to xml_document::set_filter().
+    //! \param Ch Character type to use.
+    template<class Ch = char>
+    class xml_filter
+    {
+    public:
+
+        virtual ~xml_filter()
+        {
+        }
+
+        //! Decides what to do with an element, once its name has been parsed.
+        //! \param parent Nearest element built so far that encloses the element, or the document.
+        //! \param name Name of the element; not zero terminated.
+        //! \param name_size Size of the name, in characters.
+        //! \param depth Depth of the element, top level elements being at 1.
+        //! \return What to build; filter_select inside a filter_transparent element is taken as filter_keep.
+        virtual filter_action filter(const xml_node<Ch> *parent, const Ch *name, std::size_t name_size, std::size_t depth) = 0;
+    };
+
     ///////////////////////////////////////////////////////////////////////
     // Parsing flags
 
@@ -315,6 +358,24 @@ namespace rapidxml
             return tmp - p;
         }
 
+        // Find next ch or the terminating zero, for skipping text nobody wants
+        template<class Ch>
+        inline Ch *find_char(Ch *text, Ch ch)
+        {
+            while (*text != ch && *text != Ch('\0'))
+                ++text;
+            return text;
+        }
+
+#if !defined(RAPIDXML_NO_STDLIB)
+        // The C library's strchr does the same 16 or 32 bytes at a time where SIMD is available
+        inline char *find_char(char *text, char ch)
+        {
+            char *found = std::strchr(text, ch);
+            return found ? found : text + std::strlen(text);
+        }
+#endif
+
         // Compare strings for equality
         template<class Ch>
         inline bool compare(const Ch *p1, std::size_t size1, const Ch *p2, std::size_t size2, bool case_sensitive)
@@ -1363,7 +1424,41 @@ namespace rapidxml
         //! Constructs empty XML document
         xml_document()
             : xml_node<Ch>(node_document)
+            , m_max_depth(RAPIDXML_MAX_DEPTH)
+            , m_filter(0)
+        {
+        }
+
+        //! Sets the filter which decides, element by element, which nodes are built by documents parsed from now on.
+        //! The text of elements not built is skipped without being looked at, beyond finding where tags are,
+        //! so parsing is faster, and uses less memory, the less is built.
+        //! Elements not built are not checked for correctness, nor are their closing tags validated.
+        //! \param filter Filter to use, or 0 (the default) to build everything. It must outlive any parsing.
+        void set_filter(xml_filter<Ch> *filter)
+        {
+            m_filter = filter;
+        }
+
+        //! Gets the filter which decides which nodes are built.
+        //! \return Filter, or 0 if everything is built.
+        xml_filter<Ch> *filter() const
+        {
+            return m_filter;
+        }
+
+        //! Sets the maximum depth to which elements may be nested in documents parsed from now on.
+        //! Top level elements are at depth 1. Any element nested deeper causes a rapidxml::parse_error.
+        //! \param max_depth Maximum depth, or 0 for no limit. Default is <code>RAPIDXML_MAX_DEPTH</code>.
+        void set_max_depth(std::size_t max_depth)
+        {
+            m_max_depth = max_depth;
+        }
+
+        //! Gets the maximum depth to which elements may be nested.
+        //! \return Maximum depth, or 0 for no limit.
+        std::size_t max_depth() const
         {
+            return m_max_depth;
         }
 
         //! Parses zero-terminated XML string according to given flags.
@@ -1401,7 +1496,9 @@ namespace rapidxml
                 if (*text == Ch('<'))
                 {
                     ++text;     // Skip '<'
-                    if (xml_node<Ch> *node = parse_node<Flags>(text))
+                    if (m_filter && text[0] != Ch('?') && text[0] != Ch('!'))
+                        parse_filtered_element<Flags>(text);
+                    else if (xml_node<Ch> *node = parse_node<Flags>(text))
                         this->append_node(node);
                 }
                 else
@@ -2032,18 +2129,35 @@ namespace rapidxml
             return cdata;
         }
         
-        // Parse element node
+        // Parse element node, with all its contents
         template<int Flags>
         xml_node<Ch> *parse_element(Ch *&text)
         {
-            // Create element node
-            xml_node<Ch> *element = this->allocate_node(node_element);
+            xml_node<Ch> *element;
+            if (parse_element_start<Flags>(text, element))
+                parse_node_contents<Flags>(text, element);
+            return element;
+        }
 
+        // Parse element node's name and attributes, up to and including > or />
+        // Returns true if the element has contents to parse, false if it was empty (/>)
+        template<int Flags>
+        bool parse_element_start(Ch *&text, xml_node<Ch> *&element)
+        {
             // Extract element name
             Ch *name = text;
             skip<node_name_pred, Flags>(text);
             if (text == name)
                 RAPIDXML_PARSE_ERROR("expected element name", text);
+            return parse_element_start_after_name<Flags>(text, name, element);
+        }
+
+        // Parse the rest of element node's start tag, once its name has been skipped
+        template<int Flags>
+        bool parse_element_start_after_name(Ch *&text, Ch *name, xml_node<Ch> *&element)
+        {
+            // Create element node
+            element = this->allocate_node(node_element);
             element->name(name, text - name);
             
             // Skip whitespace between element name and attributes or >
@@ -2053,10 +2167,11 @@ namespace rapidxml
             parse_node_attributes<Flags>(text, element);
 
             // Determine ending type
+            bool has_contents;
             if (*text == Ch('>'))
             {
                 ++text;
-                parse_node_contents<Flags>(text, element);
+                has_contents = true;
             }
             else if (*text == Ch('/'))
             {
@@ -2064,16 +2179,16 @@ namespace rapidxml
                 if (*text != Ch('>'))
                     RAPIDXML_PARSE_ERROR("expected >", text);
                 ++text;
+                has_contents = false;
             }
             else
                 RAPIDXML_PARSE_ERROR("expected >", text);
 
-            // Place zero terminator after name
+            // Place zero terminator after name; the character it overwrites has been parsed
             if (!(Flags & parse_no_string_terminators))
                 element->name()[element->name_size()] = Ch('\0');
 
-            // Return parsed element
-            return element;
+            return has_contents;
         }
 
         // Determine node type, and parse it
@@ -2162,10 +2277,15 @@ namespace rapidxml
             }
         }
 
-        // Parse contents of the node - children, data etc.
+        // Parse contents of the top level element node - children, data etc.
+        // Child elements are parsed in the same loop rather than by recursion, so that
+        // any depth of nesting can be parsed in bounded stack: node is the innermost
+        // element still open, and its parent is the one to return to when it closes.
         template<int Flags>
         void parse_node_contents(Ch *&text, xml_node<Ch> *node)
         {
+            std::size_t depth = 1;      // Depth of node, top level elements being at 1
+
             // For all children and text
             while (1)
             {
@@ -2208,11 +2328,30 @@ namespace rapidxml
                         if (*text != Ch('>'))
                             RAPIDXML_PARSE_ERROR("expected >", text);
                         ++text;     // Skip '>'
-                        return;     // Node closed, finished parsing contents
+                        if (depth == 1)
+                            return;     // Top level node closed, finished parsing contents
+                        node = node->parent();      // Carry on with the parent's contents
+                        --depth;
+                    }
+                    else if (text[1] != Ch('?') && text[1] != Ch('!'))
+                    {
+                        // Child element
+                        ++text;     // Skip '<'
+                        if (m_max_depth != 0 && depth >= m_max_depth)
+                            RAPIDXML_PARSE_ERROR("elements nested too deeply", text);
+                        xml_node<Ch> *child;
+                        bool has_contents = parse_element_start<Flags>(text, child);
+                        node->append_node(child);
+                        if (has_contents)
+                        {
+                            // Parse the child's contents next, then come back to these
+                            node = child;
+                            ++depth;
+                        }
                     }
                     else
                     {
-                        // Child node
+                        // Other child node
                         ++text;     // Skip '<'
                         if (xml_node<Ch> *child = parse_node<Flags>(text))
                             node->append_node(child);
@@ -2232,6 +2371,290 @@ namespace rapidxml
             }
         }
         
+        // Parse top level element through the filter, appending whatever is built to the document
+        template<int Flags>
+        void parse_filtered_element(Ch *&text)
+        {
+            Ch *name = text;
+            skip<node_name_pred, Flags>(text);
+            if (text == name)
+                RAPIDXML_PARSE_ERROR("expected element name", text);
+            filter_action action = m_filter->filter(this, name, text - name, 1);
+            switch (action)
+            {
+            case filter_keep:
+            case filter_select:
+                {
+                    xml_node<Ch> *element;
+                    if (parse_element_start_after_name<Flags>(text, name, element))
+                    {
+                        if (action == filter_keep)
+                            parse_node_contents<Flags>(text, element);
+                        else
+                            parse_node_contents_filtered<Flags>(text, element, 0);
+                    }
+                    this->append_node(element);
+                }
+                break;
+            case filter_transparent:
+                if (skip_element_start<Flags>(text))
+                    parse_node_contents_filtered<Flags>(text, this, 1);
+                break;
+            default:
+                if (skip_element_start<Flags>(text))
+                    skip_element_contents<Flags>(text);
+                break;
+            }
+        }
+
+        // Parse contents of the top level element node through the filter.
+        // As parse_node_contents, but each child element is offered to the filter first. node is the innermost element
+        // built that is still open (or the document), and transparent is how many elements not built are open inside it;
+        // while there are any, text is skipped rather than parsed. Inside an element kept whole, parsing carries on as
+        // normal until it closes; keep_depth is its depth, or 0 if there is none.
+        template<int Flags>
+        void parse_node_contents_filtered(Ch *&text, xml_node<Ch> *node, std::size_t transparent)
+        {
+            std::size_t depth = 1;          // Depth of innermost open element, top level elements being at 1
+            std::size_t keep_depth = 0;
+
+            // For all children and text
+            while (1)
+            {
+                Ch *contents_start = text;      // Store start of node contents before whitespace is skipped
+                if (transparent != 0 && keep_depth == 0)
+                    text = internal::find_char(text, Ch('<'));      // Skip unwanted text in one go
+                else
+                    skip<whitespace_pred, Flags>(text);
+                Ch next_char = *text;
+
+            // After data nodes, control jumps here, as in parse_node_contents()
+            after_data_node:
+
+                // Determine what comes next: node closing, child node, data node, or 0?
+                switch (next_char)
+                {
+
+                // Node closing or child node
+                case Ch('<'):
+                    if (text[1] == Ch('/'))
+                    {
+                        // Node closing
+                        text += 2;      // Skip '</'
+                        if (transparent != 0 && keep_depth == 0)
+                        {
+                            // An element not built closing; no validation, just skip name
+                            skip<node_name_pred, Flags>(text);
+                            --transparent;
+                        }
+                        else
+                        {
+                            if (Flags & parse_validate_closing_tags)
+                            {
+                                // Skip and validate closing tag name
+                                Ch *closing_name = text;
+                                skip<node_name_pred, Flags>(text);
+                                if (!internal::compare(node->name(), node->name_size(), closing_name, text - closing_name, true))
+                                    RAPIDXML_PARSE_ERROR("invalid closing tag name", text);
+                            }
+                            else
+                            {
+                                // No validation, just skip name
+                                skip<node_name_pred, Flags>(text);
+                            }
+                            if (depth == keep_depth)
+                                keep_depth = 0;
+                            node = node->parent();      // Carry on with the parent's contents
+                        }
+                        // Skip remaining whitespace after node name
+                        skip<whitespace_pred, Flags>(text);
+                        if (*text != Ch('>'))
+                            RAPIDXML_PARSE_ERROR("expected >", text);
+                        ++text;     // Skip '>'
+                        if (--depth == 0)
+                            return;     // Top level node closed, finished parsing contents
+                    }
+                    else if (text[1] != Ch('?') && text[1] != Ch('!'))
+                    {
+                        // Child element
+                        ++text;     // Skip '<'
+                        if (m_max_depth != 0 && depth >= m_max_depth)
+                            RAPIDXML_PARSE_ERROR("elements nested too deeply", text);
+                        Ch *name = text;
+                        skip<node_name_pred, Flags>(text);
+                        if (text == name)
+                            RAPIDXML_PARSE_ERROR("expected element name", text);
+                        filter_action action = filter_keep;
+                        if (keep_depth == 0)
+                        {
+                            action = m_filter->filter(node, name, text - name, depth + 1);
+                            if (action == filter_select && transparent != 0)
+                                action = filter_keep;
+                        }
+                        if (action == filter_keep || action == filter_select)
+                        {
+                            xml_node<Ch> *child;
+                            bool has_contents = parse_element_start_after_name<Flags>(text, name, child);
+                            node->append_node(child);
+                            if (has_contents)
+                            {
+                                // Parse the child's contents next, then come back to these
+                                node = child;
+                                ++depth;
+                                if (action == filter_keep && keep_depth == 0)
+                                    keep_depth = depth;
+                            }
+                        }
+                        else if (skip_element_start<Flags>(text))
+                        {
+                            if (action == filter_transparent)
+                            {
+                                // Offer the child's children to the filter next, then come back to these
+                                ++transparent;
+                                ++depth;
+                            }
+                            else
+                                skip_element_contents<Flags>(text);
+                        }
+                    }
+                    else if (transparent != 0 && keep_depth == 0)
+                    {
+                        // Other child node, of an element not built
+                        ++text;     // Skip '<'
+                        skip_other_node<Flags>(text);
+                    }
+                    else
+                    {
+                        // Other child node
+                        ++text;     // Skip '<'
+                        if (xml_node<Ch> *child = parse_node<Flags>(text))
+                            node->append_node(child);
+                    }
+                    break;
+
+                // End of data - error
+                case Ch('\0'):
+                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+
+                // Data node
+                default:
+                    next_char = parse_and_append_data<Flags>(node, text, contents_start);
+                    goto after_data_node;   // Bypass regular processing after data nodes
+
+                }
+            }
+        }
+
+        // Skip element's attributes, up to and including > or />, without building anything
+        // Returns true if the element has contents to skip, false if it was empty (/>)
+        template<int Flags>
+        bool skip_element_start(Ch *&text)
+        {
+            while (1)
+            {
+                switch (*text)
+                {
+                case Ch('>'):
+                    ++text;
+                    return true;
+                case Ch('/'):
+                    ++text;
+                    if (*text != Ch('>'))
+                        RAPIDXML_PARSE_ERROR("expected >", text);
+                    ++text;
+                    return false;
+                case Ch('\''):
+                case Ch('"'):
+                    {
+                        // Attribute values may hold > and /
+                        Ch quote = *text++;
+                        while (*text != quote)
+                        {
+                            if (*text == Ch('\0'))
+                                RAPIDXML_PARSE_ERROR("expected ' or \"", text);
+                            ++text;
+                        }
+                        ++text;     // Skip quote
+                    }
+                    break;
+                case Ch('\0'):
+                    RAPIDXML_PARSE_ERROR("expected >", text);
+                default:
+                    ++text;
+                    break;
+                }
+            }
+        }
+
+        // Skip contents of element, up to and including its closing tag, without building anything
+        // Nested elements are only counted, so that any depth can be skipped
+        template<int Flags>
+        void skip_element_contents(Ch *&text)
+        {
+            std::size_t depth = 1;
+            while (1)
+            {
+                text = internal::find_char(text, Ch('<'));
+                if (*text == Ch('\0'))
+                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                ++text;     // Skip '<'
+                if (*text == Ch('/'))
+                {
+                    // Closing tag
+                    ++text;     // Skip '/'
+                    while (*text != Ch('>'))
+                    {
+                        if (*text == Ch('\0'))
+                            RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                        ++text;
+                    }
+                    ++text;     // Skip '>'
+                    if (--depth == 0)
+                        return;
+                }
+                else if (*text == Ch('?') || *text == Ch('!'))
+                    skip_other_node<Flags>(text);
+                else if (skip_element_start<Flags>(text))
+                    ++depth;
+            }
+        }
+
+        // Skip PI, comment, CDATA or other <! node, from the character after <, without building anything
+        template<int Flags>
+        void skip_other_node(Ch *&text)
+        {
+            const Ch *terminator = 0;
+            if (text[0] == Ch('?'))
+                terminator = question_terminator();
+            else if (text[1] == Ch('-') && text[2] == Ch('-'))
+                terminator = comment_terminator();
+            else if (text[1] == Ch('[') && text[2] == Ch('C') && text[3] == Ch('D') && text[4] == Ch('A') &&
+                     text[5] == Ch('T') && text[6] == Ch('A') && text[7] == Ch('['))
+                terminator = cdata_terminator();
+            else
+                terminator = bracket_terminator();
+            while (1)
+            {
+                text = internal::find_char(text, terminator[0]);
+                if (*text == Ch('\0'))
+                    RAPIDXML_PARSE_ERROR("unexpected end of data", text);
+                std::size_t matched = 0;
+                while (terminator[matched] != Ch('\0') && text[matched] == terminator[matched])
+                    ++matched;
+                if (terminator[matched] == Ch('\0'))
+                {
+                    text += matched;
+                    return;
+                }
+                ++text;
+            }
+        }
+
+        static const Ch *question_terminator() { static const Ch terminator[] = { Ch('?'), Ch('>'), Ch('\0') }; return terminator; }
+        static const Ch *comment_terminator() { static const Ch terminator[] = { Ch('-'), Ch('-'), Ch('>'), Ch('\0') }; return terminator; }
+        static const Ch *cdata_terminator() { static const Ch terminator[] = { Ch(']'), Ch(']'), Ch('>'), Ch('\0') }; return terminator; }
+        static const Ch *bracket_terminator() { static const Ch terminator[] = { Ch('>'), Ch('\0') }; return terminator; }
+
         // Parse XML attributes of the node
         template<int Flags>
         void parse_node_attributes(Ch *&text, xml_node<Ch> *node)
@@ -2297,6 +2720,9 @@ namespace rapidxml
             }
         }
 
+        std::size_t m_max_depth;        // Maximum depth to which elements may be nested, or 0 for no limit
+        xml_filter<Ch> *m_filter;       // Decides which elements are built, or 0 for all of them
+
     };
 
     //! \cond internal
@@ -8,12 +8,30 @@
 
 #include "rapidxml.hpp"
 
+#if !defined(RAPIDXML_NO_STDLIB)
+    #include <cstring>      // For std::memcpy
+#endif
+
 // Only include streams if not disabled
 #ifndef RAPIDXML_NO_STREAMS
     #include <ostream>
     #include <iterator>
 #endif
 
+// Use SIMD to find characters needing expansion, unless disabled
+#if !defined(RAPIDXML_NO_SIMD)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define RAPIDXML_SIMD_WIDTH 32
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define RAPIDXML_SIMD_WIDTH 16
+    #endif
+    #if defined(RAPIDXML_SIMD_WIDTH) && defined(_MSC_VER)
+        #include <intrin.h>
+    #endif
+#endif
+
 namespace rapidxml
 {
 
@@ -40,42 +58,123 @@ namespace rapidxml
                 *out++ = *begin++;
             return out;
         }
-        
+
+        // Copy characters from given range to given output pointer in bulk
+        template<class Ch>
+        inline Ch *copy_chars(const Ch *begin, const Ch *end, Ch *out)
+        {
+#if !defined(RAPIDXML_NO_STDLIB)
+            std::size_t size = end - begin;
+            if (size != 0)
+                std::memcpy(out, begin, size * sizeof(Ch));
+            return out + size;
+#else
+            while (begin != end)
+                *out++ = *begin++;
+            return out;
+#endif
+        }
+
+        // Is character one which copy_and_expand_chars expands?
+        template<class Ch>
+        inline bool is_expandable_char(Ch ch, Ch noexpand)
+        {
+            return ch != noexpand &&
+                   (ch == Ch('<') || ch == Ch('>') || ch == Ch('\'') || ch == Ch('"') || ch == Ch('&'));
+        }
+
+        // Find first character in given range which copy_and_expand_chars expands, or end
+        template<class Ch>
+        inline const Ch *find_expandable_char(const Ch *begin, const Ch *end, Ch noexpand)
+        {
+            while (begin != end && !is_expandable_char(*begin, noexpand))
+                ++begin;
+            return begin;
+        }
+
+#ifdef RAPIDXML_SIMD_WIDTH
+        // Index of lowest set bit of nonzero mask
+        inline unsigned lowest_set_bit(unsigned mask)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return index;
+#else
+            return __builtin_ctz(mask);
+#endif
+        }
+
+        // Find first character in given range which copy_and_expand_chars expands, or end.
+        // Compares RAPIDXML_SIMD_WIDTH characters at a time against all five expandable characters.
+        inline const char *find_expandable_char(const char *begin, const char *end, char noexpand)
+        {
+#if RAPIDXML_SIMD_WIDTH == 32
+            const __m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>'), apos = _mm256_set1_epi8('\'');
+            const __m256i quot = _mm256_set1_epi8('"'), amp = _mm256_set1_epi8('&'), skip = _mm256_set1_epi8(noexpand);
+            while (end - begin >= 32)
+            {
+                __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+                __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt), _mm256_cmpeq_epi8(chunk, gt)),
+                                               _mm256_or_si256(_mm256_cmpeq_epi8(chunk, apos), _mm256_cmpeq_epi8(chunk, quot)));
+                hits = _mm256_andnot_si256(_mm256_cmpeq_epi8(chunk, skip), _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, amp)));
+                unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hits));
+                if (mask != 0)
+                    return begin + lowest_set_bit(mask);
+                begin += 32;
+            }
+#else
+            const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), apos = _mm_set1_epi8('\'');
+            const __m128i quot = _mm_set1_epi8('"'), amp = _mm_set1_epi8('&'), skip = _mm_set1_epi8(noexpand);
+            while (end - begin >= 16)
+            {
+                __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+                __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, lt), _mm_cmpeq_epi8(chunk, gt)),
+                                            _mm_or_si128(_mm_cmpeq_epi8(chunk, apos), _mm_cmpeq_epi8(chunk, quot)));
+                hits = _mm_andnot_si128(_mm_cmpeq_epi8(chunk, skip), _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, amp)));
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+                if (mask != 0)
+                    return begin + lowest_set_bit(mask);
+                begin += 16;
+            }
+#endif
+            while (begin != end && !is_expandable_char(*begin, noexpand))
+                ++begin;
+            return begin;
+        }
+#endif
+
         // Copy characters from given range to given output iterator and expand
-        // characters into references (&lt; &gt; &apos; &quot; &amp;)
+        // characters into references (&lt; &gt; &apos; &quot; &amp;).
+        // Runs of characters needing no expansion are found by find_expandable_char and copied in one go.
         template<class OutIt, class Ch>
         inline OutIt copy_and_expand_chars(const Ch *begin, const Ch *end, Ch noexpand, OutIt out)
         {
             while (begin != end)
             {
-                if (*begin == noexpand)
+                const Ch *expandable = find_expandable_char(begin, end, noexpand);
+                out = copy_chars(begin, expandable, out);
+                if (expandable == end)
+                    break;
+                switch (*expandable)
                 {
-                    *out++ = *begin;    // No expansion, copy character
+                case Ch('<'):
+                    *out++ = Ch('&'); *out++ = Ch('l'); *out++ = Ch('t'); *out++ = Ch(';');
+                    break;
+                case Ch('>'): 
+                    *out++ = Ch('&'); *out++ = Ch('g'); *out++ = Ch('t'); *out++ = Ch(';');
+                    break;
+                case Ch('\''): 
+                    *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('p'); *out++ = Ch('o'); *out++ = Ch('s'); *out++ = Ch(';');
+                    break;
+                case Ch('"'): 
+                    *out++ = Ch('&'); *out++ = Ch('q'); *out++ = Ch('u'); *out++ = Ch('o'); *out++ = Ch('t'); *out++ = Ch(';');
+                    break;
+                case Ch('&'): 
+                    *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('m'); *out++ = Ch('p'); *out++ = Ch(';'); 
+                    break;
                 }
-                else
-                {
-                    switch (*begin)
-                    {
-                    case Ch('<'):
-                        *out++ = Ch('&'); *out++ = Ch('l'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('>'): 
-                        *out++ = Ch('&'); *out++ = Ch('g'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('\''): 
-                        *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('p'); *out++ = Ch('o'); *out++ = Ch('s'); *out++ = Ch(';');
-                        break;
-                    case Ch('"'): 
-                        *out++ = Ch('&'); *out++ = Ch('q'); *out++ = Ch('u'); *out++ = Ch('o'); *out++ = Ch('t'); *out++ = Ch(';');
-                        break;
-                    case Ch('&'): 
-                        *out++ = Ch('&'); *out++ = Ch('a'); *out++ = Ch('m'); *out++ = Ch('p'); *out++ = Ch(';'); 
-                        break;
-                    default:
-                        *out++ = *begin;    // No expansion, copy character
-                    }
-                }
-                ++begin;    // Step to next character
+                begin = expandable + 1;    // Step past expanded character
             }
             return out;
         }
@@ -101,6 +200,16 @@ namespace rapidxml
 
         ///////////////////////////////////////////////////////////////////////////
         // Internal printing operations
+
+        // Forward declarations, needed by compilers doing two-phase lookup
+        template<class OutIt, class Ch> inline OutIt print_children(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_element_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_data_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_cdata_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_declaration_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_comment_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_doctype_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
+        template<class OutIt, class Ch> inline OutIt print_pi_node(OutIt out, const xml_node<Ch> *node, int flags, int indent);
     
         // Print node
         template<class OutIt, class Ch>